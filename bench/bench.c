@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "common_macros.h"
+
+uint32_t bench_max_keys = 1u << 24;
+uint32_t bench_max_entities = 1u << 20;
+
+static char **bench_filters;
+static int bench_num_filters;
+
+void bench_samples_add(struct bench_samples *s, uint64_t ns, uint64_t ops) {
+  if (s->num >= s->cap) {
+    s->cap = s->cap ? s->cap * 2 : 1024;
+    s->samples = realloc(s->samples, s->cap * sizeof(struct bench_sample));
+  }
+
+  s->samples[s->num++] = (struct bench_sample){ns, ops};
+}
+
+bool bench_selected(const char *name) {
+  bool selected = bench_num_filters == 0;
+
+  for (int i = 0; i < bench_num_filters && !selected; i++) {
+    selected = strstr(name, bench_filters[i]) != NULL;
+  }
+
+  return selected;
+}
+
+bool bench_begin(const char *name) {
+  if (!bench_selected(name)) {
+    return false;
+  }
+
+  // start a new high water mark from the current RSS, kernels before 4.0 keep
+  // the old one
+  FILE *f = fopen("/proc/self/clear_refs", "w");
+  if (f != NULL) {
+    fputs("5", f);
+    fclose(f);
+  }
+
+  return true;
+}
+
+static uint64_t bench__peak_rss_kb(void) {
+  FILE *f = fopen("/proc/self/status", "r");
+  char line[256];
+  uint64_t kb = 0;
+
+  while (f != NULL && fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "VmHWM: %lu kB", &kb) == 1) {
+      fclose(f);
+      return kb;
+    }
+  }
+
+  if (f != NULL) {
+    fclose(f);
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (uint64_t)usage.ru_maxrss;
+}
+
+static int bench__compare_doubles(const void *a, const void *b) {
+  double da = *(const double *)a;
+  double db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+void bench_report(const char *name, const char *variant, uint64_t n,
+                  struct bench_samples *s) {
+  if (s->num == 0) {
+    return;
+  }
+
+  double *per_op = malloc(s->num * sizeof(double));
+  uint64_t total_ns = 0;
+  uint64_t total_ops = 0;
+
+  for (uint32_t i = 0; i < s->num; i++) {
+    total_ns += s->samples[i].ns;
+    total_ops += s->samples[i].ops;
+    per_op[i] = (double)s->samples[i].ns / (double)s->samples[i].ops;
+  }
+
+  qsort(per_op, s->num, sizeof(double), &bench__compare_doubles);
+
+#define BENCH__PERCENTILE(P) per_op[(uint32_t)((s->num - 1) * (P) / 100)]
+  printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"n\":%lu,\"ops\":%lu,"
+         "\"ns_per_op\":%.2f,\"p50_ns\":%.2f,\"p90_ns\":%.2f,\"p99_ns\":%.2f,"
+         "\"max_ns\":%.2f,\"peak_rss_kb\":%lu}\n",
+         name, variant, n, total_ops, (double)total_ns / (double)total_ops,
+         BENCH__PERCENTILE(50), BENCH__PERCENTILE(90), BENCH__PERCENTILE(99),
+         per_op[s->num - 1], bench__peak_rss_kb());
+#undef BENCH__PERCENTILE
+  fflush(stdout);
+
+  free(per_op);
+  s->num = 0;
+}
+
+static void bench__usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [--max-keys N] [--max-entities N] [FILTER...]\n"
+          "Runs the benchmarks whose name contains one of the filters, all of "
+          "them\nwithout any, and prints one JSON object per result.\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  bench_filters = malloc(argc * sizeof(char *));
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--max-keys") && i + 1 < argc) {
+      bench_max_keys = strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--max-entities") && i + 1 < argc) {
+      bench_max_entities = strtoul(argv[++i], NULL, 0);
+    } else if (argv[i][0] == '-') {
+      bench__usage(argv[0]);
+    } else {
+      bench_filters[bench_num_filters++] = argv[i];
+    }
+  }
+
+  if (bench_max_entities == 0 || bench_max_entities >= 1u << 24) {
+    RUNTIME_ERROR("--max-entities has to be between 1 and %u", (1u << 24) - 1);
+  }
+
+  bench_hash_run();
+  bench_join_run();
+  bench_frame_run();
+  bench_spatial_run();
+
+  free(bench_filters);
+  return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef __BENCH_H_
+#define __BENCH_H_
+
+// Benchmark harness: timed samples of some number of operations each, reported
+// as one JSON object per line on stdout
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+struct bench_sample {
+  uint64_t ns;
+  uint64_t ops;
+};
+
+struct bench_samples {
+  struct bench_sample *samples;
+  uint32_t num;
+  uint32_t cap;
+};
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Bijective mix of an index, for ids spread over the whole key space.
+ */
+static inline uint32_t bench_mix(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x85ebca6b;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35;
+  x ^= x >> 16;
+  return x;
+}
+
+void bench_samples_add(struct bench_samples *s, uint64_t ns, uint64_t ops);
+
+/**
+ * Whether the benchmark `name` was selected on the command line.
+ */
+bool bench_selected(const char *name);
+
+/**
+ * bench_selected, also starts measuring the peak RSS anew if it was.
+ */
+bool bench_begin(const char *name);
+
+/**
+ * Print a result line: total ns per op, the percentiles of the per-op time of
+ * the samples and the peak RSS since bench_begin. Clears the samples.
+ */
+void bench_report(const char *name, const char *variant, uint64_t n,
+                  struct bench_samples *s);
+
+// largest key count of the hash table benchmarks
+extern uint32_t bench_max_keys;
+// entity count of the join and frame benchmarks
+extern uint32_t bench_max_entities;
+
+void bench_hash_run(void);
+void bench_join_run(void);
+void bench_frame_run(void);
+void bench_spatial_run(void);
+
+#endif // __BENCH_H_
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "component.h"
+#include "entity.h"
+#include "system.h"
+
+// the example of the Readme
+
+struct position_storage {
+  int32_t x, y;
+};
+
+DEFINE_COMPONENT(position, struct position_storage);
+REGISTER_COMPONENT(position, struct position_storage);
+
+struct velocity_storage {
+  int32_t dx, dy;
+};
+
+DEFINE_COMPONENT(velocity, struct velocity_storage);
+REGISTER_COMPONENT(velocity, struct velocity_storage);
+
+REGISTER_SYSTEM(update_velocty_values, {
+  FOR_JOIN_COMPONENT_2(position, velocity, d, {
+    d.position->x += d.velocity->dx;
+    d.position->y += d.velocity->dy;
+  });
+});
+
+// entities destroyed and spawned again every frame, in percent
+static const uint32_t bench_frame_churns[] = {0, 1, 10};
+static const uint32_t bench_frame_min_frames = 20;
+static const uint32_t bench_frame_min_updates = 1u << 24;
+// spawns or destroys timed together as one sample
+static const uint32_t bench_frame_batch = 1024;
+
+static uint32_t bench_frame__spawn(uint32_t i) {
+  uint32_t ent = new_entity_id();
+  position.add_value(ent, (struct position_storage){0, 0});
+
+  // a quarter of them stand still
+  if (i % 4) {
+    velocity.add_value(ent, (struct velocity_storage){1, 2});
+  }
+
+  return ent;
+}
+
+static void bench_frame__churn(struct bench_samples *samples, uint32_t n) {
+  uint32_t *ids = malloc(n * sizeof(uint32_t));
+
+  for (uint32_t start = 0; start < n; start += bench_frame_batch) {
+    uint32_t end =
+        start + bench_frame_batch < n ? start + bench_frame_batch : n;
+    uint64_t t = bench_now_ns();
+    for (uint32_t i = start; i < end; i++) {
+      ids[i] = bench_frame__spawn(i);
+    }
+    bench_samples_add(samples, bench_now_ns() - t, end - start);
+  }
+  bench_report("churn/spawn", "position+velocity", n, samples);
+
+  for (uint32_t start = 0; start < n; start += bench_frame_batch) {
+    uint32_t end =
+        start + bench_frame_batch < n ? start + bench_frame_batch : n;
+    uint64_t t = bench_now_ns();
+    for (uint32_t i = start; i < end; i++) {
+      destroy_entity(ids[i]);
+    }
+    bench_samples_add(samples, bench_now_ns() - t, end - start);
+  }
+  bench_report("churn/destroy", "position+velocity", n, samples);
+
+  free(ids);
+}
+
+static void bench_frame__frames(struct bench_samples *samples, uint32_t n,
+                                uint32_t churn) {
+  uint32_t *ids = malloc(n * sizeof(uint32_t));
+  uint32_t frames = bench_frame_min_updates / n;
+  uint32_t per_frame = (uint64_t)n * churn / 100;
+  uint32_t next = 0;
+  char variant[64];
+
+  if (frames < bench_frame_min_frames) {
+    frames = bench_frame_min_frames;
+  }
+
+  for (uint32_t i = 0; i < n; i++) {
+    ids[i] = bench_frame__spawn(i);
+  }
+
+  // once so the first frame doesn't pay for the setup
+  run_systems();
+
+  for (uint32_t frame = 0; frame < frames; frame++) {
+    uint64_t t = bench_now_ns();
+
+    for (uint32_t i = 0; i < per_frame; i++) {
+      uint32_t idx = bench_mix(next++) % n;
+      destroy_entity(ids[idx]);
+      ids[idx] = bench_frame__spawn(idx);
+    }
+
+    run_systems();
+    bench_samples_add(samples, bench_now_ns() - t, 1);
+  }
+
+  snprintf(variant, sizeof(variant), "churn=%u%%", churn);
+  bench_report("frame/run_systems", variant, n, samples);
+
+  for (uint32_t i = 0; i < n; i++) {
+    destroy_entity(ids[i]);
+  }
+  free(ids);
+}
+
+void bench_frame_run(void) {
+  struct bench_samples samples = {0};
+
+  for (uint32_t shift = 14; shift <= 20; shift += 3) {
+    uint32_t n = 1u << shift;
+
+    if (n > bench_max_entities) {
+      break;
+    }
+
+    if (bench_begin("churn")) {
+      bench_frame__churn(&samples, n);
+    }
+
+    for (uint32_t c = 0;
+         c < sizeof(bench_frame_churns) / sizeof(bench_frame_churns[0]); c++) {
+      if (bench_begin("frame/run_systems")) {
+        bench_frame__frames(&samples, n, bench_frame_churns[c]);
+      }
+    }
+  }
+
+  free(samples.samples);
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "hash_set.h"
+#include "hash_table.h"
+
+DEFINE_HASH(uint32_t, bench_u32);
+MAKE_HASH(uint32_t, bench_u32);
+
+// operations timed together as one sample
+static const uint32_t bench_hash_batch = 1024;
+
+static volatile uint32_t bench_hash_sink;
+
+static void bench_hash__keys(uint32_t *keys, uint32_t n, bool random) {
+  for (uint32_t i = 0; i < n; i++) {
+    keys[i] = random ? bench_mix(i) : i;
+  }
+}
+
+// time OP over every key of `keys` in batches
+#define BENCH_HASH__TIMED(SAMPLES, KEYS, N, OP)                                \
+  for (uint32_t start = 0; start < (N); start += bench_hash_batch) {           \
+    uint32_t end =                                                             \
+        start + bench_hash_batch < (N) ? start + bench_hash_batch : (N);       \
+    uint64_t t = bench_now_ns();                                               \
+    for (uint32_t i = start; i < end; i++) {                                   \
+      uint32_t k = (KEYS)[i];                                                  \
+      OP;                                                                      \
+    }                                                                          \
+    bench_samples_add((SAMPLES), bench_now_ns() - t, end - start);             \
+  }
+
+static void bench_hash__table(const uint32_t *keys, uint32_t n,
+                              const char *variant,
+                              struct bench_samples *samples) {
+  struct hash_table_bench_u32 *table = hash_table_bench_u32_new();
+  uint32_t found = 0;
+
+  BENCH_HASH__TIMED(samples, keys, n,
+                    hash_table_bench_u32_insert(table, k, i));
+  bench_report("hash_table/insert", variant, n, samples);
+
+  BENCH_HASH__TIMED(samples, keys, n,
+                    found += hash_table_bench_u32_lookup(table, k) != NULL);
+  bench_report("hash_table/lookup", variant, n, samples);
+
+  // as many keys, (almost) none of them in the table
+  BENCH_HASH__TIMED(samples, keys, n,
+                    found += hash_table_bench_u32_lookup(table, ~k) != NULL);
+  bench_report("hash_table/lookup_miss", variant, n, samples);
+
+  BENCH_HASH__TIMED(samples, keys, n, hash_table_bench_u32_delete(table, k));
+  bench_report("hash_table/delete", variant, n, samples);
+
+  bench_hash_sink = found;
+  hash_table_bench_u32_free(table);
+  free(table);
+}
+
+static void bench_hash__set(const uint32_t *keys, uint32_t n,
+                            const char *variant,
+                            struct bench_samples *samples) {
+  struct hash_set *set = hash_set_new();
+  uint32_t found = 0;
+
+  BENCH_HASH__TIMED(samples, keys, n, hash_set_insert(set, k));
+  bench_report("hash_set/insert", variant, n, samples);
+
+  BENCH_HASH__TIMED(samples, keys, n, found += hash_set_contains(set, k));
+  bench_report("hash_set/lookup", variant, n, samples);
+
+  BENCH_HASH__TIMED(samples, keys, n, found += hash_set_contains(set, ~k));
+  bench_report("hash_set/lookup_miss", variant, n, samples);
+
+  BENCH_HASH__TIMED(samples, keys, n, hash_set_delete(set, k));
+  bench_report("hash_set/delete", variant, n, samples);
+
+  bench_hash_sink = found;
+  hash_set_free(set);
+  free(set);
+}
+
+void bench_hash_run(void) {
+  struct bench_samples samples = {0};
+  uint32_t *keys = malloc((size_t)bench_max_keys * sizeof(uint32_t));
+
+  // 1K to 16M keys, 16 times more each step
+  for (uint32_t shift = 10; shift <= 24; shift += shift < 22 ? 4 : 2) {
+    uint32_t n = 1u << shift;
+
+    if (n > bench_max_keys) {
+      break;
+    }
+
+    for (int random = 0; random < 2; random++) {
+      const char *variant = random ? "random" : "sequential";
+      bench_hash__keys(keys, n, random);
+
+      if (bench_begin("hash_table")) {
+        bench_hash__table(keys, n, variant, &samples);
+      }
+
+      if (bench_begin("hash_set")) {
+        bench_hash__set(keys, n, variant, &samples);
+      }
+    }
+  }
+
+  free(keys);
+  free(samples.samples);
+}
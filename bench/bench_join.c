@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "component.h"
+#include "entity.h"
+#include "query.h"
+
+struct bench_join_vec {
+  float x, y, z;
+};
+
+DEFINE_COMPONENT(bench_join_a, struct bench_join_vec);
+REGISTER_COMPONENT(bench_join_a, struct bench_join_vec);
+DEFINE_COMPONENT(bench_join_b, struct bench_join_vec);
+REGISTER_COMPONENT(bench_join_b, struct bench_join_vec);
+DEFINE_COMPONENT(bench_join_c, float);
+REGISTER_COMPONENT(bench_join_c, float);
+DEFINE_TAG(bench_join_t);
+REGISTER_TAG(bench_join_t);
+
+REGISTER_QUERY(bench_join_ab, (bench_join_a, bench_join_b));
+
+// fraction of the entities with a that also have b and c, in percent
+static const uint32_t bench_join_overlaps[] = {1, 10, 50, 100};
+// every pass over the join is one sample, at least this many of them
+static const uint32_t bench_join_min_passes = 20;
+static const uint32_t bench_join_min_visits = 1u << 24;
+
+static volatile float bench_join_sink;
+
+static uint32_t *bench_join__spawn(uint32_t n, uint32_t overlap) {
+  uint32_t *ids = malloc(n * sizeof(uint32_t));
+  struct bench_join_vec *vecs = malloc(n * sizeof(struct bench_join_vec));
+  float *floats = malloc(n * sizeof(float));
+  uint32_t num_both = 0;
+
+  for (uint32_t i = 0; i < n; i++) {
+    ids[i] = new_entity_id();
+    vecs[i] = (struct bench_join_vec){i, i, i};
+    floats[i] = i;
+  }
+
+  bench_join_a.reserve(n);
+  bench_join_a.add_values(ids, vecs, n);
+
+  // the ones that have the others spread over the whole range
+  uint32_t *both = malloc(n * sizeof(uint32_t));
+  for (uint32_t i = 0; i < n; i++) {
+    if (bench_mix(i) % 100 < overlap) {
+      both[num_both++] = ids[i];
+    }
+  }
+
+  bench_join_b.reserve(num_both);
+  bench_join_b.add_values(both, vecs, num_both);
+  bench_join_c.reserve(num_both);
+  bench_join_c.add_values(both, floats, num_both);
+  for (uint32_t i = 0; i < num_both; i++) {
+    ADD_TAG(bench_join_t, both[i]);
+  }
+
+  free(both);
+  free(vecs);
+  free(floats);
+  return ids;
+}
+
+static uint32_t bench_join__passes(uint32_t visits) {
+  uint32_t passes = bench_join_min_visits / (visits ? visits : 1);
+  return passes > bench_join_min_passes ? passes : bench_join_min_passes;
+}
+
+// time BODY, a full walk that visits VISITS entities, enough times
+#define BENCH_JOIN__TIMED(SAMPLES, VISITS, BODY)                               \
+  for (uint32_t pass = 0; pass < bench_join__passes(VISITS); pass++) {         \
+    uint64_t t = bench_now_ns();                                               \
+    BODY;                                                                      \
+    bench_samples_add((SAMPLES), bench_now_ns() - t, (VISITS) ? (VISITS) : 1); \
+  }
+
+void bench_join_run(void) {
+  struct bench_samples samples = {0};
+  char variant[64];
+
+  for (uint32_t shift = 14; shift <= 20; shift += 3) {
+    uint32_t n = 1u << shift;
+
+    if (n > bench_max_entities) {
+      break;
+    }
+
+    for (uint32_t o = 0;
+         o < sizeof(bench_join_overlaps) / sizeof(bench_join_overlaps[0]);
+         o++) {
+      uint32_t overlap = bench_join_overlaps[o];
+      bool iter = overlap == 100 && bench_selected("join/iter");
+      bool join_2 = bench_selected("join/2way");
+      bool join_3 = bench_selected("join/3way");
+      bool query = bench_selected("join/query");
+      bool tag = bench_selected("join/tag");
+      bool bitset = bench_selected("join/bitset");
+
+      if (!iter && !join_2 && !join_3 && !query && !tag && !bitset) {
+        continue;
+      }
+
+      uint32_t *ids = bench_join__spawn(n, overlap);
+      uint32_t num_both = bench_join_b.storage->num_elems;
+      float sum = 0;
+      snprintf(variant, sizeof(variant), "overlap=%u%%", overlap);
+
+      if (iter && bench_begin("join/iter")) {
+        BENCH_JOIN__TIMED(&samples, n, FOR_JOIN_COMPONENT_1(bench_join_a, it, {
+                            sum += it.bench_join_a->x;
+                          }));
+        bench_report("join/iter", "all", n, &samples);
+      }
+
+      if (join_2 && bench_begin("join/2way")) {
+        BENCH_JOIN__TIMED(&samples, num_both,
+                          FOR_JOIN_COMPONENT_2(bench_join_a, bench_join_b, it, {
+                            it.bench_join_a->x += it.bench_join_b->x;
+                          }));
+        bench_report("join/2way", variant, n, &samples);
+      }
+
+      if (join_3 && bench_begin("join/3way")) {
+        BENCH_JOIN__TIMED(&samples, num_both,
+                          FOR_JOIN_COMPONENT_3(bench_join_a, bench_join_b,
+                                               bench_join_c, it, {
+                                                 it.bench_join_a->x +=
+                                                     it.bench_join_b->x *
+                                                     *it.bench_join_c;
+                                               }));
+        bench_report("join/3way", variant, n, &samples);
+      }
+
+      // the same as the 2 way join, from the cached matches
+      if (query && bench_begin("join/query")) {
+        BENCH_JOIN__TIMED(&samples, num_both, FOR_QUERY(bench_join_ab, it, {
+                            it.bench_join_a->x += it.bench_join_b->x;
+                          }));
+        bench_report("join/query", variant, n, &samples);
+      }
+
+      // the same as the 2 way join, with b's membership as a tag
+      if (tag && bench_begin("join/tag")) {
+        BENCH_JOIN__TIMED(&samples, num_both,
+                          FOR_JOIN_COMPONENT_2(bench_join_a, bench_join_t, it, {
+                            it.bench_join_a->x += 1;
+                          }));
+        bench_report("join/tag", variant, n, &samples);
+      }
+
+      // the same as the 3 way join, intersecting the presence bits first
+      if (bitset && bench_begin("join/bitset")) {
+        BENCH_JOIN__TIMED(
+            &samples, num_both,
+            FOR_JOIN_BITSET_COMPONENTS((bench_join_a, bench_join_b,
+                                        bench_join_c),
+                                       it, {
+                                         it.bench_join_a->x +=
+                                             it.bench_join_b->x *
+                                             *it.bench_join_c;
+                                       }));
+        bench_report("join/bitset", variant, n, &samples);
+      }
+
+      bench_join_sink = sum;
+
+      for (uint32_t i = 0; i < n; i++) {
+        destroy_entity(ids[i]);
+      }
+      free(ids);
+    }
+  }
+
+  free(samples.samples);
+}
@@ -0,0 +1,198 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "component.h"
+#include "entity.h"
+#include "spatial.h"
+
+struct bench_spatial_pos {
+  float x, y;
+};
+
+DEFINE_COMPONENT_WITH_STORAGE(bench_spatial_p, struct bench_spatial_pos,
+                              sparse_set);
+REGISTER_COMPONENT_WITH_STORAGE(bench_spatial_p, struct bench_spatial_pos,
+                                sparse_set);
+DEFINE_SPATIAL_POSITION(bench_spatial_p, x, y);
+
+// entities are spread over a square with this much room for each, so a query
+// finds about as many neighbours whatever the count
+static const float bench_spatial_area_per_entity = 100;
+static const float bench_spatial_radius = 20;
+static const uint32_t bench_spatial_k = 8;
+// queries timed together as one sample
+static const uint32_t bench_spatial_batch = 1024;
+static const uint32_t bench_spatial_min_queries = 1u << 18;
+// the scan visits every entity per query, it gets fewer of them
+static const uint32_t bench_spatial_scan_queries = 256;
+static const uint32_t bench_spatial_frames = 20;
+
+static volatile uint32_t bench_spatial_sink;
+
+static float bench_spatial__coord(uint32_t i, float side) {
+  return (float)(bench_mix(i) % 1000000) / 1000000 * side;
+}
+
+static struct bench_spatial_pos bench_spatial__query(uint32_t i, float side) {
+  return (struct bench_spatial_pos){bench_spatial__coord(2 * i + 1, side),
+                                    bench_spatial__coord(2 * i + 2, side)};
+}
+
+static void bench_spatial__radius(struct bench_samples *samples,
+                                  struct spatial_index *index, float side) {
+  uint32_t found = 0;
+
+  for (uint32_t start = 0; start < bench_spatial_min_queries;
+       start += bench_spatial_batch) {
+    uint64_t t = bench_now_ns();
+    for (uint32_t i = start; i < start + bench_spatial_batch; i++) {
+      struct bench_spatial_pos q = bench_spatial__query(i, side);
+      FOR_SPATIAL_RADIUS(index, ((struct spatial_point){q.x, q.y}),
+                         bench_spatial_radius, ent, pos, {
+                           (void)pos;
+                           found += ent;
+                         });
+    }
+    bench_samples_add(samples, bench_now_ns() - t, bench_spatial_batch);
+  }
+
+  bench_spatial_sink = found;
+}
+
+static void bench_spatial__nearest(struct bench_samples *samples,
+                                   struct spatial_index *index, float side) {
+  uint32_t ids[bench_spatial_k];
+  uint32_t found = 0;
+
+  for (uint32_t start = 0; start < bench_spatial_min_queries;
+       start += bench_spatial_batch) {
+    uint64_t t = bench_now_ns();
+    for (uint32_t i = start; i < start + bench_spatial_batch; i++) {
+      struct bench_spatial_pos q = bench_spatial__query(i, side);
+      found += spatial_nearest(index, (struct spatial_point){q.x, q.y},
+                               bench_spatial_k, INFINITY, ids);
+    }
+    bench_samples_add(samples, bench_now_ns() - t, bench_spatial_batch);
+  }
+
+  bench_spatial_sink = found;
+}
+
+// every entity takes a step, then the index catches up
+static void bench_spatial__update(struct bench_samples *samples,
+                                  struct spatial_index *index, uint32_t n) {
+  for (uint32_t frame = 0; frame < bench_spatial_frames; frame++) {
+    FOR_JOIN_COMPONENT_1(bench_spatial_p, it, {
+      it.bench_spatial_p->x += (float)(bench_mix(it.id + frame) % 3) - 1;
+      it.bench_spatial_p->y += (float)(bench_mix(it.id - frame) % 3) - 1;
+      MARK_CHANGED(bench_spatial_p, it.id);
+    });
+
+    uint64_t t = bench_now_ns();
+    spatial_index_update(index);
+    bench_samples_add(samples, bench_now_ns() - t, n);
+  }
+}
+
+static void bench_spatial__index(struct bench_samples *samples,
+                                 struct spatial_index *index,
+                                 const char *variant, uint32_t n, float side) {
+  if (bench_begin("spatial/build")) {
+    uint64_t t = bench_now_ns();
+    spatial_index_update(index);
+    bench_samples_add(samples, bench_now_ns() - t, n);
+    bench_report("spatial/build", variant, n, samples);
+  } else {
+    spatial_index_update(index);
+  }
+
+  if (bench_begin("spatial/radius")) {
+    bench_spatial__radius(samples, index, side);
+    bench_report("spatial/radius", variant, n, samples);
+  }
+
+  if (bench_begin("spatial/nearest")) {
+    bench_spatial__nearest(samples, index, side);
+    bench_report("spatial/nearest", variant, n, samples);
+  }
+
+  if (bench_begin("spatial/update")) {
+    bench_spatial__update(samples, index, n);
+    bench_report("spatial/update", variant, n, samples);
+  }
+
+  spatial_index_free(index);
+}
+
+void bench_spatial_run(void) {
+  struct bench_samples samples = {0};
+
+  if (!bench_selected("spatial")) {
+    return;
+  }
+
+  for (uint32_t shift = 14; shift <= 20; shift += 3) {
+    uint32_t n = 1u << shift;
+
+    if (n > bench_max_entities) {
+      break;
+    }
+
+    float side = sqrtf(n * bench_spatial_area_per_entity);
+    uint32_t *ids = malloc(n * sizeof(uint32_t));
+    struct bench_spatial_pos *positions =
+        malloc(n * sizeof(struct bench_spatial_pos));
+
+    for (uint32_t i = 0; i < n; i++) {
+      ids[i] = new_entity_id();
+      positions[i] = (struct bench_spatial_pos){
+          bench_spatial__coord(2 * i, side),
+          bench_spatial__coord(2 * i + 1, side),
+      };
+    }
+
+    bench_spatial_p.reserve(n);
+    bench_spatial_p.add_values(ids, positions, n);
+
+    // what the index saves: a walk over every entity per query
+    if (bench_begin("spatial/radius")) {
+      uint32_t found = 0;
+      for (uint32_t i = 0; i < bench_spatial_scan_queries; i++) {
+        struct bench_spatial_pos q = bench_spatial__query(i, side);
+        uint64_t t = bench_now_ns();
+        FOR_JOIN_COMPONENT_1(bench_spatial_p, it, {
+          float dx = it.bench_spatial_p->x - q.x;
+          float dy = it.bench_spatial_p->y - q.y;
+          found += dx * dx + dy * dy <=
+                   bench_spatial_radius * bench_spatial_radius;
+        });
+        bench_samples_add(&samples, bench_now_ns() - t, 1);
+      }
+      bench_spatial_sink = found;
+      bench_report("spatial/radius", "scan", n, &samples);
+    }
+
+    bench_spatial__index(
+        &samples,
+        spatial_grid_new(bench_spatial_p.id, &spatial_position_bench_spatial_p,
+                         bench_spatial_radius),
+        "grid", n, side);
+    bench_spatial__index(
+        &samples,
+        spatial_quadtree_new(bench_spatial_p.id,
+                             &spatial_position_bench_spatial_p,
+                             (struct spatial_point){0, 0},
+                             (struct spatial_point){side, side}),
+        "quadtree", n, side);
+
+    for (uint32_t i = 0; i < n; i++) {
+      destroy_entity(ids[i]);
+    }
+    free(ids);
+    free(positions);
+  }
+
+  free(samples.samples);
+}
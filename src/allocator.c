@@ -0,0 +1,404 @@
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "common_macros.h"
+
+static void *allocator_heap__alloc(void *ctx, size_t size) {
+  return malloc(size);
+}
+
+static void *allocator_heap__realloc(void *ctx, void *ptr, size_t old_size,
+                                     size_t new_size) {
+  return realloc(ptr, new_size);
+}
+
+static void allocator_heap__free(void *ctx, void *ptr, size_t size) {
+  free(ptr);
+}
+
+const struct allocator allocator_heap = {
+    &allocator_heap__alloc,
+    &allocator_heap__realloc,
+    &allocator_heap__free,
+    NULL,
+};
+
+struct allocator_arena_chunk {
+  struct allocator_arena_chunk *next;
+  size_t size;
+  size_t used;
+  alignas(16) uint8_t data[];
+};
+
+static size_t allocator__round_up(size_t size, size_t to) {
+  return (size + to - 1) & ~(to - 1);
+}
+
+static struct allocator_arena_chunk *
+allocator_arena__new_chunk(struct allocator_arena *arena, size_t size) {
+  struct allocator_arena_chunk *chunk =
+      malloc(sizeof(struct allocator_arena_chunk) + size);
+
+  if (chunk == NULL) {
+    RUNTIME_ERROR("Failed to allocate an arena chunk of %zu bytes", size);
+  }
+
+  chunk->next = arena->chunks;
+  chunk->size = size;
+  chunk->used = 0;
+  arena->chunks = chunk;
+  return chunk;
+}
+
+static void *allocator_arena__alloc(void *ctx, size_t size) {
+  struct allocator_arena *arena = ctx;
+  struct allocator_arena_chunk *chunk = arena->chunks;
+  size = allocator__round_up(size, 16);
+
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    // chunks double, so a frame only needs a handful of them
+    size_t chunk_size = chunk ? chunk->size * 2 : ALLOCATOR_ARENA_CHUNK_SIZE;
+    chunk = allocator_arena__new_chunk(arena,
+                                       chunk_size > size ? chunk_size : size);
+  }
+
+  void *ptr = &chunk->data[chunk->used];
+  chunk->used += size;
+  arena->last = ptr;
+  return ptr;
+}
+
+static void *allocator_arena__realloc(void *ctx, void *ptr, size_t old_size,
+                                      size_t new_size) {
+  struct allocator_arena *arena = ctx;
+  struct allocator_arena_chunk *chunk = arena->chunks;
+
+  if (ptr == NULL) {
+    return allocator_arena__alloc(ctx, new_size);
+  }
+
+  if (ptr == arena->last) {
+    size_t start = (uint8_t *)ptr - chunk->data;
+    size_t size = allocator__round_up(new_size, 16);
+
+    if (chunk->size - start >= size) {
+      chunk->used = start + size;
+      return ptr;
+    }
+  } else if (new_size <= old_size) {
+    return ptr;
+  }
+
+  void *moved = allocator_arena__alloc(ctx, new_size);
+  memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+  return moved;
+}
+
+static void allocator_arena__free(void *ctx, void *ptr, size_t size) {
+  struct allocator_arena *arena = ctx;
+
+  // only the last allocation can be given back before the reset
+  if (ptr == arena->last) {
+    arena->chunks->used = (uint8_t *)ptr - arena->chunks->data;
+    arena->last = NULL;
+  }
+}
+
+void allocator_arena_init(struct allocator_arena *arena) {
+  *arena = (struct allocator_arena){
+      .allocator = {&allocator_arena__alloc, &allocator_arena__realloc,
+                    &allocator_arena__free, arena},
+  };
+}
+
+void allocator_arena_reset(struct allocator_arena *arena) {
+  struct allocator_arena_chunk *chunk = arena->chunks;
+  arena->last = NULL;
+
+  if (chunk == NULL) {
+    return;
+  }
+
+  if (chunk->next == NULL) {
+    chunk->used = 0;
+    return;
+  }
+
+  size_t total = 0;
+  while (chunk != NULL) {
+    struct allocator_arena_chunk *next = chunk->next;
+    total += chunk->size;
+    free(chunk);
+    chunk = next;
+  }
+
+  arena->chunks = NULL;
+  allocator_arena__new_chunk(arena, total);
+}
+
+void allocator_arena_destroy(struct allocator_arena *arena) {
+  struct allocator_arena_chunk *chunk = arena->chunks;
+
+  while (chunk != NULL) {
+    struct allocator_arena_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  arena->chunks = NULL;
+  arena->last = NULL;
+}
+
+struct allocator_pool_slab {
+  struct allocator_pool_slab *next;
+};
+
+// the slab header takes up a whole line, so the blocks after it stay aligned
+#define ALLOCATOR_POOL_SLAB_HEADER 64
+
+static uint32_t allocator_pool__class(size_t size) {
+  if (size <= ALLOCATOR_POOL_MIN_SIZE) {
+    return 0;
+  }
+
+  return 64 - __builtin_clzl(size - 1) - ALLOCATOR_POOL_MIN_SHIFT;
+}
+
+static size_t allocator_pool__class_size(uint32_t class) {
+  return ALLOCATOR_POOL_MIN_SIZE << class;
+}
+
+static void allocator_pool__push(struct allocator_pool *pool, uint32_t class,
+                                 void *block) {
+  *(void **)block = pool->free_lists[class];
+  pool->free_lists[class] = block;
+}
+
+// carve a block of `class` out of the newest slab, the rest of a slab too
+// small for it goes on the free lists of the smaller classes
+static void *allocator_pool__carve(struct allocator_pool *pool,
+                                   uint32_t class) {
+  size_t size = allocator_pool__class_size(class);
+
+  if (pool->slab_left < size) {
+    for (int32_t c = class - 1; c >= 0; c--) {
+      if (pool->slab_left >= allocator_pool__class_size(c)) {
+        allocator_pool__push(pool, c, pool->slab_next);
+        pool->slab_next += allocator_pool__class_size(c);
+        pool->slab_left -= allocator_pool__class_size(c);
+      }
+    }
+
+    struct allocator_pool_slab *slab =
+        aligned_alloc(ALLOCATOR_POOL_SLAB_HEADER, ALLOCATOR_POOL_SLAB_SIZE);
+
+    if (slab == NULL) {
+      RUNTIME_ERROR("Failed to allocate a pool slab");
+    }
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_next = (uint8_t *)slab + ALLOCATOR_POOL_SLAB_HEADER;
+    pool->slab_left = ALLOCATOR_POOL_SLAB_SIZE - ALLOCATOR_POOL_SLAB_HEADER;
+  }
+
+  void *block = pool->slab_next;
+  pool->slab_next += size;
+  pool->slab_left -= size;
+  return block;
+}
+
+void *allocator_pool__alloc(void *ctx, size_t size) {
+  struct allocator_pool *pool = ctx;
+
+  if (size > ALLOCATOR_POOL_MAX_SIZE) {
+    void *ptr = aligned_alloc(64, allocator__round_up(size, 64));
+
+    if (ptr == NULL) {
+      RUNTIME_ERROR("Failed to allocate %zu bytes", size);
+    }
+
+    return ptr;
+  }
+
+  uint32_t class = allocator_pool__class(size);
+  void *block;
+
+  pthread_mutex_lock(&pool->lock);
+  block = pool->free_lists[class];
+
+  if (block != NULL) {
+    pool->free_lists[class] = *(void **)block;
+  } else {
+    block = allocator_pool__carve(pool, class);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  return block;
+}
+
+void *allocator_pool__realloc(void *ctx, void *ptr, size_t old_size,
+                              size_t new_size) {
+  if (ptr == NULL) {
+    return allocator_pool__alloc(ctx, new_size);
+  }
+
+  if (old_size <= ALLOCATOR_POOL_MAX_SIZE &&
+      new_size <= ALLOCATOR_POOL_MAX_SIZE &&
+      allocator_pool__class(old_size) == allocator_pool__class(new_size)) {
+    return ptr;
+  }
+
+  void *moved = allocator_pool__alloc(ctx, new_size);
+  memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+  allocator_pool__free(ctx, ptr, old_size);
+  return moved;
+}
+
+void allocator_pool__free(void *ctx, void *ptr, size_t size) {
+  struct allocator_pool *pool = ctx;
+
+  if (size > ALLOCATOR_POOL_MAX_SIZE) {
+    free(ptr);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  allocator_pool__push(pool, allocator_pool__class(size), ptr);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void allocator_pool_init(struct allocator_pool *pool) {
+  *pool = (struct allocator_pool)ALLOCATOR_POOL_INIT(*pool);
+}
+
+void allocator_pool_destroy(struct allocator_pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+
+  struct allocator_pool_slab *slab = pool->slabs;
+  while (slab != NULL) {
+    struct allocator_pool_slab *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+
+  memset(pool->free_lists, 0, sizeof(pool->free_lists));
+  pool->slabs = NULL;
+  pool->slab_next = NULL;
+  pool->slab_left = 0;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static size_t allocator_vm__page_size(void) {
+  static size_t page_size;
+
+  if (page_size == 0) {
+    page_size = sysconf(_SC_PAGESIZE);
+  }
+
+  return page_size;
+}
+
+static size_t allocator_vm__reserved(struct allocator_vm *vm) {
+  return allocator__round_up(vm->reserve_size,
+                             vm->huge_pages ? ALLOCATOR_VM_HUGE_PAGE_SIZE
+                                            : allocator_vm__page_size());
+}
+
+// bytes of a block of `size` that are committed, whole huge pages once it's
+// past the size of one so they can be backed by one
+static size_t allocator_vm__committed(struct allocator_vm *vm, size_t size) {
+  size_t granule = vm->huge_pages && size >= ALLOCATOR_VM_HUGE_PAGE_SIZE
+                       ? ALLOCATOR_VM_HUGE_PAGE_SIZE
+                       : allocator_vm__page_size();
+  return allocator__round_up(size ? size : 1, granule);
+}
+
+void *allocator_vm__alloc(void *ctx, size_t size) {
+  struct allocator_vm *vm = ctx;
+  size_t reserved = allocator_vm__reserved(vm);
+
+  if (size > reserved) {
+    RUNTIME_ERROR("Allocating %zu bytes, past the %zu reserved for a block",
+                  size, reserved);
+  }
+
+  // reserved with room to spare, so the range can be aligned to a huge page
+  size_t slack = vm->huge_pages ? ALLOCATOR_VM_HUGE_PAGE_SIZE : 0;
+  uint8_t *range = mmap(NULL, reserved + slack, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (range == MAP_FAILED) {
+    RUNTIME_ERROR("Failed to reserve %zu bytes", reserved);
+  }
+
+  uint8_t *block = range;
+
+  if (vm->huge_pages) {
+    block = (uint8_t *)allocator__round_up((uintptr_t)range,
+                                           ALLOCATOR_VM_HUGE_PAGE_SIZE);
+
+    if (block > range) {
+      munmap(range, block - range);
+    }
+
+    if (block + reserved < range + reserved + slack) {
+      munmap(block + reserved, range + slack - block);
+    }
+
+    madvise(block, reserved, MADV_HUGEPAGE);
+  }
+
+  if (mprotect(block, allocator_vm__committed(vm, size),
+               PROT_READ | PROT_WRITE)) {
+    RUNTIME_ERROR("Failed to commit %zu bytes", size);
+  }
+
+  return block;
+}
+
+void *allocator_vm__realloc(void *ctx, void *ptr, size_t old_size,
+                            size_t new_size) {
+  struct allocator_vm *vm = ctx;
+
+  if (ptr == NULL) {
+    return allocator_vm__alloc(ctx, new_size);
+  }
+
+  if (new_size > allocator_vm__reserved(vm)) {
+    RUNTIME_ERROR("Growing a block to %zu bytes, past the %zu reserved for it",
+                  new_size, allocator_vm__reserved(vm));
+  }
+
+  size_t old_committed = allocator_vm__committed(vm, old_size);
+  size_t new_committed = allocator_vm__committed(vm, new_size);
+  uint8_t *block = ptr;
+
+  if (new_committed > old_committed &&
+      mprotect(block + old_committed, new_committed - old_committed,
+               PROT_READ | PROT_WRITE)) {
+    RUNTIME_ERROR("Failed to commit %zu bytes", new_size);
+  }
+
+  // shrinking hands the pages back but keeps the range reserved
+  if (new_committed < old_committed) {
+    madvise(block + new_committed, old_committed - new_committed,
+            MADV_DONTNEED);
+    mprotect(block + new_committed, old_committed - new_committed, PROT_NONE);
+  }
+
+  return ptr;
+}
+
+void allocator_vm__free(void *ctx, void *ptr, size_t size) {
+  munmap(ptr, allocator_vm__reserved(ctx));
+}
+
+void allocator_vm_init(struct allocator_vm *vm, size_t reserve_size,
+                       bool huge_pages) {
+  *vm = (struct allocator_vm)ALLOCATOR_VM_INIT(*vm, reserve_size, huge_pages);
+}
@@ -0,0 +1,180 @@
+#ifndef __ALLOCATOR_H_
+#define __ALLOCATOR_H_
+
+// Allocators the containers get their memory from: the heap, a bump arena for
+// scratch data that's dropped all at once, a pool of size classes for arrays
+// that get grown and freed over and over, and reserved virtual ranges for big
+// arrays that should grow in place
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Where a container allocates. Frees and reallocs are given the size the block
+ * was allocated with, so allocators don't need to keep it in a header.
+ */
+struct allocator {
+  void *(*alloc)(void *ctx, size_t size);
+  void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+  void (*free)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+};
+
+/**
+ * malloc, realloc and free, what the containers use unless they're given
+ * another allocator.
+ */
+extern const struct allocator allocator_heap;
+
+static inline void *allocator_alloc(const struct allocator *a, size_t size) {
+  return a->alloc(a->ctx, size);
+}
+
+static inline void *allocator_calloc(const struct allocator *a, size_t size) {
+  void *ptr = a->alloc(a->ctx, size);
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+static inline void *allocator_realloc(const struct allocator *a, void *ptr,
+                                      size_t old_size, size_t new_size) {
+  return a->realloc(a->ctx, ptr, old_size, new_size);
+}
+
+static inline void allocator_free(const struct allocator *a, void *ptr,
+                                  size_t size) {
+  if (ptr != NULL) {
+    a->free(a->ctx, ptr, size);
+  }
+}
+
+// size an arena's chunks start at
+#ifndef ALLOCATOR_ARENA_CHUNK_SIZE
+#define ALLOCATOR_ARENA_CHUNK_SIZE (64 * 1024)
+#endif
+
+struct allocator_arena_chunk;
+
+/**
+ * Bump allocator for scratch data, e.g. a frame's: allocations are carved one
+ * after the other out of chunks and only given back all at once by
+ * allocator_arena_reset. Not thread safe, use one per thread.
+ */
+struct allocator_arena {
+  struct allocator allocator;
+  // the chunk being carved from, followed by the filled ones
+  struct allocator_arena_chunk *chunks;
+  // last allocation, reallocs of it grow in place
+  void *last;
+};
+
+void allocator_arena_init(struct allocator_arena *arena);
+
+/**
+ * Give back everything allocated from the arena. Its memory is kept as a
+ * single chunk big enough for all of it, so the next frame's allocations don't
+ * have to allocate any more chunks.
+ */
+void allocator_arena_reset(struct allocator_arena *arena);
+
+void allocator_arena_destroy(struct allocator_arena *arena);
+
+// size classes of a pool are the powers of two from ALLOCATOR_POOL_MIN_SIZE to
+// ALLOCATOR_POOL_MAX_SIZE, bigger blocks come straight from the heap
+#define ALLOCATOR_POOL_MIN_SHIFT 6
+#define ALLOCATOR_POOL_MAX_SHIFT 20
+#define ALLOCATOR_POOL_MIN_SIZE (1ul << ALLOCATOR_POOL_MIN_SHIFT)
+#define ALLOCATOR_POOL_MAX_SIZE (1ul << ALLOCATOR_POOL_MAX_SHIFT)
+#define ALLOCATOR_POOL_NUM_CLASSES                                             \
+  (ALLOCATOR_POOL_MAX_SHIFT - ALLOCATOR_POOL_MIN_SHIFT + 1)
+// blocks are carved out of slabs this big
+#define ALLOCATOR_POOL_SLAB_SIZE (4ul << 20)
+
+struct allocator_pool_slab;
+
+/**
+ * Size class pool, for the arrays of tables that keep doubling: freed blocks
+ * go on a free list of their class and are handed out again, instead of
+ * going back to the heap. Blocks are 64 byte aligned and the memory is only
+ * given back by allocator_pool_destroy. Thread safe.
+ */
+struct allocator_pool {
+  struct allocator allocator;
+  pthread_mutex_t lock;
+  void *free_lists[ALLOCATOR_POOL_NUM_CLASSES];
+  struct allocator_pool_slab *slabs;
+  // part of the newest slab not handed out yet
+  uint8_t *slab_next;
+  size_t slab_left;
+};
+
+void *allocator_pool__alloc(void *ctx, size_t size);
+void *allocator_pool__realloc(void *ctx, void *ptr, size_t old_size,
+                              size_t new_size);
+void allocator_pool__free(void *ctx, void *ptr, size_t size);
+
+/**
+ * Static initializer of the pool `POOL`, so pools can be handed to components
+ * before main runs:
+ *
+ * static struct allocator_pool tables = ALLOCATOR_POOL_INIT(tables);
+ */
+#define ALLOCATOR_POOL_INIT(POOL)                                              \
+  {                                                                            \
+    .allocator = {&allocator_pool__alloc, &allocator_pool__realloc,            \
+                  &allocator_pool__free, &(POOL)},                             \
+    .lock = PTHREAD_MUTEX_INITIALIZER,                                         \
+  }
+
+void allocator_pool_init(struct allocator_pool *pool);
+
+/**
+ * Free every slab of the pool, whatever is still allocated from it included.
+ */
+void allocator_pool_destroy(struct allocator_pool *pool);
+
+// granule of huge pages, reservations of allocators using them are aligned to
+// it and commits past it are rounded up to it
+#define ALLOCATOR_VM_HUGE_PAGE_SIZE (2ul << 20)
+
+/**
+ * Every block gets a virtual range of its own, reserved up front with no
+ * access and committed page by page as it's reallocated bigger: a block never
+ * moves, so growing it never copies and pointers into it stay valid for as
+ * long as it's allocated. Meant for a few big arrays, e.g. a long lived vector,
+ * every block takes up a mapping of its own. Don't give it to a component's
+ * storage: storages allocate their small parts from it too (a sparse set's
+ * every index page), and each of those would reserve a whole range.
+ */
+struct allocator_vm {
+  struct allocator allocator;
+  // bytes reserved for every block, blocks can't grow past it
+  size_t reserve_size;
+  // ask for transparent huge pages (madvise) for the blocks' ranges
+  bool huge_pages;
+};
+
+void *allocator_vm__alloc(void *ctx, size_t size);
+void *allocator_vm__realloc(void *ctx, void *ptr, size_t old_size,
+                            size_t new_size);
+void allocator_vm__free(void *ctx, void *ptr, size_t size);
+
+/**
+ * Static initializer of the allocator `VM`, see ALLOCATOR_POOL_INIT:
+ *
+ * static struct allocator_vm big = ALLOCATOR_VM_INIT(big, 1ul << 34, true);
+ */
+#define ALLOCATOR_VM_INIT(VM, RESERVE_SIZE, HUGE_PAGES)                        \
+  {                                                                            \
+    .allocator = {&allocator_vm__alloc, &allocator_vm__realloc,                \
+                  &allocator_vm__free, &(VM)},                                 \
+    .reserve_size = (RESERVE_SIZE), .huge_pages = (HUGE_PAGES),                \
+  }
+
+void allocator_vm_init(struct allocator_vm *vm, size_t reserve_size,
+                       bool huge_pages);
+
+#endif // __ALLOCATOR_H_
@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "archetype.h"
+#include "common_macros.h"
+#include "sparse_set.h"
+#include "world.h"
+
+static const uint32_t archetype_initial_cap = 16;
+static const uint32_t archetype_none = UINT32_MAX;
+
+struct archetype_record {
+  uint32_t archetype;
+  uint32_t row;
+};
+
+DEFINE_SPARSE_SET(struct archetype_record, archetype_record);
+MAKE_SPARSE_SET(struct archetype_record, archetype_record);
+
+struct archetype_world {
+  struct archetype **archetypes;
+  uint32_t num_archetypes;
+  uint32_t cap;
+  struct sparse_set_archetype_record *records;
+};
+
+// value size of every archetype component, the same in every world
+static size_t archetype_elem_sizes[COMPONENT_MAX];
+static bool archetype_components[COMPONENT_MAX];
+
+void archetype_register_component(uint32_t component_id, size_t elem_size) {
+  if (component_id >= COMPONENT_MAX) {
+    RUNTIME_ERROR("Component id %u is over the maximum of %d", component_id,
+                  COMPONENT_MAX);
+  }
+
+  // registered again by every new world, which may be on another thread
+  if (archetype_elem_sizes[component_id] != elem_size) {
+    archetype_elem_sizes[component_id] = elem_size;
+  }
+
+  if (!archetype_components[component_id]) {
+    archetype_components[component_id] = true;
+  }
+}
+
+bool archetype_is_component(uint32_t component_id) {
+  return component_id < COMPONENT_MAX && archetype_components[component_id];
+}
+
+void archetype__world_init(struct world *world) {
+  world->archetypes = calloc(1, sizeof(struct archetype_world));
+  world->archetypes->records = sparse_set_archetype_record_new();
+}
+
+void archetype__world_free(struct world *world) {
+  struct archetype_world *archetypes = world->archetypes;
+
+  for (uint32_t i = 0; i < archetypes->num_archetypes; i++) {
+    struct archetype *arch = archetypes->archetypes[i];
+
+    for (uint32_t c = 0; c < arch->num_columns; c++) {
+      free(arch->columns[c]);
+    }
+
+    free(arch->columns);
+    free(arch->component_ids);
+    free(arch->entities);
+    free(arch);
+  }
+
+  free(archetypes->archetypes);
+  sparse_set_archetype_record_free(archetypes->records);
+  free(archetypes->records);
+  free(archetypes);
+}
+
+static struct archetype_world *archetype__world(void) {
+  return world_current()->archetypes;
+}
+
+static uint32_t archetype__new(struct archetype_world *archetypes,
+                               const struct component_signature *signature) {
+  struct archetype *arch = malloc(sizeof(struct archetype));
+  arch->signature = *signature;
+  arch->num_columns = 0;
+  arch->num_rows = 0;
+  arch->cap = archetype_initial_cap;
+
+  for (uint32_t id = 0; id < COMPONENT_MAX; id++) {
+    if (component_signature_has(signature, id)) {
+      arch->num_columns++;
+    }
+
+    arch->add_edge[id] = archetype_none;
+    arch->remove_edge[id] = archetype_none;
+  }
+
+  arch->component_ids = malloc(arch->num_columns * sizeof(uint32_t));
+  arch->columns = malloc(arch->num_columns * sizeof(uint8_t *));
+  arch->entities = malloc(arch->cap * sizeof(uint32_t));
+
+  uint32_t column = 0;
+  for (uint32_t id = 0; id < COMPONENT_MAX; id++) {
+    if (component_signature_has(signature, id)) {
+      arch->component_ids[column] = id;
+      arch->columns[column] = malloc(arch->cap * archetype_elem_sizes[id]);
+      arch->column_of[id] = column;
+      column++;
+    }
+  }
+
+  if (archetypes->num_archetypes >= archetypes->cap) {
+    archetypes->cap = archetypes->cap ? archetypes->cap * 2 : 16;
+    archetypes->archetypes =
+        realloc(archetypes->archetypes,
+                archetypes->cap * sizeof(struct archetype *));
+  }
+
+  archetypes->archetypes[archetypes->num_archetypes] = arch;
+  return archetypes->num_archetypes++;
+}
+
+static uint32_t
+archetype__find_or_new(struct archetype_world *archetypes,
+                       const struct component_signature *signature) {
+  for (uint32_t i = 0; i < archetypes->num_archetypes; i++) {
+    if (component_signature_equals(&archetypes->archetypes[i]->signature,
+                                   signature)) {
+      return i;
+    }
+  }
+
+  return archetype__new(archetypes, signature);
+}
+
+static uint32_t archetype__with(struct archetype_world *archetypes,
+                                uint32_t from, uint32_t component_id) {
+  struct archetype *arch = archetypes->archetypes[from];
+
+  if (arch->add_edge[component_id] == archetype_none) {
+    struct component_signature signature = arch->signature;
+    component_signature_set(&signature, component_id);
+    arch->add_edge[component_id] =
+        archetype__find_or_new(archetypes, &signature);
+  }
+
+  return arch->add_edge[component_id];
+}
+
+static uint32_t archetype__without(struct archetype_world *archetypes,
+                                   uint32_t from, uint32_t component_id) {
+  struct archetype *arch = archetypes->archetypes[from];
+
+  if (arch->remove_edge[component_id] == archetype_none) {
+    struct component_signature signature = arch->signature;
+    component_signature_clear(&signature, component_id);
+    arch->remove_edge[component_id] =
+        archetype__find_or_new(archetypes, &signature);
+  }
+
+  return arch->remove_edge[component_id];
+}
+
+static void *archetype__cell(struct archetype *arch, uint32_t column,
+                             uint32_t row) {
+  size_t elem_size = archetype_elem_sizes[arch->component_ids[column]];
+
+  return arch->columns[column] + row * elem_size;
+}
+
+static void archetype__resize(struct archetype *arch, uint32_t new_cap) {
+  arch->cap = new_cap;
+  arch->entities = realloc(arch->entities, arch->cap * sizeof(uint32_t));
+
+  for (uint32_t c = 0; c < arch->num_columns; c++) {
+    size_t elem_size = archetype_elem_sizes[arch->component_ids[c]];
+    arch->columns[c] = realloc(arch->columns[c], arch->cap * elem_size);
+  }
+}
+
+static uint32_t archetype__push_row(struct archetype *arch, uint32_t ent_id) {
+  if (arch->num_rows >= arch->cap) {
+    archetype__resize(arch, arch->cap * 2);
+  }
+
+  arch->entities[arch->num_rows] = ent_id;
+  return arch->num_rows++;
+}
+
+/**
+ * Remove a row by moving the last row into it, fixing up the moved entity.
+ */
+static void archetype__remove_row(struct archetype_world *archetypes,
+                                  struct archetype *arch, uint32_t row) {
+  uint32_t last = arch->num_rows - 1;
+
+  if (row != last) {
+    uint32_t moved = arch->entities[last];
+    arch->entities[row] = moved;
+
+    for (uint32_t c = 0; c < arch->num_columns; c++) {
+      size_t elem_size = archetype_elem_sizes[arch->component_ids[c]];
+      memcpy(archetype__cell(arch, c, row), archetype__cell(arch, c, last),
+             elem_size);
+    }
+
+    sparse_set_archetype_record_lookup(archetypes->records, moved)->row = row;
+  }
+
+  arch->num_rows--;
+}
+
+/**
+ * Move an entity's row to another archetype, copying the columns they share.
+ */
+static uint32_t archetype__move(struct archetype_world *archetypes,
+                                uint32_t ent_id, struct archetype_record *rec,
+                                uint32_t to) {
+  struct archetype *src = archetypes->archetypes[rec->archetype];
+  struct archetype *dst = archetypes->archetypes[to];
+  uint32_t row = archetype__push_row(dst, ent_id);
+
+  for (uint32_t c = 0; c < dst->num_columns; c++) {
+    uint32_t id = dst->component_ids[c];
+
+    if (component_signature_has(&src->signature, id)) {
+      memcpy(archetype__cell(dst, c, row),
+             archetype__cell(src, src->column_of[id], rec->row),
+             archetype_elem_sizes[id]);
+    }
+  }
+
+  archetype__remove_row(archetypes, src, rec->row);
+  rec->archetype = to;
+  rec->row = row;
+  return row;
+}
+
+bool archetype_add_component(uint32_t ent_id, uint32_t component_id,
+                             const void *val) {
+  struct archetype_world *archetypes = archetype__world();
+  size_t elem_size = archetype_elem_sizes[component_id];
+  struct archetype_record *rec =
+      sparse_set_archetype_record_lookup(archetypes->records, ent_id);
+
+  if (rec == NULL) {
+    struct component_signature signature = {0};
+    component_signature_set(&signature, component_id);
+
+    uint32_t to = archetype__find_or_new(archetypes, &signature);
+    struct archetype *arch = archetypes->archetypes[to];
+    uint32_t row = archetype__push_row(arch, ent_id);
+    sparse_set_archetype_record_insert(archetypes->records, ent_id,
+                                       (struct archetype_record){to, row});
+    memcpy(archetype__cell(arch, arch->column_of[component_id], row), val,
+           elem_size);
+    return true;
+  }
+
+  struct archetype *arch = archetypes->archetypes[rec->archetype];
+
+  // already has it, overwrite in place
+  if (component_signature_has(&arch->signature, component_id)) {
+    memcpy(archetype__cell(arch, arch->column_of[component_id], rec->row), val,
+           elem_size);
+    return false;
+  }
+
+  uint32_t to = archetype__with(archetypes, rec->archetype, component_id);
+  uint32_t row = archetype__move(archetypes, ent_id, rec, to);
+  arch = archetypes->archetypes[to];
+  memcpy(archetype__cell(arch, arch->column_of[component_id], row), val,
+         elem_size);
+  return true;
+}
+
+static void *archetype__record_component(struct archetype_world *archetypes,
+                                         struct archetype_record *rec,
+                                         uint32_t component_id) {
+  struct archetype *arch = archetypes->archetypes[rec->archetype];
+
+  if (!component_signature_has(&arch->signature, component_id)) {
+    return NULL;
+  }
+
+  return archetype__cell(arch, arch->column_of[component_id], rec->row);
+}
+
+void *archetype_lookup_component(uint32_t ent_id, uint32_t component_id) {
+  struct archetype_world *archetypes = archetype__world();
+  struct archetype_record *rec =
+      sparse_set_archetype_record_lookup(archetypes->records, ent_id);
+
+  if (rec == NULL) {
+    return NULL;
+  }
+
+  return archetype__record_component(archetypes, rec, component_id);
+}
+
+bool archetype_delete_component(uint32_t ent_id, uint32_t component_id) {
+  struct archetype_world *archetypes = archetype__world();
+  struct archetype_record *rec =
+      sparse_set_archetype_record_lookup(archetypes->records, ent_id);
+
+  if (rec == NULL) {
+    return false;
+  }
+
+  struct archetype *arch = archetypes->archetypes[rec->archetype];
+
+  if (!component_signature_has(&arch->signature, component_id)) {
+    return false;
+  }
+
+  // last archetype component of the entity, it leaves the archetypes entirely
+  if (arch->num_columns == 1) {
+    archetype__remove_row(archetypes, arch, rec->row);
+    sparse_set_archetype_record_delete(archetypes->records, ent_id);
+    return true;
+  }
+
+  archetype__move(archetypes, ent_id, rec,
+                  archetype__without(archetypes, rec->archetype, component_id));
+  return true;
+}
+
+void archetype_reserve(uint32_t component_id, uint32_t n) {
+  struct archetype_world *archetypes = archetype__world();
+  struct component_signature signature = {0};
+  component_signature_set(&signature, component_id);
+
+  uint32_t to = archetype__find_or_new(archetypes, &signature);
+  struct archetype *arch = archetypes->archetypes[to];
+
+  if ((uint64_t)arch->num_rows + n > arch->cap) {
+    archetype__resize(arch, arch->num_rows + n);
+  }
+
+  sparse_set_archetype_record_reserve(archetypes->records,
+                                      archetypes->records->num_elems + n);
+}
+
+uint32_t archetype_count(void) { return archetype__world()->num_archetypes; }
+
+struct archetype *archetype_get(uint32_t idx) {
+  return archetype__world()->archetypes[idx];
+}
+
+uint32_t archetype_num_entities(void) {
+  return archetype__world()->records->num_elems;
+}
+
+void *archetype_entity_slot(uint32_t idx, uint32_t component_id,
+                            uint32_t *key) {
+  struct archetype_world *archetypes = archetype__world();
+  *key = archetypes->records->keys[idx];
+
+  return archetype__record_component(
+      archetypes, &archetypes->records->vals[idx], component_id);
+}
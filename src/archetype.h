@@ -0,0 +1,287 @@
+#ifndef __ARCHETYPE_H_
+#define __ARCHETYPE_H_
+
+// Archetype storage: entities with the same set of archetype components share
+// a table with one contiguous column per component
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "common_macros.h"
+#include "snapshot.h"
+#include "storage_stats.h"
+
+#define COMPONENT_MAX 128
+#define COMPONENT_SIGNATURE_WORDS (COMPONENT_MAX / 64)
+
+/**
+ * A set of components, indexed by component id.
+ */
+struct component_signature {
+  uint64_t bits[COMPONENT_SIGNATURE_WORDS];
+};
+
+static inline bool component_signature_has(const struct component_signature *s,
+                                           uint32_t component_id) {
+  return s->bits[component_id / 64] & (UINT64_C(1) << (component_id % 64));
+}
+
+static inline void component_signature_set(struct component_signature *s,
+                                           uint32_t component_id) {
+  s->bits[component_id / 64] |= UINT64_C(1) << (component_id % 64);
+}
+
+static inline void component_signature_clear(struct component_signature *s,
+                                             uint32_t component_id) {
+  s->bits[component_id / 64] &= ~(UINT64_C(1) << (component_id % 64));
+}
+
+/**
+ * Whether every component of `subset` is in `s`.
+ */
+static inline bool
+component_signature_contains(const struct component_signature *s,
+                             const struct component_signature *subset) {
+  for (uint32_t i = 0; i < COMPONENT_SIGNATURE_WORDS; i++) {
+    if ((s->bits[i] & subset->bits[i]) != subset->bits[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static inline bool
+component_signature_equals(const struct component_signature *a,
+                           const struct component_signature *b) {
+  for (uint32_t i = 0; i < COMPONENT_SIGNATURE_WORDS; i++) {
+    if (a->bits[i] != b->bits[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+struct archetype {
+  struct component_signature signature;
+  uint32_t num_columns;
+  uint32_t *component_ids;
+  uint8_t **columns;
+  uint32_t *entities;
+  uint32_t num_rows;
+  uint32_t cap;
+  // column of each component id, only valid for ids in the signature
+  uint8_t column_of[COMPONENT_MAX];
+  // cached transitions to the archetype with a component added / removed
+  uint32_t add_edge[COMPONENT_MAX];
+  uint32_t remove_edge[COMPONENT_MAX];
+};
+
+/**
+ * Declare a component id as archetype stored, with values of `elem_size`.
+ */
+void archetype_register_component(uint32_t component_id, size_t elem_size);
+
+/**
+ * Whether a component id was declared archetype stored.
+ */
+bool archetype_is_component(uint32_t component_id);
+
+/**
+ * Add (or overwrite) a component of an entity, moving the entity to the
+ * archetype that has it. Returns whether the entity didn't have it before.
+ */
+bool archetype_add_component(uint32_t ent_id, uint32_t component_id,
+                             const void *val);
+
+void *archetype_lookup_component(uint32_t ent_id, uint32_t component_id);
+
+/**
+ * Remove a component of an entity, moving the entity to the archetype without
+ * it. Returns whether the entity had it.
+ */
+bool archetype_delete_component(uint32_t ent_id, uint32_t component_id);
+
+/**
+ * Make room for `n` more entities that only have `component_id` so far, on top
+ * of the ones there are, in the archetype new entities land in when it's their
+ * first archetype component.
+ */
+void archetype_reserve(uint32_t component_id, uint32_t n);
+
+uint32_t archetype_count(void);
+
+struct archetype *archetype_get(uint32_t idx);
+
+/**
+ * Number of entities that have at least one archetype component.
+ */
+uint32_t archetype_num_entities(void);
+
+/**
+ * The `idx`th entity with at least one archetype component, and its value of
+ * `component_id` or NULL if it hasn't got it.
+ */
+void *archetype_entity_slot(uint32_t idx, uint32_t component_id,
+                            uint32_t *key);
+
+struct world;
+
+// the archetype tables of a world, created and freed with it (see world.h)
+void archetype__world_init(struct world *world);
+void archetype__world_free(struct world *world);
+
+static inline void *archetype_column(struct archetype *arch,
+                                     uint32_t component_id) {
+  if (!component_signature_has(&arch->signature, component_id)) {
+    return NULL;
+  }
+
+  return arch->columns[arch->column_of[component_id]];
+}
+
+#define DEFINE_ARCHETYPE_STORAGE(VALTYPE, NAME)                                \
+  struct archetype_##NAME {                                                    \
+    uint32_t component_id;                                                     \
+    uint32_t num_elems;                                                        \
+  };                                                                           \
+  struct archetype_##NAME *archetype_##NAME##_new(uint32_t component_id);      \
+  void archetype_##NAME##_free(struct archetype_##NAME *storage);              \
+  void archetype_##NAME##_insert_many(struct archetype_##NAME *storage,        \
+                                      const uint32_t *keys,                    \
+                                      const VALTYPE *vals, uint32_t n);        \
+  void archetype_##NAME##_snapshot_write(struct archetype_##NAME *storage,     \
+                                         struct snapshot_writer *w);           \
+  void archetype_##NAME##_snapshot_read(struct archetype_##NAME *storage,      \
+                                        struct snapshot_reader *r);            \
+  void archetype_##NAME##_stats(struct archetype_##NAME *storage,              \
+                                struct storage_stats *stats);                  \
+                                                                               \
+  static inline void archetype_##NAME##_insert(                                \
+      struct archetype_##NAME *storage, uint32_t k, VALTYPE v) {               \
+    if (archetype_add_component(k, storage->component_id, &v)) {               \
+      storage->num_elems++;                                                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline VALTYPE *archetype_##NAME##_lookup(                            \
+      struct archetype_##NAME *storage, uint32_t k) {                          \
+    return archetype_lookup_component(k, storage->component_id);               \
+  }                                                                            \
+                                                                               \
+  static inline bool archetype_##NAME##_delete(                                \
+      struct archetype_##NAME *storage, uint32_t k) {                          \
+    if (!archetype_delete_component(k, storage->component_id)) {               \
+      return false;                                                            \
+    }                                                                          \
+                                                                               \
+    storage->num_elems--;                                                      \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline void archetype_##NAME##_reserve(                               \
+      struct archetype_##NAME *storage, uint32_t n) {                          \
+    if (n > storage->num_elems) {                                              \
+      archetype_reserve(storage->component_id, n - storage->num_elems);        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* slots are the entities with any archetype component */                    \
+  static inline uint32_t archetype_##NAME##_num_slots(                         \
+      struct archetype_##NAME *storage) {                                      \
+    return archetype_num_entities();                                           \
+  }                                                                            \
+                                                                               \
+  static inline VALTYPE *archetype_##NAME##_slot(                              \
+      struct archetype_##NAME *storage, uint32_t idx, uint32_t *key) {         \
+    return archetype_entity_slot(idx, storage->component_id, key);             \
+  }
+
+#define MAKE_ARCHETYPE_STORAGE(VALTYPE, NAME)                                  \
+  struct archetype_##NAME *archetype_##NAME##_new(uint32_t component_id) {     \
+    struct archetype_##NAME *storage = malloc(sizeof(struct archetype_##NAME)); \
+    storage->component_id = component_id;                                      \
+    storage->num_elems = 0;                                                    \
+    archetype_register_component(component_id, sizeof(VALTYPE));               \
+    return storage;                                                            \
+  }                                                                            \
+                                                                               \
+  void archetype_##NAME##_free(struct archetype_##NAME *storage) {}            \
+                                                                               \
+  void archetype_##NAME##_insert_many(struct archetype_##NAME *storage,        \
+                                      const uint32_t *keys,                    \
+                                      const VALTYPE *vals, uint32_t n) {       \
+    archetype_reserve(storage->component_id, n);                               \
+                                                                               \
+    for (uint32_t i = 0; i < n; i++) {                                         \
+      archetype_##NAME##_insert(storage, keys[i], vals[i]);                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* the archetype tables are shared with the other archetype components, so   \
+   * the values are written packed and loaded back through insert_many */      \
+  void archetype_##NAME##_snapshot_write(struct archetype_##NAME *storage,     \
+                                         struct snapshot_writer *w) {          \
+    uint32_t n = 0;                                                            \
+    uint32_t *keys = malloc((storage->num_elems + 1) * sizeof(uint32_t));      \
+    VALTYPE *vals = malloc((storage->num_elems + 1) * sizeof(VALTYPE));        \
+                                                                               \
+    for (uint32_t i = 0; i < archetype_num_entities(); i++) {                  \
+      VALTYPE *val = archetype_##NAME##_slot(storage, i, &keys[n]);            \
+      if (val != NULL) {                                                       \
+        vals[n++] = *val;                                                      \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    snapshot_write(w, &n, sizeof(n));                                          \
+    snapshot_write(w, keys, (uint64_t)n * sizeof(uint32_t));                   \
+    snapshot_write(w, vals, (uint64_t)n * sizeof(VALTYPE));                    \
+    free(keys);                                                                \
+    free(vals);                                                                \
+  }                                                                            \
+                                                                               \
+  void archetype_##NAME##_snapshot_read(struct archetype_##NAME *storage,      \
+                                        struct snapshot_reader *r) {           \
+    const uint32_t *n = snapshot_read(r, sizeof(uint32_t));                    \
+                                                                               \
+    if (n == NULL) {                                                           \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    const uint32_t *keys = snapshot_read(r, (uint64_t)*n * sizeof(uint32_t));  \
+    const VALTYPE *vals = snapshot_read(r, (uint64_t)*n * sizeof(VALTYPE));    \
+                                                                               \
+    if (vals != NULL) {                                                        \
+      archetype_##NAME##_insert_many(storage, keys, vals, *n);                 \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* the values are columns of the archetype tables, the lookups go through    \
+   * the entity's row */                                                       \
+  void archetype_##NAME##_stats(struct archetype_##NAME *storage,              \
+                                struct storage_stats *stats) {                 \
+    stats->num_elems = storage->num_elems;                                     \
+    stats->cap = storage->num_elems;                                           \
+    stats->probe_histogram[0] = storage->num_elems;                            \
+    stats->bytes = storage->num_elems * sizeof(VALTYPE);                       \
+    storage_stats_finish(stats);                                               \
+  }
+
+/**
+ * Walk every archetype that has all of `SIGNATURE`.
+ *
+ * @param ARCH_VAR variable to receive a pointer to each matching archetype.
+ */
+#define ARCHETYPE_ITER(SIGNATURE, ARCH_VAR, ...)                               \
+  for (uint32_t archetype_iter_idx = 0;                                        \
+       archetype_iter_idx < archetype_count(); archetype_iter_idx++) {         \
+    struct archetype *ARCH_VAR = archetype_get(archetype_iter_idx);            \
+    if (ARCH_VAR->num_rows &&                                                  \
+        component_signature_contains(&ARCH_VAR->signature, (SIGNATURE))) {     \
+      __VA_ARGS__                                                              \
+    }                                                                          \
+  }
+
+#endif // __ARCHETYPE_H_
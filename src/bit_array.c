@@ -1,31 +1,253 @@
 #include "bit_array.h"
 
-#include <stdio.h>
+#include <string.h>
 
-size_t index_in_bitarray(size_t idx) { return idx / 8; }
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
-size_t bit_index_in_bitarray(size_t idx) { return idx % 8; }
+static size_t bit_array__num_groups(size_t num_blocks) {
+  return (num_blocks + BIT_ARRAY_WORD_BITS - 1) / BIT_ARRAY_WORD_BITS;
+}
+
+struct bit_array bit_array_new_with_allocator(size_t num_bits,
+                                              const struct allocator *alloc) {
+  struct bit_array bits = {.alloc = alloc};
+  bit_array_resize(&bits, num_bits);
+  return bits;
+}
+
+struct bit_array bit_array_new(size_t num_bits) {
+  return bit_array_new_with_allocator(num_bits, &allocator_heap);
+}
+
+void bit_array_free(struct bit_array *bits) {
+  size_t num_blocks = bit_array_num_blocks(bits);
+
+  allocator_free(bits->alloc, bits->words,
+                 bit_array_num_words(bits) * sizeof(uint64_t));
+  allocator_free(bits->alloc, bits->word_summary,
+                 num_blocks * sizeof(uint64_t));
+  allocator_free(bits->alloc, bits->block_summary,
+                 bit_array__num_groups(num_blocks) * sizeof(uint64_t));
+  *bits = (struct bit_array){.alloc = bits->alloc};
+}
+
+/**
+ * Grow `*array` from `old_num` to `new_num` words, zeroing the new ones.
+ */
+static void bit_array__grow(const struct allocator *alloc, uint64_t **array,
+                            size_t old_num, size_t new_num) {
+  *array = allocator_realloc(alloc, *array, old_num * sizeof(uint64_t),
+                             new_num * sizeof(uint64_t));
+  memset(*array + old_num, 0, (new_num - old_num) * sizeof(uint64_t));
+}
+
+void bit_array_resize(struct bit_array *bits, size_t num_bits) {
+  size_t old_blocks = bit_array_num_blocks(bits);
+  size_t new_blocks = (num_bits + BIT_ARRAY_BLOCK_BITS - 1) /
+                      BIT_ARRAY_BLOCK_BITS;
+
+  if (new_blocks <= old_blocks) {
+    return;
+  }
+
+  bit_array__grow(bits->alloc, &bits->words,
+                  old_blocks * BIT_ARRAY_BLOCK_WORDS,
+                  new_blocks * BIT_ARRAY_BLOCK_WORDS);
+  bit_array__grow(bits->alloc, &bits->word_summary, old_blocks, new_blocks);
+  bit_array__grow(bits->alloc, &bits->block_summary,
+                  bit_array__num_groups(old_blocks),
+                  bit_array__num_groups(new_blocks));
+  bits->num_bits = new_blocks * BIT_ARRAY_BLOCK_BITS;
+}
+
+static void bit_array__clear_block_bit(struct bit_array *bits, size_t block) {
+  bits->block_summary[block / BIT_ARRAY_WORD_BITS] &=
+      ~(1ull << block % BIT_ARRAY_WORD_BITS);
+}
+
+static void bit_array__set_block_bit(struct bit_array *bits, size_t block) {
+  bits->block_summary[block / BIT_ARRAY_WORD_BITS] |=
+      1ull << block % BIT_ARRAY_WORD_BITS;
+}
+
+/**
+ * Clear the words of `block` that have bits set, and its summaries.
+ */
+static void bit_array__clear_block(struct bit_array *bits, size_t block) {
+  uint64_t *words = &bits->words[block * BIT_ARRAY_BLOCK_WORDS];
+
+  for (uint64_t set = bits->word_summary[block]; set; set &= set - 1) {
+    words[__builtin_ctzll(set)] = 0;
+  }
+
+  bits->word_summary[block] = 0;
+  bit_array__clear_block_bit(bits, block);
+}
+
+/**
+ * Drop the bits of the word summary of `block` (limited to `candidates`)
+ * whose words were cleared, then its block bit if it's empty.
+ */
+static void bit_array__summarize_block(struct bit_array *bits, size_t block,
+                                       uint64_t candidates) {
+  const uint64_t *words = &bits->words[block * BIT_ARRAY_BLOCK_WORDS];
+  uint64_t summary = 0;
 
-uint8_t *bit_array_new(size_t num_bits) {
-  size_t num_bytes = (num_bits + 8) / 8;
+  for (; candidates; candidates &= candidates - 1) {
+    uint32_t word = __builtin_ctzll(candidates);
+    summary |= (uint64_t)(words[word] != 0) << word;
+  }
 
-  return calloc(num_bytes, sizeof(uint8_t));
+  bits->word_summary[block] = summary;
+
+  if (summary == 0) {
+    bit_array__clear_block_bit(bits, block);
+  }
+}
+
+void bit_array_reset(struct bit_array *bits) {
+  size_t num_blocks = bit_array_num_blocks(bits);
+
+  for (size_t block = bit_array_next_block(bits, 0); block < num_blocks;
+       block = bit_array_next_block(bits, block + 1)) {
+    bit_array__clear_block(bits, block);
+  }
+}
+
+// `dst OP= src` over the 64 words of a block, 4 words at a time with AVX2
+#if defined(__AVX2__)
+#define BIT_ARRAY__BLOCK_OP(NAME, AVX2_OP, OP)                                 \
+  static void bit_array__block_##NAME(uint64_t *dst, const uint64_t *src) {    \
+    for (size_t i = 0; i < BIT_ARRAY_BLOCK_WORDS; i += 4) {                    \
+      __m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);                \
+      __m256i s = _mm256_loadu_si256((const __m256i *)&src[i]);                \
+      _mm256_storeu_si256((__m256i *)&dst[i], AVX2_OP);                        \
+    }                                                                          \
+  }
+#else
+#define BIT_ARRAY__BLOCK_OP(NAME, AVX2_OP, OP)                                 \
+  static void bit_array__block_##NAME(uint64_t *dst, const uint64_t *src) {    \
+    for (size_t i = 0; i < BIT_ARRAY_BLOCK_WORDS; i++) {                       \
+      dst[i] = OP;                                                             \
+    }                                                                          \
+  }
+#endif
+
+BIT_ARRAY__BLOCK_OP(and, _mm256_and_si256(d, s), dst[i] & src[i])
+BIT_ARRAY__BLOCK_OP(or, _mm256_or_si256(d, s), dst[i] | src[i])
+BIT_ARRAY__BLOCK_OP(andnot, _mm256_andnot_si256(s, d), dst[i] & ~src[i])
+
+static uint64_t bit_array__block_popcount(const uint64_t *words) {
+#if defined(__AVX2__)
+  // popcount of every nibble through a shuffle, summed per 64 bit lane
+  const __m256i nibble_counts =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                       2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+  __m256i sums = _mm256_setzero_si256();
+
+  for (size_t i = 0; i < BIT_ARRAY_BLOCK_WORDS; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&words[i]);
+    __m256i lo = _mm256_and_si256(v, low_nibbles);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles);
+    __m256i counts =
+        _mm256_add_epi8(_mm256_shuffle_epi8(nibble_counts, lo),
+                        _mm256_shuffle_epi8(nibble_counts, hi));
+    sums = _mm256_add_epi64(sums,
+                            _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+  }
+
+  return (uint64_t)_mm256_extract_epi64(sums, 0) +
+         (uint64_t)_mm256_extract_epi64(sums, 1) +
+         (uint64_t)_mm256_extract_epi64(sums, 2) +
+         (uint64_t)_mm256_extract_epi64(sums, 3);
+#else
+  uint64_t count = 0;
+  for (size_t i = 0; i < BIT_ARRAY_BLOCK_WORDS; i++) {
+    count += __builtin_popcountll(words[i]);
+  }
+  return count;
+#endif
 }
 
-bool get_bit_in_bitarray(uint8_t *bitarray, size_t idx) {
-  size_t arr_idx = index_in_bitarray(idx);
-  size_t bit_idx = bit_index_in_bitarray(idx);
+void bit_array_copy(struct bit_array *dst, const struct bit_array *src) {
+  bit_array_resize(dst, src->num_bits);
+  bit_array_reset(dst);
+
+  size_t num_blocks = bit_array_num_blocks(src);
 
-  return bitarray[arr_idx] & (1 << bit_idx);
+  for (size_t block = bit_array_next_block(src, 0); block < num_blocks;
+       block = bit_array_next_block(src, block + 1)) {
+    memcpy(&dst->words[block * BIT_ARRAY_BLOCK_WORDS],
+           &src->words[block * BIT_ARRAY_BLOCK_WORDS],
+           BIT_ARRAY_BLOCK_WORDS * sizeof(uint64_t));
+    dst->word_summary[block] = src->word_summary[block];
+    bit_array__set_block_bit(dst, block);
+  }
 }
 
-bool set_bit_in_bitarray(uint8_t *bitarray, size_t idx, bool val) {
-  size_t arr_idx = index_in_bitarray(idx);
-  size_t bit_idx = bit_index_in_bitarray(idx);
+void bit_array_and(struct bit_array *dst, const struct bit_array *src) {
+  size_t num_blocks = bit_array_num_blocks(dst);
+  size_t src_blocks = bit_array_num_blocks(src);
+
+  for (size_t block = bit_array_next_block(dst, 0); block < num_blocks;
+       block = bit_array_next_block(dst, block + 1)) {
+    uint64_t both = block < src_blocks ? dst->word_summary[block] &
+                                             src->word_summary[block]
+                                       : 0;
+
+    if (both == 0) {
+      bit_array__clear_block(dst, block);
+      continue;
+    }
+
+    bit_array__block_and(&dst->words[block * BIT_ARRAY_BLOCK_WORDS],
+                         &src->words[block * BIT_ARRAY_BLOCK_WORDS]);
+    bit_array__summarize_block(dst, block, both);
+  }
+}
+
+void bit_array_or(struct bit_array *dst, const struct bit_array *src) {
+  bit_array_resize(dst, src->num_bits);
+
+  size_t num_blocks = bit_array_num_blocks(src);
+
+  for (size_t block = bit_array_next_block(src, 0); block < num_blocks;
+       block = bit_array_next_block(src, block + 1)) {
+    bit_array__block_or(&dst->words[block * BIT_ARRAY_BLOCK_WORDS],
+                        &src->words[block * BIT_ARRAY_BLOCK_WORDS]);
+    dst->word_summary[block] |= src->word_summary[block];
+    bit_array__set_block_bit(dst, block);
+  }
+}
+
+void bit_array_andnot(struct bit_array *dst, const struct bit_array *src) {
+  size_t num_blocks = bit_array_num_blocks(dst);
+  size_t src_blocks = bit_array_num_blocks(src);
+
+  for (size_t block = bit_array_next_block(dst, 0); block < num_blocks;
+       block = bit_array_next_block(dst, block + 1)) {
+    if (block >= src_blocks || src->word_summary[block] == 0) {
+      continue;
+    }
+
+    bit_array__block_andnot(&dst->words[block * BIT_ARRAY_BLOCK_WORDS],
+                            &src->words[block * BIT_ARRAY_BLOCK_WORDS]);
+    bit_array__summarize_block(dst, block, dst->word_summary[block]);
+  }
+}
 
-  bool old_val = get_bit_in_bitarray(bitarray, idx);
+size_t bit_array_popcount(const struct bit_array *bits) {
+  size_t num_blocks = bit_array_num_blocks(bits);
+  size_t count = 0;
 
-  bitarray[arr_idx] &= (val << bit_idx);
+  for (size_t block = bit_array_next_block(bits, 0); block < num_blocks;
+       block = bit_array_next_block(bits, block + 1)) {
+    count += bit_array__block_popcount(
+        &bits->words[block * BIT_ARRAY_BLOCK_WORDS]);
+  }
 
-  return old_val;
+  return count;
 }
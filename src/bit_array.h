@@ -1,24 +1,212 @@
 #ifndef __BIT_ARRAY_H_
 #define __BIT_ARRAY_H_
 
+// Bit array on 64 bit words, with two summary levels over the words so walking
+// the set bits of a sparse array and combining arrays skip what's empty
+
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
-size_t index_in_bitarray(size_t idx);
+#include "allocator.h"
+
+#define BIT_ARRAY_WORD_BITS 64
+// words under a bit of the word summary, a block is 4096 bits
+#define BIT_ARRAY_BLOCK_WORDS 64
+#define BIT_ARRAY_BLOCK_BITS (BIT_ARRAY_BLOCK_WORDS * BIT_ARRAY_WORD_BITS)
+
+/**
+ * Bit array sized in blocks of 4096 bits. `word_summary` has a bit per word
+ * that's set if the word isn't 0, and `block_summary` a bit per block that's
+ * set if any of its words isn't: empty words and blocks are skipped a bit at a
+ * time.
+ */
+struct bit_array {
+  uint64_t *words;
+  // a word per block, a bit per word
+  uint64_t *word_summary;
+  // a bit per block
+  uint64_t *block_summary;
+  // a multiple of BIT_ARRAY_BLOCK_BITS
+  size_t num_bits;
+  const struct allocator *alloc;
+};
+
+struct bit_array bit_array_new(size_t num_bits);
+
+struct bit_array bit_array_new_with_allocator(size_t num_bits,
+                                              const struct allocator *alloc);
 
-size_t bit_index_in_bitarray(size_t idx);
+void bit_array_free(struct bit_array *bits);
 
-uint8_t *bit_array_new(size_t num_bits);
+/**
+ * Grow `bits` to hold at least `num_bits` bits, the new ones are clear. Never
+ * shrinks it.
+ */
+void bit_array_resize(struct bit_array *bits, size_t num_bits);
 
 /**
- * Get a bit from a bit array.
+ * Clear every bit, only touching the words that have any set.
  */
-bool get_bit_in_bitarray(uint8_t *bitarray, size_t idx);
+void bit_array_reset(struct bit_array *bits);
+
+/**
+ * Make `dst` a copy of `src`, growing it if it's smaller.
+ */
+void bit_array_copy(struct bit_array *dst, const struct bit_array *src);
+
+// set algebra, in place on `dst`. Only the blocks the summaries say are
+// non empty are combined, with AVX2 when the library is built with it. Bits
+// past the end of `src` count as clear, or grows `dst` to fit them
+void bit_array_and(struct bit_array *dst, const struct bit_array *src);
+void bit_array_or(struct bit_array *dst, const struct bit_array *src);
+void bit_array_andnot(struct bit_array *dst, const struct bit_array *src);
+
+/**
+ * Number of bits set.
+ */
+size_t bit_array_popcount(const struct bit_array *bits);
+
+static inline size_t bit_array_num_words(const struct bit_array *bits) {
+  return bits->num_bits / BIT_ARRAY_WORD_BITS;
+}
+
+static inline size_t bit_array_num_blocks(const struct bit_array *bits) {
+  return bits->num_bits / BIT_ARRAY_BLOCK_BITS;
+}
+
+static inline bool bit_array_get(const struct bit_array *bits, size_t idx) {
+  return (bits->words[idx / BIT_ARRAY_WORD_BITS] >>
+          (idx % BIT_ARRAY_WORD_BITS)) &
+         1;
+}
+
+/**
+ * Set bit `idx` (below num_bits), returns whether it already was.
+ */
+static inline bool bit_array_set(struct bit_array *bits, size_t idx) {
+  size_t word = idx / BIT_ARRAY_WORD_BITS;
+  size_t block = word / BIT_ARRAY_BLOCK_WORDS;
+  uint64_t bit = 1ull << idx % BIT_ARRAY_WORD_BITS;
+  bool was_set = bits->words[word] & bit;
+
+  bits->words[word] |= bit;
+  bits->word_summary[block] |= 1ull << word % BIT_ARRAY_BLOCK_WORDS;
+  bits->block_summary[block / BIT_ARRAY_WORD_BITS] |=
+      1ull << block % BIT_ARRAY_WORD_BITS;
+  return was_set;
+}
+
+/**
+ * Clear bit `idx` (below num_bits), returns whether it was set.
+ */
+static inline bool bit_array_clear(struct bit_array *bits, size_t idx) {
+  size_t word = idx / BIT_ARRAY_WORD_BITS;
+  size_t block = word / BIT_ARRAY_BLOCK_WORDS;
+  uint64_t bit = 1ull << idx % BIT_ARRAY_WORD_BITS;
+  bool was_set = bits->words[word] & bit;
+
+  bits->words[word] &= ~bit;
+
+  // the summaries only drop a bit once what's under it is empty
+  if (bits->words[word] == 0) {
+    bits->word_summary[block] &= ~(1ull << word % BIT_ARRAY_BLOCK_WORDS);
+
+    if (bits->word_summary[block] == 0) {
+      bits->block_summary[block / BIT_ARRAY_WORD_BITS] &=
+          ~(1ull << block % BIT_ARRAY_WORD_BITS);
+    }
+  }
+
+  return was_set;
+}
+
+/**
+ * First block at or after `block` that has any bit set, or num_blocks.
+ */
+static inline size_t bit_array_next_block(const struct bit_array *bits,
+                                          size_t block) {
+  size_t num_blocks = bit_array_num_blocks(bits);
+
+  if (block >= num_blocks) {
+    return num_blocks;
+  }
+
+  size_t group = block / BIT_ARRAY_WORD_BITS;
+  uint64_t blocks =
+      bits->block_summary[group] & (UINT64_MAX << block % BIT_ARRAY_WORD_BITS);
+
+  while (blocks == 0) {
+    if (++group * BIT_ARRAY_WORD_BITS >= num_blocks) {
+      return num_blocks;
+    }
+    blocks = bits->block_summary[group];
+  }
+
+  return group * BIT_ARRAY_WORD_BITS + __builtin_ctzll(blocks);
+}
+
+/**
+ * First word at or after `word` that has any bit set, or num_words.
+ */
+static inline size_t bit_array_next_word(const struct bit_array *bits,
+                                         size_t word) {
+  size_t block = word / BIT_ARRAY_BLOCK_WORDS;
+
+  if (block >= bit_array_num_blocks(bits)) {
+    return bit_array_num_words(bits);
+  }
+
+  uint64_t words = bits->word_summary[block] &
+                   (UINT64_MAX << word % BIT_ARRAY_BLOCK_WORDS);
+
+  if (words == 0) {
+    block = bit_array_next_block(bits, block + 1);
+
+    if (block == bit_array_num_blocks(bits)) {
+      return bit_array_num_words(bits);
+    }
+    words = bits->word_summary[block];
+  }
+
+  return block * BIT_ARRAY_BLOCK_WORDS + __builtin_ctzll(words);
+}
+
+/**
+ * First set bit at or after `idx`, or num_bits.
+ */
+static inline size_t bit_array_next(const struct bit_array *bits, size_t idx) {
+  size_t word = idx / BIT_ARRAY_WORD_BITS;
+
+  if (word >= bit_array_num_words(bits)) {
+    return bits->num_bits;
+  }
+
+  uint64_t set = bits->words[word] & (UINT64_MAX << idx % BIT_ARRAY_WORD_BITS);
+
+  if (set == 0) {
+    word = bit_array_next_word(bits, word + 1);
+
+    if (word == bit_array_num_words(bits)) {
+      return bits->num_bits;
+    }
+    set = bits->words[word];
+  }
+
+  return word * BIT_ARRAY_WORD_BITS + __builtin_ctzll(set);
+}
 
 /**
- * Set a bit in a bit array, returns the previous value.
+ * Iterate over the set bits of `BITS` in increasing order.
+ *
+ * @param IDX_NAME variable to receive the index of each set bit.
  */
-bool set_bit_in_bitarray(uint8_t *bitarray, size_t idx, bool val);
+#define BIT_ARRAY_ITER(BITS, IDX_NAME, ...)                                    \
+  for (size_t IDX_NAME = bit_array_next((BITS), 0);                            \
+       IDX_NAME < (BITS)->num_bits;                                            \
+       IDX_NAME = bit_array_next((BITS), IDX_NAME + 1)) {                      \
+    __VA_ARGS__                                                                \
+  }
 
 #endif // __BIT_ARRAY_H_
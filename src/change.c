@@ -0,0 +1,317 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "archetype.h"
+#include "change.h"
+#include "common_macros.h"
+#include "sparse_set.h"
+#include "world.h"
+
+DEFINE_SPARSE_SET(struct change_ticks, change_ticks);
+MAKE_SPARSE_SET(struct change_ticks, change_ticks);
+
+static const uint32_t change_list_initial_cap = 64;
+// stale entries (removed entities, entities changed again later) are dropped
+// once the list is this many times longer than the number of values
+static const uint32_t change_list_compact_factor = 2;
+
+struct change_entry {
+  uint32_t ent_id;
+  uint32_t tick;
+};
+
+struct change_tracker {
+  struct sparse_set_change_ticks *ticks;
+  // entities in the order they were changed, an entity changed again is
+  // appended again and its earlier entries go stale
+  struct change_entry *entries;
+  uint32_t num_entries;
+  uint32_t cap;
+  // for marks from the workers of a parallel join
+  pthread_mutex_t lock;
+};
+
+struct change_world {
+  // indexed by component id, created when the component gets its first value
+  struct change_tracker *trackers[COMPONENT_MAX];
+  struct {
+    change_removed_fn fn;
+    void *ctx;
+  } watchers[CHANGE_MAX_WATCHERS];
+  uint32_t num_watchers;
+  uint32_t global_tick;
+};
+
+static _Thread_local uint32_t change__current_tick;
+
+void change__world_init(struct world *world) {
+  world->changes = calloc(1, sizeof(struct change_world));
+  world->changes->global_tick = 1;
+}
+
+void change__world_free(struct world *world) {
+  for (uint32_t id = 0; id < COMPONENT_MAX; id++) {
+    struct change_tracker *tracker = world->changes->trackers[id];
+
+    if (tracker != NULL) {
+      sparse_set_change_ticks_free(tracker->ticks);
+      free(tracker->ticks);
+      free(tracker->entries);
+      pthread_mutex_destroy(&tracker->lock);
+      free(tracker);
+    }
+  }
+
+  free(world->changes);
+}
+
+static struct change_world *change__world(void) {
+  return world_current()->changes;
+}
+
+uint32_t change_tick(void) {
+  if (change__current_tick) {
+    return change__current_tick;
+  }
+
+  return __atomic_load_n(&change__world()->global_tick, __ATOMIC_ACQUIRE);
+}
+
+uint32_t change_tick_advance(void) {
+  return __atomic_add_fetch(&change__world()->global_tick, 1,
+                            __ATOMIC_ACQ_REL);
+}
+
+uint32_t change_tick_enter(uint32_t tick) {
+  uint32_t prev = change__current_tick;
+  change__current_tick = tick;
+  return prev;
+}
+
+void change_tick_reset(uint32_t tick) {
+  __atomic_store_n(&change__world()->global_tick, tick, __ATOMIC_RELEASE);
+}
+
+static struct change_tracker *change__tracker(uint32_t component_id) {
+  struct change_tracker **trackers = change__world()->trackers;
+  struct change_tracker *tracker = trackers[component_id];
+
+  if (tracker == NULL) {
+    tracker = calloc(1, sizeof(struct change_tracker));
+    tracker->ticks = sparse_set_change_ticks_new();
+    pthread_mutex_init(&tracker->lock, NULL);
+    trackers[component_id] = tracker;
+  }
+
+  return tracker;
+}
+
+static void change__append(struct change_tracker *tracker, uint32_t ent_id,
+                           uint32_t tick) {
+  pthread_mutex_lock(&tracker->lock);
+
+  if (tracker->num_entries >= tracker->cap) {
+    tracker->cap = tracker->cap ? tracker->cap * 2 : change_list_initial_cap;
+    tracker->entries =
+        realloc(tracker->entries, tracker->cap * sizeof(struct change_entry));
+  }
+
+  tracker->entries[tracker->num_entries++] =
+      (struct change_entry){ent_id, tick};
+  pthread_mutex_unlock(&tracker->lock);
+}
+
+void change_added(uint32_t component_id, uint32_t ent_id) {
+  struct change_tracker *tracker = change__tracker(component_id);
+  uint32_t tick = change_tick();
+
+  sparse_set_change_ticks_insert(tracker->ticks, ent_id,
+                                 (struct change_ticks){tick, tick});
+  change__append(tracker, ent_id, tick);
+}
+
+void change_mark(uint32_t component_id, uint32_t ent_id) {
+  struct change_tracker *tracker = change__world()->trackers[component_id];
+
+  if (tracker == NULL) {
+    return;
+  }
+
+  struct change_ticks *ticks =
+      sparse_set_change_ticks_lookup(tracker->ticks, ent_id);
+  uint32_t tick = change_tick();
+
+  // already listed for this tick
+  if (ticks == NULL || ticks->changed == tick) {
+    return;
+  }
+
+  ticks->changed = tick;
+  change__append(tracker, ent_id, tick);
+}
+
+void change_removed(uint32_t component_id, uint32_t ent_id) {
+  struct change_tracker *tracker = change__world()->trackers[component_id];
+
+  if (tracker != NULL) {
+    sparse_set_change_ticks_delete(tracker->ticks, ent_id);
+  }
+
+  struct change_world *changes = change__world();
+
+  for (uint32_t i = 0; i < changes->num_watchers; i++) {
+    changes->watchers[i].fn(component_id, ent_id, changes->watchers[i].ctx);
+  }
+}
+
+void change_watch_removed(change_removed_fn fn, void *ctx) {
+  struct change_world *changes = change__world();
+
+  if (changes->num_watchers >= CHANGE_MAX_WATCHERS) {
+    RUNTIME_ERROR("Too many removal watchers, the maximum is %d",
+                  CHANGE_MAX_WATCHERS);
+  }
+
+  changes->watchers[changes->num_watchers].fn = fn;
+  changes->watchers[changes->num_watchers].ctx = ctx;
+  changes->num_watchers++;
+}
+
+void change_unwatch_removed(change_removed_fn fn, void *ctx) {
+  struct change_world *changes = change__world();
+
+  for (uint32_t i = 0; i < changes->num_watchers; i++) {
+    if (changes->watchers[i].fn == fn && changes->watchers[i].ctx == ctx) {
+      changes->watchers[i] = changes->watchers[--changes->num_watchers];
+      return;
+    }
+  }
+}
+
+const struct change_ticks *change_ticks(uint32_t component_id,
+                                        uint32_t ent_id) {
+  struct change_tracker *tracker = change__world()->trackers[component_id];
+
+  if (tracker == NULL) {
+    return NULL;
+  }
+
+  return sparse_set_change_ticks_lookup(tracker->ticks, ent_id);
+}
+
+void change_iter_init(struct change_iter *iter, uint32_t component_id,
+                      uint32_t since, bool added) {
+  struct change_tracker *tracker = change__world()->trackers[component_id];
+  *iter = (struct change_iter){component_id, since, added, 0, 0};
+
+  if (tracker == NULL) {
+    return;
+  }
+
+  // entries are in tick order, skip the ones from `since` and before
+  uint32_t lo = 0;
+  uint32_t hi = tracker->num_entries;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    if (tracker->entries[mid].tick <= since) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  iter->pos = lo;
+  iter->end = tracker->num_entries;
+}
+
+bool change_iter_next(struct change_iter *iter, uint32_t *ent_id) {
+  struct change_tracker *tracker =
+      change__world()->trackers[iter->component_id];
+
+  while (iter->pos < iter->end) {
+    struct change_entry e = tracker->entries[iter->pos++];
+    const struct change_ticks *ticks =
+        sparse_set_change_ticks_lookup(tracker->ticks, e.ent_id);
+
+    // gone since, or listed again later on
+    if (ticks == NULL || ticks->changed != e.tick) {
+      continue;
+    }
+
+    if (iter->added && ticks->added <= iter->since) {
+      continue;
+    }
+
+    *ent_id = e.ent_id;
+    return true;
+  }
+
+  return false;
+}
+
+void change_compact(void) {
+  struct change_tracker **trackers = change__world()->trackers;
+
+  for (uint32_t id = 0; id < COMPONENT_MAX; id++) {
+    struct change_tracker *tracker = trackers[id];
+
+    if (tracker == NULL ||
+        tracker->num_entries <=
+            change_list_compact_factor * tracker->ticks->num_elems +
+                change_list_initial_cap) {
+      continue;
+    }
+
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < tracker->num_entries; i++) {
+      struct change_entry e = tracker->entries[i];
+      const struct change_ticks *ticks =
+          sparse_set_change_ticks_lookup(tracker->ticks, e.ent_id);
+
+      if (ticks != NULL && ticks->changed == e.tick) {
+        tracker->entries[kept++] = e;
+      }
+    }
+
+    tracker->num_entries = kept;
+  }
+}
+
+void change_snapshot_write(uint32_t component_id, struct snapshot_writer *w) {
+  struct change_tracker *tracker = change__tracker(component_id);
+
+  sparse_set_change_ticks_snapshot_write(tracker->ticks, w);
+  snapshot_write(w, &tracker->num_entries, sizeof(uint32_t));
+  snapshot_write(w, tracker->entries,
+                 (uint64_t)tracker->num_entries * sizeof(struct change_entry));
+}
+
+void change_snapshot_read(uint32_t component_id, struct snapshot_reader *r) {
+  struct change_tracker *tracker = change__tracker(component_id);
+
+  sparse_set_change_ticks_snapshot_read(tracker->ticks, r);
+  const uint32_t *num_entries = snapshot_read(r, sizeof(uint32_t));
+
+  if (num_entries == NULL) {
+    return;
+  }
+
+  uint32_t cap = *num_entries > change_list_initial_cap
+                     ? *num_entries
+                     : change_list_initial_cap;
+  struct change_entry *entries = snapshot_read_array(
+      r, &allocator_heap, sizeof(struct change_entry), *num_entries, cap);
+
+  if (entries == NULL) {
+    return;
+  }
+
+  free(tracker->entries);
+  tracker->entries = entries;
+  tracker->cap = cap;
+  tracker->num_entries = *num_entries;
+}
@@ -0,0 +1,114 @@
+#ifndef __CHANGE_H_
+#define __CHANGE_H_
+
+// Change detection: every component remembers the tick each of its values was
+// added and last changed at, and lists the entities it changed in tick order so
+// asking for recent changes never touches the values that didn't change
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "snapshot.h"
+
+struct change_ticks {
+  uint32_t added;
+  uint32_t changed;
+};
+
+/**
+ * The tick changes made by the calling thread are stamped with: the tick of
+ * the system it's running, or the global tick of the current world outside of
+ * systems. Every world counts its ticks on its own.
+ */
+uint32_t change_tick(void);
+
+/**
+ * Start a new global tick and return it, run_systems starts one for every
+ * system it runs and one for the changes made once they're done.
+ */
+uint32_t change_tick_advance(void);
+
+/**
+ * Stamp the calling thread's changes with `tick`, 0 to go back to the global
+ * tick. Returns the tick it was stamping them with before.
+ */
+uint32_t change_tick_enter(uint32_t tick);
+
+/**
+ * Set the global tick, when restoring a snapshot.
+ */
+void change_tick_reset(uint32_t tick);
+
+/**
+ * Record that `ent_id` got a value of a component, or had its value replaced.
+ */
+void change_added(uint32_t component_id, uint32_t ent_id);
+
+/**
+ * Record that the value of a component `ent_id` has was modified in place.
+ * Only the first mark of an entity in a tick costs more than a lookup, marks
+ * from different threads are fine as long as they are for different entities.
+ */
+void change_mark(uint32_t component_id, uint32_t ent_id);
+
+void change_removed(uint32_t component_id, uint32_t ent_id);
+
+#define CHANGE_MAX_WATCHERS 8
+
+typedef void (*change_removed_fn)(uint32_t component_id, uint32_t ent_id,
+                                  void *ctx);
+
+/**
+ * Call `fn` every time an entity loses a value of a component, removals aren't
+ * kept in the change lists. An entity being destroyed is still alive when `fn`
+ * is called for its components.
+ */
+void change_watch_removed(change_removed_fn fn, void *ctx);
+
+void change_unwatch_removed(change_removed_fn fn, void *ctx);
+
+/**
+ * Ticks of the value of a component `ent_id` has, NULL if it has none.
+ */
+const struct change_ticks *change_ticks(uint32_t component_id,
+                                        uint32_t ent_id);
+
+/**
+ * Walks the entities whose value of a component was added (or changed) after
+ * a tick, each one once.
+ */
+struct change_iter {
+  uint32_t component_id;
+  uint32_t since;
+  bool added;
+  uint32_t pos;
+  uint32_t end;
+};
+
+void change_iter_init(struct change_iter *iter, uint32_t component_id,
+                      uint32_t since, bool added);
+
+/**
+ * Get the next entity, returns false once there are none left. Entities
+ * changed while walking are left for the next walk.
+ */
+bool change_iter_next(struct change_iter *iter, uint32_t *ent_id);
+
+/**
+ * Drop the stale entries of the change lists, called by run_systems once no
+ * system is running.
+ */
+void change_compact(void);
+
+// a component's ticks and change list, for snapshots
+void change_snapshot_write(uint32_t component_id, struct snapshot_writer *w);
+void change_snapshot_read(uint32_t component_id, struct snapshot_reader *r);
+
+struct world;
+
+// the ticks, change lists and watchers of a world, created and freed with it
+// (see world.h)
+void change__world_init(struct world *world);
+void change__world_free(struct world *world);
+
+#endif // __CHANGE_H_
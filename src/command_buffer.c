@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "command_buffer.h"
+#include "entity.h"
+#include "thread_pool.h"
+#include "world.h"
+
+static const uint32_t command_list_initial_cap = 64;
+
+enum command_kind {
+  COMMAND_ADD,
+  COMMAND_SET,
+  COMMAND_DELETE,
+  COMMAND_DESTROY,
+};
+
+// commands for one component in the order they were recorded, the values of
+// the adds and sets are packed next to each other so a run of adds can go to
+// add_values as is
+struct command_list {
+  uint32_t *ent_ids;
+  uint8_t *kinds;
+  uint32_t num;
+  uint32_t cap;
+  uint8_t *vals;
+  uint32_t num_vals;
+  uint32_t vals_cap;
+};
+
+struct command_buffer {
+  struct command_list commands[COMPONENT_MAX];
+  struct command_list destroys;
+  // components with any command recorded
+  struct component_signature touched;
+};
+
+struct command_buffer_world {
+  // one buffer per worker of the world's pool, created by the worker the first
+  // time it records
+  struct command_buffer *buffers[THREAD_POOL_MAX_WORKERS];
+};
+
+static void command_list__free(struct command_list *list) {
+  free(list->ent_ids);
+  free(list->kinds);
+  free(list->vals);
+}
+
+void command_buffer__world_init(struct world *world) {
+  world->command_buffers = calloc(1, sizeof(struct command_buffer_world));
+}
+
+void command_buffer__world_free(struct world *world) {
+  for (uint32_t w = 0; w < THREAD_POOL_MAX_WORKERS; w++) {
+    struct command_buffer *buffer = world->command_buffers->buffers[w];
+
+    if (buffer == NULL) {
+      continue;
+    }
+
+    for (uint32_t id = 0; id < COMPONENT_MAX; id++) {
+      command_list__free(&buffer->commands[id]);
+    }
+
+    command_list__free(&buffer->destroys);
+    free(buffer);
+  }
+
+  free(world->command_buffers);
+}
+
+static struct command_buffer *command_buffer__current(void) {
+  struct command_buffer **buffers = world_current()->command_buffers->buffers;
+  uint32_t worker = thread_pool_current_worker();
+
+  if (buffers[worker] == NULL) {
+    buffers[worker] = calloc(1, sizeof(struct command_buffer));
+  }
+
+  return buffers[worker];
+}
+
+// `val` is NULL for the commands without a value
+static void command_list__push(struct command_list *list,
+                               enum command_kind kind, uint32_t ent_id,
+                               const void *val, size_t elem_size) {
+  if (list->num >= list->cap) {
+    list->cap = list->cap ? list->cap * 2 : command_list_initial_cap;
+    list->ent_ids = realloc(list->ent_ids, list->cap * sizeof(uint32_t));
+    list->kinds = realloc(list->kinds, list->cap);
+  }
+
+  list->ent_ids[list->num] = ent_id;
+  list->kinds[list->num] = kind;
+  list->num++;
+
+  if (val == NULL || !elem_size) {
+    return;
+  }
+
+  if (list->num_vals >= list->vals_cap) {
+    list->vals_cap = list->vals_cap ? list->vals_cap * 2
+                                    : command_list_initial_cap;
+    list->vals = realloc(list->vals, list->vals_cap * elem_size);
+  }
+
+  memcpy(list->vals + list->num_vals * elem_size, val, elem_size);
+  list->num_vals++;
+}
+
+static void command_buffer__push(uint32_t component_id, enum command_kind kind,
+                                 uint32_t ent_id, const void *val) {
+  struct command_buffer *buffer = command_buffer__current();
+  command_list__push(&buffer->commands[component_id], kind, ent_id, val,
+                     component_registry_info(component_id)->elem_size);
+  component_signature_set(&buffer->touched, component_id);
+}
+
+void command_buffer_add(uint32_t component_id, uint32_t ent_id,
+                        const void *val) {
+  command_buffer__push(component_id, COMMAND_ADD, ent_id, val);
+}
+
+void command_buffer_set(uint32_t component_id, uint32_t ent_id,
+                        const void *val) {
+  command_buffer__push(component_id, COMMAND_SET, ent_id, val);
+}
+
+void command_buffer_delete(uint32_t component_id, uint32_t ent_id) {
+  command_buffer__push(component_id, COMMAND_DELETE, ent_id, NULL);
+}
+
+void command_buffer_destroy(uint32_t ent_id) {
+  command_list__push(&command_buffer__current()->destroys, COMMAND_DESTROY,
+                     ent_id, NULL, 0);
+}
+
+// each worker's commands in the order it recorded them, so a delete followed
+// by an add leaves a value
+static void command_buffer__flush_component(struct command_buffer **buffers,
+                                            uint32_t component_id) {
+  const struct component_info *info = component_registry_info(component_id);
+  size_t elem_size = info->elem_size;
+
+  for (uint32_t w = 0; w < THREAD_POOL_MAX_WORKERS; w++) {
+    if (buffers[w] == NULL) {
+      continue;
+    }
+
+    struct command_list *list = &buffers[w]->commands[component_id];
+    uint8_t *vals = list->vals;
+    uint32_t i = 0;
+
+    while (i < list->num) {
+      uint32_t ent_id = list->ent_ids[i];
+
+      switch (list->kinds[i]) {
+      case COMMAND_ADD: {
+        uint32_t end = i + 1;
+
+        while (end < list->num && list->kinds[end] == COMMAND_ADD) {
+          end++;
+        }
+
+        info->add_values(&list->ent_ids[i], vals, end - i);
+        vals += (end - i) * elem_size;
+        i = end;
+        continue;
+      }
+      case COMMAND_SET: {
+        void *val = info->def->lookup_value(ent_id);
+
+        if (val != NULL) {
+          memcpy(val, vals, elem_size);
+          change_mark(component_id, ent_id);
+        }
+
+        vals += elem_size;
+        break;
+      }
+      case COMMAND_DELETE:
+        info->def->delete_value(ent_id);
+        break;
+      }
+
+      i++;
+    }
+
+    list->num = 0;
+    list->num_vals = 0;
+  }
+}
+
+void command_buffer_flush(void) {
+  struct command_buffer **buffers = world_current()->command_buffers->buffers;
+  struct component_signature touched = {0};
+
+  for (uint32_t w = 0; w < THREAD_POOL_MAX_WORKERS; w++) {
+    if (buffers[w] != NULL) {
+      for (uint32_t i = 0; i < COMPONENT_SIGNATURE_WORDS; i++) {
+        touched.bits[i] |= buffers[w]->touched.bits[i];
+      }
+
+      buffers[w]->touched = (struct component_signature){0};
+    }
+  }
+
+  for (uint32_t word = 0; word < COMPONENT_SIGNATURE_WORDS; word++) {
+    for (uint64_t bits = touched.bits[word]; bits; bits &= bits - 1) {
+      command_buffer__flush_component(buffers,
+                                      word * 64 + __builtin_ctzll(bits));
+    }
+  }
+
+  for (uint32_t w = 0; w < THREAD_POOL_MAX_WORKERS; w++) {
+    struct command_buffer *buffer = buffers[w];
+
+    if (buffer == NULL) {
+      continue;
+    }
+
+    for (uint32_t i = 0; i < buffer->destroys.num; i++) {
+      destroy_entity(buffer->destroys.ent_ids[i]);
+    }
+
+    buffer->destroys.num = 0;
+  }
+}
@@ -0,0 +1,73 @@
+#ifndef __COMMAND_BUFFER_H_
+#define __COMMAND_BUFFER_H_
+
+// Structural changes recorded while systems run and applied once they are done,
+// so joins never see a storage change under them
+
+#include <stdint.h>
+
+#include "component.h"
+
+/**
+ * Record adding a value of a component to an entity, `val` points to a value
+ * of the component's type.
+ */
+void command_buffer_add(uint32_t component_id, uint32_t ent_id,
+                        const void *val);
+
+/**
+ * Record overwriting an entity's value of a component, dropped if the entity
+ * doesn't have the component by the time it's applied.
+ */
+void command_buffer_set(uint32_t component_id, uint32_t ent_id,
+                        const void *val);
+
+void command_buffer_delete(uint32_t component_id, uint32_t ent_id);
+
+void command_buffer_destroy(uint32_t ent_id);
+
+/**
+ * Apply every command recorded in the current world. Commands are grouped per
+ * component, so each storage is touched once, and within a component each
+ * worker's commands apply in the order they were recorded, runs of adds in
+ * bulk. Entities are destroyed last.
+ *
+ * Called by run_systems once every system has run.
+ */
+void command_buffer_flush(void);
+
+// the buffers of a world, created and freed with it (see world.h)
+void command_buffer__world_init(struct world *world);
+void command_buffer__world_free(struct world *world);
+
+/**
+ * Record adding a value of a component to an entity, for structural changes
+ * from inside a join. Each worker records into its own buffer.
+ *
+ * Usage:
+ * FOR_JOIN_COMPONENT_1(health, i, {
+ *   if (i.health->hp <= 0) {
+ *     DEFER_ADD_VALUE(dead, i.id, (struct dead_storage){0});
+ *   }
+ * });
+ */
+#define DEFER_ADD_VALUE(COMP_NAME, ENT_ID, ...)                                \
+  do {                                                                         \
+    typeof(*component_##COMP_NAME##__lookup(COMP_NAME.storage, 0))             \
+        command_buffer_val = __VA_ARGS__;                                      \
+    command_buffer_add(COMP_NAME.id, (ENT_ID), &command_buffer_val);           \
+  } while (0)
+
+#define DEFER_SET_VALUE(COMP_NAME, ENT_ID, ...)                                \
+  do {                                                                         \
+    typeof(*component_##COMP_NAME##__lookup(COMP_NAME.storage, 0))             \
+        command_buffer_val = __VA_ARGS__;                                      \
+    command_buffer_set(COMP_NAME.id, (ENT_ID), &command_buffer_val);           \
+  } while (0)
+
+#define DEFER_DELETE_VALUE(COMP_NAME, ENT_ID)                                  \
+  command_buffer_delete(COMP_NAME.id, (ENT_ID))
+
+#define DEFER_DESTROY_ENTITY(ENT_ID) command_buffer_destroy(ENT_ID)
+
+#endif // __COMMAND_BUFFER_H_
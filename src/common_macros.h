@@ -47,4 +47,37 @@
     (B) = temp;                                                                \
   } while (0)
 
+#define MACRO_UNPAREN(...) __VA_ARGS__
+
+#define MACRO__CONCAT(A, B) A##B
+#define MACRO_CONCAT(A, B) MACRO__CONCAT(A, B)
+
+/**
+ * Number of arguments given, up to 8.
+ */
+#define MACRO_NARGS(...) MACRO__NARGS(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define MACRO__NARGS(_1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+/**
+ * Expand `F(IDX, ARG)` for every argument given (up to 8), where `IDX` is the
+ * index of the argument.
+ */
+#define MACRO_FOR_EACH(F, ...)                                                 \
+  MACRO_CONCAT(MACRO__FOR_EACH_, MACRO_NARGS(__VA_ARGS__))(F, 0, __VA_ARGS__)
+#define MACRO__FOR_EACH_1(F, I, X) F(I, X)
+#define MACRO__FOR_EACH_2(F, I, X, ...)                                        \
+  F(I, X) MACRO__FOR_EACH_1(F, I + 1, __VA_ARGS__)
+#define MACRO__FOR_EACH_3(F, I, X, ...)                                        \
+  F(I, X) MACRO__FOR_EACH_2(F, I + 1, __VA_ARGS__)
+#define MACRO__FOR_EACH_4(F, I, X, ...)                                        \
+  F(I, X) MACRO__FOR_EACH_3(F, I + 1, __VA_ARGS__)
+#define MACRO__FOR_EACH_5(F, I, X, ...)                                        \
+  F(I, X) MACRO__FOR_EACH_4(F, I + 1, __VA_ARGS__)
+#define MACRO__FOR_EACH_6(F, I, X, ...)                                        \
+  F(I, X) MACRO__FOR_EACH_5(F, I + 1, __VA_ARGS__)
+#define MACRO__FOR_EACH_7(F, I, X, ...)                                        \
+  F(I, X) MACRO__FOR_EACH_6(F, I + 1, __VA_ARGS__)
+#define MACRO__FOR_EACH_8(F, I, X, ...)                                        \
+  F(I, X) MACRO__FOR_EACH_7(F, I + 1, __VA_ARGS__)
+
 #endif // __COMMON_MACROS_H_
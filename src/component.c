@@ -0,0 +1,403 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archetype.h"
+#include "bit_array.h"
+#include "common_macros.h"
+#include "component.h"
+#include "query.h"
+#include "sparse_set.h"
+#include "world.h"
+
+DEFINE_SPARSE_SET(struct component_signature, component_entity_signatures);
+MAKE_SPARSE_SET(struct component_signature, component_entity_signatures);
+
+static struct {
+  // indexed by component id
+  struct component_info infos[COMPONENT_MAX];
+  uint32_t num_components;
+} registry;
+
+struct component_world {
+  // held while changing the signatures, the presence bits and the queries'
+  // matches, systems that write different components may add and delete
+  // concurrently
+  pthread_mutex_t lock;
+  // components of every entity that has any
+  struct sparse_set_component_entity_signatures *signatures;
+  // a bit per entity index per component, for intersecting joins
+  struct bit_array presence[COMPONENT_MAX];
+};
+
+_Thread_local uint64_t storage_probes;
+
+struct component_lookup_block {
+  struct component_lookup_counts counts[COMPONENT_MAX];
+  struct component_lookup_block *next;
+};
+
+_Thread_local struct component_lookup_counts *component__lookup_counts;
+
+// the blocks of every thread that did a lookup, kept after the thread exits so
+// its lookups still count
+static pthread_mutex_t component_lookup_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct component_lookup_block *component_lookup_blocks;
+
+uint32_t component_registry_new_id(void) {
+  if (registry.num_components >= COMPONENT_MAX) {
+    RUNTIME_ERROR("Too many components registered, the maximum is %d",
+                  COMPONENT_MAX);
+  }
+
+  return registry.num_components++;
+}
+
+void component_registry_add(const struct component_info *info) {
+  registry.infos[info->def->id] = *info;
+  world_default()->storages[info->def->id] = info->def->storage;
+}
+
+const struct component_info *component_registry_info(uint32_t component_id) {
+  return &registry.infos[component_id];
+}
+
+uint32_t component_registry_num(void) { return registry.num_components; }
+
+const struct component_info *component_registry_find(const char *name) {
+  for (uint32_t id = 0; id < registry.num_components; id++) {
+    if (registry.infos[id].def != NULL &&
+        strcmp(registry.infos[id].def->name, name) == 0) {
+      return &registry.infos[id];
+    }
+  }
+
+  return NULL;
+}
+
+struct component_lookup_counts *component__new_lookup_counts(void) {
+  struct component_lookup_block *block =
+      calloc(1, sizeof(struct component_lookup_block));
+
+  pthread_mutex_lock(&component_lookup_lock);
+  block->next = component_lookup_blocks;
+  component_lookup_blocks = block;
+  pthread_mutex_unlock(&component_lookup_lock);
+
+  return block->counts;
+}
+
+void component_storage_stats(uint32_t component_id,
+                             struct storage_stats *stats) {
+  memset(stats, 0, sizeof(struct storage_stats));
+  registry.infos[component_id].stats(stats);
+
+  pthread_mutex_lock(&component_lookup_lock);
+  for (struct component_lookup_block *block = component_lookup_blocks; block;
+       block = block->next) {
+    struct component_lookup_counts *c = &block->counts[component_id];
+    stats->lookups += __atomic_load_n(&c->lookups, __ATOMIC_RELAXED);
+    stats->lookup_probes += __atomic_load_n(&c->probes, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&component_lookup_lock);
+}
+
+void component_storage_stats_print(FILE *f) {
+  for (uint32_t id = 0; id < registry.num_components; id++) {
+    if (registry.infos[id].def == NULL) {
+      continue;
+    }
+
+    struct storage_stats stats;
+    component_storage_stats(id, &stats);
+
+    fprintf(f,
+            "%-20s %-10s elems %u cap %u load %.2f tombstones %u probe mean "
+            "%.2f max %u bytes %zu grows %lu lookups %lu probes/lookup %.2f\n",
+            registry.infos[id].def->name, stats.storage, stats.num_elems,
+            stats.cap, stats.load_factor, stats.tombstones, stats.mean_probe,
+            stats.max_probe, stats.bytes, stats.grows, stats.lookups,
+            stats.lookups ? (double)stats.lookup_probes / stats.lookups : 0);
+  }
+}
+
+void component_join_plan(struct component_join_term *terms, uint32_t num_terms,
+                         uint32_t *order) {
+  uint32_t sizes[COMPONENT_JOIN_MAX];
+
+  if (num_terms > COMPONENT_JOIN_MAX) {
+    RUNTIME_ERROR("Joining %u components, the maximum is %d", num_terms,
+                  COMPONENT_JOIN_MAX);
+  }
+
+  // insertion sort, joins are only ever a handful of components
+  for (uint32_t i = 0; i < num_terms; i++) {
+    uint32_t size = terms[i].ops->num_elems(terms[i].storage);
+    uint32_t j = i;
+
+    for (; j > 0 && sizes[j - 1] > size; j--) {
+      sizes[j] = sizes[j - 1];
+      order[j] = order[j - 1];
+    }
+
+    sizes[j] = size;
+    order[j] = i;
+  }
+}
+
+void component__world_init(struct world *world) {
+  world->components = calloc(1, sizeof(struct component_world));
+  pthread_mutex_init(&world->components->lock, NULL);
+
+  for (uint32_t id = 0; id < registry.num_components; id++) {
+    world->storages[id] = registry.infos[id].new_storage();
+  }
+}
+
+void component__world_free(struct world *world) {
+  struct component_world *components = world->components;
+
+  for (uint32_t id = 0; id < registry.num_components; id++) {
+    registry.infos[id].free_storage(world->storages[id]);
+    bit_array_free(&components->presence[id]);
+  }
+
+  if (components->signatures != NULL) {
+    sparse_set_component_entity_signatures_free(components->signatures);
+    free(components->signatures);
+  }
+
+  pthread_mutex_destroy(&components->lock);
+  free(components);
+}
+
+static struct component_world *component__world(void) {
+  return world_current()->components;
+}
+
+const struct component_signature *component_entity_signature(uint32_t ent_id) {
+  struct component_world *components = component__world();
+
+  if (components->signatures == NULL) {
+    return NULL;
+  }
+
+  return sparse_set_component_entity_signatures_lookup(components->signatures,
+                                                       ent_id);
+}
+
+static struct sparse_set_component_entity_signatures *
+component__signatures(void) {
+  struct component_world *components = component__world();
+
+  if (components->signatures == NULL) {
+    components->signatures = sparse_set_component_entity_signatures_new();
+  }
+
+  return components->signatures;
+}
+
+static struct bit_array *component__presence(uint32_t component_id) {
+  struct bit_array *presence = &component__world()->presence[component_id];
+
+  if (presence->alloc == NULL) {
+    *presence = bit_array_new(0);
+  }
+
+  return presence;
+}
+
+const struct bit_array *component_presence(uint32_t component_id) {
+  return component__presence(component_id);
+}
+
+static void component__presence_set(uint32_t ent_id, uint32_t component_id) {
+  struct bit_array *presence = component__presence(component_id);
+  uint32_t idx = entity_index(ent_id);
+
+  if (idx >= presence->num_bits) {
+    size_t num_bits = presence->num_bits * 2;
+    bit_array_resize(presence, num_bits > idx ? num_bits : idx + 1);
+  }
+
+  bit_array_set(presence, idx);
+}
+
+static void component__presence_clear(uint32_t ent_id, uint32_t component_id) {
+  struct bit_array *presence = &component__world()->presence[component_id];
+  uint32_t idx = entity_index(ent_id);
+
+  if (idx < presence->num_bits) {
+    bit_array_clear(presence, idx);
+  }
+}
+
+static void
+component__presence_fill(uint32_t ent_id,
+                         const struct component_signature *signature,
+                         void *arg) {
+  for (uint32_t word = 0; word < COMPONENT_SIGNATURE_WORDS; word++) {
+    for (uint64_t bits = signature->bits[word]; bits; bits &= bits - 1) {
+      component__presence_set(ent_id, word * 64 + __builtin_ctzll(bits));
+    }
+  }
+}
+
+/**
+ * Set the presence bits again from the signatures, once they were replaced.
+ */
+static void component__presence_rebuild(void) {
+  for (uint32_t id = 0; id < COMPONENT_MAX; id++) {
+    bit_array_reset(component__presence(id));
+  }
+
+  component_for_each_entity(&component__presence_fill, NULL);
+}
+
+void component_join_presence(struct component_join_term *terms,
+                             uint32_t num_terms, struct bit_array *out) {
+  uint32_t order[COMPONENT_JOIN_MAX];
+  component_join_plan(terms, num_terms, order);
+
+  // the smallest term first, the others can only clear bits of it
+  bit_array_copy(out, component_presence(terms[order[0]].id));
+
+  for (uint32_t i = 1; i < num_terms; i++) {
+    bit_array_and(out, component_presence(terms[order[i]].id));
+  }
+}
+
+void component_entity__add(uint32_t ent_id, uint32_t component_id) {
+  struct component_world *components = component__world();
+  pthread_mutex_lock(&components->lock);
+
+  struct sparse_set_component_entity_signatures *signatures =
+      component__signatures();
+  struct component_signature *signature =
+      sparse_set_component_entity_signatures_lookup(signatures, ent_id);
+
+  if (signature == NULL) {
+    sparse_set_component_entity_signatures_insert(
+        signatures, ent_id, (struct component_signature){0});
+    signature =
+        sparse_set_component_entity_signatures_lookup(signatures, ent_id);
+  }
+
+  component_signature_set(signature, component_id);
+  component__presence_set(ent_id, component_id);
+  query__component_added(ent_id, component_id, signature);
+  pthread_mutex_unlock(&components->lock);
+}
+
+void component_entity__remove(uint32_t ent_id, uint32_t component_id) {
+  struct component_world *components = component__world();
+  pthread_mutex_lock(&components->lock);
+
+  struct component_signature *signature =
+      components->signatures == NULL
+          ? NULL
+          : sparse_set_component_entity_signatures_lookup(
+                components->signatures, ent_id);
+
+  if (signature != NULL) {
+    component_signature_clear(signature, component_id);
+    component__presence_clear(ent_id, component_id);
+    query__component_removed(ent_id, component_id);
+  }
+
+  pthread_mutex_unlock(&components->lock);
+}
+
+void component__lock(void) { pthread_mutex_lock(&component__world()->lock); }
+
+void component__unlock(void) {
+  pthread_mutex_unlock(&component__world()->lock);
+}
+
+void component_for_each_entity(
+    void (*fn)(uint32_t ent_id, const struct component_signature *signature,
+               void *arg),
+    void *arg) {
+  struct component_world *components = component__world();
+
+  if (components->signatures == NULL) {
+    return;
+  }
+
+  SPARSE_SET_ITER(component_entity_signatures, ent_id, signature,
+                  components->signatures, { fn(ent_id, signature, arg); });
+}
+
+void component_delete_entity(uint32_t ent_id) {
+  struct component_world *components = component__world();
+  pthread_mutex_lock(&components->lock);
+
+  const struct component_signature *found = component_entity_signature(ent_id);
+
+  if (found == NULL) {
+    pthread_mutex_unlock(&components->lock);
+    return;
+  }
+
+  // dropped up front, so the deletes below don't have to keep it up to date
+  struct component_signature signature = *found;
+  sparse_set_component_entity_signatures_delete(components->signatures,
+                                                ent_id);
+  query__entity_deleted(ent_id, &signature);
+
+  for (uint32_t word = 0; word < COMPONENT_SIGNATURE_WORDS; word++) {
+    for (uint64_t bits = signature.bits[word]; bits; bits &= bits - 1) {
+      component__presence_clear(ent_id, word * 64 + __builtin_ctzll(bits));
+    }
+  }
+
+  // the deletes take the lock again, to find the signature gone
+  pthread_mutex_unlock(&components->lock);
+
+  for (uint32_t word = 0; word < COMPONENT_SIGNATURE_WORDS; word++) {
+    for (uint64_t bits = signature.bits[word]; bits; bits &= bits - 1) {
+      registry.infos[word * 64 + __builtin_ctzll(bits)].def->delete_value(
+          ent_id);
+    }
+  }
+}
+
+void component_signatures_snapshot_write(struct snapshot_writer *w) {
+  sparse_set_component_entity_signatures_snapshot_write(
+      component__signatures(), w);
+}
+
+void component_signatures_snapshot_read(struct snapshot_reader *r,
+                                        const uint32_t *id_map,
+                                        uint32_t num_ids) {
+  struct sparse_set_component_entity_signatures *signatures =
+      component__signatures();
+  sparse_set_component_entity_signatures_snapshot_read(signatures, r);
+  // every entity may have changed, the queries are matched again on next use
+  query__invalidate();
+
+  bool same_ids = true;
+  for (uint32_t id = 0; id < num_ids; id++) {
+    same_ids = same_ids && id_map[id] == id;
+  }
+
+  if (same_ids) {
+    component__presence_rebuild();
+    return;
+  }
+
+  SPARSE_SET_ITER(component_entity_signatures, ent_id, signature, signatures, {
+    (void)ent_id;
+    struct component_signature remapped = {0};
+
+    for (uint32_t id = 0; id < num_ids; id++) {
+      if (component_signature_has(signature, id) && id_map[id] != UINT32_MAX) {
+        component_signature_set(&remapped, id_map[id]);
+      }
+    }
+
+    *signature = remapped;
+  });
+  component__presence_rebuild();
+}
@@ -2,56 +2,525 @@
 #define __COMPONENT_H_
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
+#include "archetype.h"
+#include "bit_array.h"
+#include "change.h"
+#include "group_hash.h"
 #include "hash_set.h"
 #include "hash_table.h"
+#include "sparse_set.h"
+#include "storage_stats.h"
+#include "tag_set.h"
+#include "world.h"
 
 #define STRUCT_MEMBER_TYPE(TYPE, MEMBER) typeof(((TYPE *)0)->MEMBER)
 
 // Components of the entity component system
 
-#define COMPONENT_DEF(NAME, TYPE)                                              \
+// Storage backends a component can be declared with, see
+// DEFINE_COMPONENT_WITH_STORAGE.
+#define COMPONENT_STORAGE_DEFINE_hash_table DEFINE_HASH
+#define COMPONENT_STORAGE_MAKE_hash_table MAKE_HASH
+#define COMPONENT_STORAGE_DEFINE_sparse_set DEFINE_SPARSE_SET
+#define COMPONENT_STORAGE_MAKE_sparse_set MAKE_SPARSE_SET
+#define COMPONENT_STORAGE_DEFINE_archetype DEFINE_ARCHETYPE_STORAGE
+#define COMPONENT_STORAGE_MAKE_archetype MAKE_ARCHETYPE_STORAGE
+#define COMPONENT_STORAGE_DEFINE_group_hash DEFINE_GROUP_HASH
+#define COMPONENT_STORAGE_MAKE_group_hash MAKE_GROUP_HASH
+#define COMPONENT_STORAGE_DEFINE_tag_set DEFINE_TAG_SET
+#define COMPONENT_STORAGE_MAKE_tag_set MAKE_TAG_SET
+
+// archetype storage keeps its values in the shared archetype tables, it has
+// no arrays of its own to allocate
+#define COMPONENT_STORAGE_NEW_hash_table(NAME, ID, ALLOC)                      \
+  hash_table_##NAME##_new_with_allocator(ALLOC)
+#define COMPONENT_STORAGE_NEW_sparse_set(NAME, ID, ALLOC)                      \
+  sparse_set_##NAME##_new_with_allocator(ALLOC)
+#define COMPONENT_STORAGE_NEW_archetype(NAME, ID, ALLOC)                       \
+  archetype_##NAME##_new(ID)
+#define COMPONENT_STORAGE_NEW_group_hash(NAME, ID, ALLOC)                      \
+  group_hash_##NAME##_new_with_allocator(ALLOC)
+#define COMPONENT_STORAGE_NEW_tag_set(NAME, ID, ALLOC)                         \
+  tag_set_##NAME##_new_with_allocator(ALLOC)
+
+// free a storage along with its world: its arrays, then the storage itself
+// from the allocator it came from
+#define COMPONENT_STORAGE_FREE_hash_table(NAME, STORAGE)                       \
+  hash_table_##NAME##_free(STORAGE);                                           \
+  allocator_free((STORAGE)->alloc, (STORAGE), sizeof(*(STORAGE)))
+#define COMPONENT_STORAGE_FREE_sparse_set(NAME, STORAGE)                       \
+  sparse_set_##NAME##_free(STORAGE);                                           \
+  allocator_free((STORAGE)->alloc, (STORAGE), sizeof(*(STORAGE)))
+#define COMPONENT_STORAGE_FREE_archetype(NAME, STORAGE)                        \
+  archetype_##NAME##_free(STORAGE);                                            \
+  free(STORAGE)
+#define COMPONENT_STORAGE_FREE_group_hash(NAME, STORAGE)                       \
+  group_hash_##NAME##_free(STORAGE);                                           \
+  allocator_free((STORAGE)->alloc, (STORAGE), sizeof(*(STORAGE)))
+#define COMPONENT_STORAGE_FREE_tag_set(NAME, STORAGE)                          \
+  tag_set_##NAME##_free(STORAGE);                                              \
+  allocator_free((STORAGE)->alloc, (STORAGE), sizeof(*(STORAGE)))
+
+// where iterating a storage goes after slot `IDX`, and how joins look up the
+// keys they probe with (always alive entities): the next slot and a lookup,
+// except for tag_set which skips to its next set bit and only tests the bit
+#define COMPONENT_STORAGE_NEXT_SLOT_hash_table(NAME, STORAGE, IDX) (IDX)
+#define COMPONENT_STORAGE_NEXT_SLOT_sparse_set(NAME, STORAGE, IDX) (IDX)
+#define COMPONENT_STORAGE_NEXT_SLOT_archetype(NAME, STORAGE, IDX) (IDX)
+#define COMPONENT_STORAGE_NEXT_SLOT_group_hash(NAME, STORAGE, IDX) (IDX)
+#define COMPONENT_STORAGE_NEXT_SLOT_tag_set(NAME, STORAGE, IDX)                \
+  tag_set_##NAME##_next_slot(STORAGE, IDX)
+#define COMPONENT_STORAGE_PROBE_hash_table(NAME, STORAGE, K)                   \
+  hash_table_##NAME##_lookup(STORAGE, K)
+#define COMPONENT_STORAGE_PROBE_sparse_set(NAME, STORAGE, K)                   \
+  sparse_set_##NAME##_lookup(STORAGE, K)
+#define COMPONENT_STORAGE_PROBE_archetype(NAME, STORAGE, K)                    \
+  archetype_##NAME##_lookup(STORAGE, K)
+#define COMPONENT_STORAGE_PROBE_group_hash(NAME, STORAGE, K)                   \
+  group_hash_##NAME##_lookup(STORAGE, K)
+#define COMPONENT_STORAGE_PROBE_tag_set(NAME, STORAGE, K)                      \
+  tag_set_##NAME##_probe(STORAGE, K)
+#define COMPONENT_STORAGE_NEXT_SLOT_OP_hash_table(NAME) NULL
+#define COMPONENT_STORAGE_NEXT_SLOT_OP_sparse_set(NAME) NULL
+#define COMPONENT_STORAGE_NEXT_SLOT_OP_archetype(NAME) NULL
+#define COMPONENT_STORAGE_NEXT_SLOT_OP_group_hash(NAME) NULL
+#define COMPONENT_STORAGE_NEXT_SLOT_OP_tag_set(NAME)                           \
+  &component_##NAME##__erased_next_slot
+
+/**
+ * Get a new component id, ids are dense and unique across the program so they
+ * can index a `struct component_signature`.
+ */
+uint32_t component_registry_new_id(void);
+
+/**
+ * Type erased access to a component's storage.
+ */
+struct component_storage_ops {
+  uint32_t (*num_elems)(void *storage);
+  uint32_t (*num_slots)(void *storage);
+  void *(*slot)(void *storage, uint32_t idx, uint32_t *key);
+  void *(*lookup)(void *storage, uint32_t k);
+  // first slot at or after `idx` that may hold a value, or num_slots. NULL
+  // when that's always `idx`
+  uint32_t (*next_slot)(void *storage, uint32_t idx);
+};
+
+#define COMPONENT_DEF(NAME, TYPE, STORAGE)                                     \
   struct component_##NAME##_def {                                              \
     const char *const name;                                                    \
     const uint32_t id;                                                         \
-    struct hash_table_component_##NAME##_storage *const storage;               \
+    struct STORAGE##_component_##NAME##_storage *const storage;                \
     void (*const add_value)(uint32_t ent_id, TYPE val);                        \
     TYPE *(*const lookup_value)(uint32_t ent_id);                              \
     void (*const delete_value)(uint32_t ent_id);                               \
+    void (*const reserve)(uint32_t n);                                         \
+    void (*const add_values)(const uint32_t *ent_ids, const TYPE *vals,        \
+                             uint32_t n);                                      \
+  };
+
+/**
+ * Layout shared by every `struct component_NAME_def`, for handling components
+ * without knowing their types.
+ */
+struct component_def {
+  const char *const name;
+  const uint32_t id;
+  // the storage in the default world, see COMPONENT_STORAGE
+  void *const storage;
+  void (*const add_value)(void);
+  void *(*const lookup_value)(uint32_t ent_id);
+  void (*const delete_value)(uint32_t ent_id);
+  void (*const reserve)(uint32_t n);
+  void (*const add_values)(void);
+};
+
+/**
+ * What the registry knows about a component, for handling it by id.
+ */
+struct component_info {
+  const struct component_def *def;
+  size_t elem_size;
+  // def->add_values with the type of the values erased
+  void (*add_values)(const uint32_t *ent_ids, const void *vals, uint32_t n);
+  // write the storage to a snapshot, or replace it with the one read from it
+  void (*snapshot_write)(struct snapshot_writer *w);
+  void (*snapshot_read)(struct snapshot_reader *r);
+  // fill in what the storage knows about itself, see component_storage_stats
+  void (*stats)(struct storage_stats *stats);
+  // an empty storage for a new world, and freeing it along with the world
+  void *(*new_storage)(void);
+  void (*free_storage)(void *storage);
+};
+
+/**
+ * Make a component reachable from its id, done once its storage is created.
+ * Its storage becomes the default world's.
+ */
+void component_registry_add(const struct component_info *info);
+
+/**
+ * The component registered with `component_id`.
+ */
+const struct component_info *component_registry_info(uint32_t component_id);
+
+/**
+ * Number of registered components, their ids are below it.
+ */
+uint32_t component_registry_num(void);
+
+/**
+ * The component registered as `name`, NULL if there is none.
+ */
+const struct component_info *component_registry_find(const char *name);
+
+/**
+ * Health of the storage of `component_id`: its fill, probe distances and
+ * memory, and the lookups done on it (by any thread) since the program
+ * started.
+ */
+void component_storage_stats(uint32_t component_id,
+                             struct storage_stats *stats);
+
+/**
+ * Print the storage stats of every registered component, a line each.
+ */
+void component_storage_stats_print(FILE *f);
+
+// lookups and the probes they took, per component id. Every thread counts
+// into a block of its own so lookups from parallel joins don't contend
+struct component_lookup_counts {
+  uint64_t lookups;
+  uint64_t probes;
+};
+
+extern _Thread_local struct component_lookup_counts *component__lookup_counts;
+
+struct component_lookup_counts *component__new_lookup_counts(void);
+
+/**
+ * Count a lookup of `component_id` that started when the thread's
+ * storage_probes was at `probes_before`.
+ */
+static inline void component__count_lookup(uint32_t component_id,
+                                           uint64_t probes_before) {
+  struct component_lookup_counts *counts = component__lookup_counts;
+
+  if (counts == NULL) {
+    counts = component__lookup_counts = component__new_lookup_counts();
+  }
+
+  // only this thread writes its block, the atomics keep the reads of
+  // component_storage_stats whole without a locked add
+  struct component_lookup_counts *c = &counts[component_id];
+  __atomic_store_n(&c->lookups,
+                   __atomic_load_n(&c->lookups, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&c->probes,
+                   __atomic_load_n(&c->probes, __ATOMIC_RELAXED) +
+                       storage_probes - probes_before,
+                   __ATOMIC_RELAXED);
+}
+
+/**
+ * Components `ent_id` has, or NULL if it never had any.
+ */
+const struct component_signature *component_entity_signature(uint32_t ent_id);
+
+/**
+ * Call `fn` with every entity that has any component, and its components.
+ */
+void component_for_each_entity(
+    void (*fn)(uint32_t ent_id, const struct component_signature *signature,
+               void *arg),
+    void *arg);
+
+/**
+ * A bit per entity index, set if the entity using the index has a value of
+ * `component_id`.
+ */
+const struct bit_array *component_presence(uint32_t component_id);
+
+/**
+ * Delete every component of `ent_id`, only touching the storages its signature
+ * says it has a value in.
+ */
+void component_delete_entity(uint32_t ent_id);
+
+// the signatures of every entity, for snapshots. `id_map` maps the component
+// ids of the snapshot to the ids of the components in this program, UINT32_MAX
+// for the ones it doesn't have
+void component_signatures_snapshot_write(struct snapshot_writer *w);
+void component_signatures_snapshot_read(struct snapshot_reader *r,
+                                        const uint32_t *id_map,
+                                        uint32_t num_ids);
+
+// keep the signature of `ent_id` in sync with its components
+void component_entity__add(uint32_t ent_id, uint32_t component_id);
+void component_entity__remove(uint32_t ent_id, uint32_t component_id);
+
+// the lock the signatures of the current world change under, for walking them
+// while other workers add and delete
+void component__lock(void);
+void component__unlock(void);
+
+// the storages, signatures and presence bits of a world, created and freed
+// with it (see world.h)
+void component__world_init(struct world *world);
+void component__world_free(struct world *world);
+
+/**
+ * Storage of component `NAME` in the current world.
+ */
+#define COMPONENT_STORAGE(NAME)                                                \
+  ((typeof(NAME.storage))world_current()->storages[NAME.id])
+
+/**
+ * Define a component kept in the given storage backend, either `hash_table`
+ * (robin hood hash table keyed by entity id), `sparse_set` (paged sparse index
+ * into packed arrays: lookups are a direct index and iterating only touches
+ * live values), `group_hash` (hash table probed a group of one byte tags at a
+ * time with SIMD, for lookup heavy components), `archetype` (a column in the
+ * table of every archetype that has the component, see
+ * FOR_ARCHETYPE_JOIN_COMPONENT_2) or `tag_set` (a bit per entity, for
+ * components without a value, see DEFINE_TAG).
+ *
+ * Also defines the storage agnostic accessors the joins are built on.
+ */
+#define DEFINE_COMPONENT_WITH_STORAGE(NAME, TYPE, STORAGE)                     \
+  COMPONENT_STORAGE_DEFINE_##STORAGE(TYPE, component_##NAME##_storage);        \
+  COMPONENT_DEF(NAME, TYPE, STORAGE);                                          \
+                                                                               \
+  static inline uint32_t component_##NAME##__num_slots(                        \
+      struct STORAGE##_component_##NAME##_storage *storage) {                  \
+    return STORAGE##_component_##NAME##_storage_num_slots(storage);            \
+  }                                                                            \
+                                                                               \
+  static inline TYPE *component_##NAME##__slot(                                \
+      struct STORAGE##_component_##NAME##_storage *storage, uint32_t idx,      \
+      uint32_t *key) {                                                         \
+    return STORAGE##_component_##NAME##_storage_slot(storage, idx, key);       \
+  }                                                                            \
+                                                                               \
+  /* lookup of a key of an alive entity, for joins */                          \
+  static inline TYPE *component_##NAME##__lookup(                              \
+      struct STORAGE##_component_##NAME##_storage *storage, uint32_t k) {      \
+    return COMPONENT_STORAGE_PROBE_##STORAGE(component_##NAME##_storage,       \
+                                             storage, k);                      \
+  }                                                                            \
+                                                                               \
+  static inline uint32_t component_##NAME##__next_slot(                        \
+      struct STORAGE##_component_##NAME##_storage *storage, uint32_t idx) {    \
+    return COMPONENT_STORAGE_NEXT_SLOT_##STORAGE(component_##NAME##_storage,   \
+                                                 storage, idx);                \
+  }                                                                            \
+                                                                               \
+  static uint32_t component_##NAME##__erased_num_elems(void *storage) {        \
+    return ((struct STORAGE##_component_##NAME##_storage *)storage)            \
+        ->num_elems;                                                           \
+  }                                                                            \
+                                                                               \
+  static uint32_t component_##NAME##__erased_num_slots(void *storage) {        \
+    return component_##NAME##__num_slots(storage);                             \
+  }                                                                            \
+                                                                               \
+  static void *component_##NAME##__erased_slot(void *storage, uint32_t idx,    \
+                                               uint32_t *key) {                \
+    return component_##NAME##__slot(storage, idx, key);                        \
+  }                                                                            \
+                                                                               \
+  static void *component_##NAME##__erased_lookup(void *storage, uint32_t k) {  \
+    return component_##NAME##__lookup(storage, k);                             \
+  }                                                                            \
+                                                                               \
+  static __attribute__((unused)) uint32_t                                      \
+      component_##NAME##__erased_next_slot(void *storage, uint32_t idx) {      \
+    return component_##NAME##__next_slot(storage, idx);                        \
+  }                                                                            \
+                                                                               \
+  static const struct component_storage_ops component_##NAME##__ops            \
+      __attribute__((unused)) = {                                              \
+      .num_elems = &component_##NAME##__erased_num_elems,                      \
+      .num_slots = &component_##NAME##__erased_num_slots,                      \
+      .slot = &component_##NAME##__erased_slot,                                \
+      .lookup = &component_##NAME##__erased_lookup,                            \
+      .next_slot = COMPONENT_STORAGE_NEXT_SLOT_OP_##STORAGE(NAME),             \
   };
 
 #define DEFINE_COMPONENT(NAME, TYPE)                                           \
-  DEFINE_HASH(TYPE, component_##NAME##_storage);                               \
-  COMPONENT_DEF(NAME, TYPE);
+  DEFINE_COMPONENT_WITH_STORAGE(NAME, TYPE, hash_table)
 
-#define REGISTER_COMPONENT(NAME, TYPE)                                         \
-  MAKE_HASH(TYPE, component_##NAME##_storage);                                 \
+/**
+ * Like REGISTER_COMPONENT_WITH_STORAGE, with the storage's arrays allocated
+ * from `ALLOC` (a `const struct allocator *`), e.g. a pool shared by the
+ * components that grow and shrink the most:
+ *
+ * static struct allocator_pool tables = ALLOCATOR_POOL_INIT(tables);
+ * REGISTER_COMPONENT_WITH_ALLOCATOR(position, struct position_storage,
+ *                                   hash_table, &tables.allocator);
+ */
+#define REGISTER_COMPONENT_WITH_ALLOCATOR(NAME, TYPE, STORAGE, ALLOC)          \
+  COMPONENT_STORAGE_MAKE_##STORAGE(TYPE, component_##NAME##_storage);          \
   static struct component_##NAME##_def NAME                                    \
       __attribute__((used, section("component_def_array")));                   \
-  static const uint32_t component_##NAME##_id = __COUNTER__;                   \
+  _Static_assert(sizeof(struct component_##NAME##_def) ==                      \
+                     sizeof(struct component_def),                             \
+                 "component definitions must share struct component_def's "    \
+                 "layout");                                                    \
   void component_##NAME##_add_value(uint32_t ent_id, TYPE val) {               \
-    hash_table_component_##NAME##_storage_insert(NAME.storage, ent_id, val);   \
+    STORAGE##_component_##NAME##_storage_insert(COMPONENT_STORAGE(NAME),       \
+                                                ent_id, val);                  \
+    component_entity__add(ent_id, NAME.id);                                    \
+    change_added(NAME.id, ent_id);                                             \
   }                                                                            \
   TYPE *component_##NAME##_lookup_value(uint32_t ent_id) {                     \
-    return hash_table_component_##NAME##_storage_lookup(NAME.storage, ent_id); \
+    uint64_t probes = storage_probes;                                          \
+    TYPE *val = STORAGE##_component_##NAME##_storage_lookup(                   \
+        COMPONENT_STORAGE(NAME), ent_id);                                      \
+    component__count_lookup(NAME.id, probes);                                  \
+    return val;                                                                \
   }                                                                            \
   void component_##NAME##_delete_value(uint32_t ent_id) {                      \
-    hash_table_component_##NAME##_storage_delete(NAME.storage, ent_id);        \
+    if (!STORAGE##_component_##NAME##_storage_delete(COMPONENT_STORAGE(NAME),  \
+                                                     ent_id)) {                \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    component_entity__remove(ent_id, NAME.id);                                 \
+    change_removed(NAME.id, ent_id);                                           \
+  }                                                                            \
+  void component_##NAME##_reserve(uint32_t n) {                                \
+    STORAGE##_component_##NAME##_storage_reserve(COMPONENT_STORAGE(NAME), n);  \
+  }                                                                            \
+  void component_##NAME##_add_values(const uint32_t *ent_ids,                  \
+                                     const TYPE *vals, uint32_t n) {           \
+    STORAGE##_component_##NAME##_storage_insert_many(COMPONENT_STORAGE(NAME),  \
+                                                     ent_ids, vals, n);        \
+    for (uint32_t i = 0; i < n; i++) {                                         \
+      component_entity__add(ent_ids[i], NAME.id);                              \
+      change_added(NAME.id, ent_ids[i]);                                       \
+    }                                                                          \
+  }                                                                            \
+  static void component_##NAME##__erased_add_values(                           \
+      const uint32_t *ent_ids, const void *vals, uint32_t n) {                 \
+    component_##NAME##_add_values(ent_ids, vals, n);                           \
+  }                                                                            \
+  static void component_##NAME##__snapshot_write(struct snapshot_writer *w) {  \
+    STORAGE##_component_##NAME##_storage_snapshot_write(                       \
+        COMPONENT_STORAGE(NAME), w);                                           \
+  }                                                                            \
+  static void component_##NAME##__snapshot_read(struct snapshot_reader *r) {   \
+    STORAGE##_component_##NAME##_storage_snapshot_read(                        \
+        COMPONENT_STORAGE(NAME), r);                                           \
+  }                                                                            \
+  static void component_##NAME##__stats(struct storage_stats *stats) {         \
+    stats->storage = #STORAGE;                                                 \
+    STORAGE##_component_##NAME##_storage_stats(COMPONENT_STORAGE(NAME),        \
+                                               stats);                         \
+  }                                                                            \
+  static void *component_##NAME##__new_storage(void) {                         \
+    return COMPONENT_STORAGE_NEW_##STORAGE(component_##NAME##_storage,         \
+                                           NAME.id, (ALLOC));                  \
+  }                                                                            \
+  static void component_##NAME##__free_storage(void *storage) {                \
+    struct STORAGE##_component_##NAME##_storage *s = storage;                  \
+    COMPONENT_STORAGE_FREE_##STORAGE(component_##NAME##_storage, s);           \
   }                                                                            \
   static void component_init__##NAME(void) __attribute__((constructor));       \
   static void component_init__##NAME(void) {                                   \
+    uint32_t id = component_registry_new_id();                                 \
     memcpy(&NAME,                                                              \
            &(struct component_##NAME##_def){                                   \
                .name = #NAME,                                                  \
-               .id = component_##NAME##_id,                                    \
-               .storage = hash_table_component_##NAME##_storage_new(),         \
+               .id = id,                                                       \
+               .storage = COMPONENT_STORAGE_NEW_##STORAGE(                     \
+                   component_##NAME##_storage, id, (ALLOC)),                   \
                .add_value = &component_##NAME##_add_value,                     \
                .lookup_value = &component_##NAME##_lookup_value,               \
-               .delete_value = &component_##NAME##_delete_value},              \
+               .delete_value = &component_##NAME##_delete_value,               \
+               .reserve = &component_##NAME##_reserve,                         \
+               .add_values = &component_##NAME##_add_values},                  \
            sizeof(struct component_##NAME##_def));                             \
+    component_registry_add(&(struct component_info){                           \
+        .def = (const struct component_def *)&NAME,                            \
+        .elem_size = sizeof(TYPE),                                             \
+        .add_values = &component_##NAME##__erased_add_values,                  \
+        .snapshot_write = &component_##NAME##__snapshot_write,                 \
+        .snapshot_read = &component_##NAME##__snapshot_read,                   \
+        .stats = &component_##NAME##__stats,                                   \
+        .new_storage = &component_##NAME##__new_storage,                       \
+        .free_storage = &component_##NAME##__free_storage});                   \
   }
 
+#define REGISTER_COMPONENT_WITH_STORAGE(NAME, TYPE, STORAGE)                   \
+  REGISTER_COMPONENT_WITH_ALLOCATOR(NAME, TYPE, STORAGE, &allocator_heap)
+
+#define REGISTER_COMPONENT(NAME, TYPE)                                         \
+  REGISTER_COMPONENT_WITH_STORAGE(NAME, TYPE, hash_table)
+
+/**
+ * Value of a tag, there's nothing to it.
+ */
+struct component_tag {};
+
+/**
+ * Define a tag: a component without a value that entities either have or
+ * don't, e.g. `is_dead`. Tags are kept as a bit per entity index, so probing
+ * one in a join is a bit test and walking one skips a word of entities without
+ * it at a time.
+ *
+ * Usage:
+ * DEFINE_TAG(is_dead);
+ * REGISTER_TAG(is_dead);
+ *
+ * ADD_TAG(is_dead, ent);
+ * FOR_JOIN_COMPONENT_2(position, is_dead, d, { ... });
+ */
+#define DEFINE_TAG(NAME)                                                       \
+  DEFINE_COMPONENT_WITH_STORAGE(NAME, struct component_tag, tag_set)
+
+#define REGISTER_TAG(NAME)                                                     \
+  REGISTER_COMPONENT_WITH_STORAGE(NAME, struct component_tag, tag_set)
+
+#define ADD_TAG(NAME, ENT_ID) NAME.add_value((ENT_ID), (struct component_tag){})
+
+#define HAS_TAG(NAME, ENT_ID) (NAME.lookup_value(ENT_ID) != NULL)
+
+/**
+ * Iterate over every value of a component, whatever its storage.
+ *
+ * @param COMP_NAME component to iterate over.
+ * @param KEY_NAME variable to receive the entity id.
+ * @param VAL_NAME variable to receive a pointer to the value.
+ */
+#define COMPONENT_ITER(COMP_NAME, KEY_NAME, VAL_NAME, ...)                     \
+  for (typeof(*COMP_NAME.storage) *component_##COMP_NAME##_iter_storage =      \
+           COMPONENT_STORAGE(COMP_NAME);                                       \
+       component_##COMP_NAME##_iter_storage != NULL;                           \
+       component_##COMP_NAME##_iter_storage = NULL)                            \
+    for (uint32_t component_##COMP_NAME##_iter_idx =                           \
+             component_##COMP_NAME##__next_slot(                               \
+                 component_##COMP_NAME##_iter_storage, 0);                     \
+         component_##COMP_NAME##_iter_idx <                                    \
+         component_##COMP_NAME##__num_slots(                                   \
+             component_##COMP_NAME##_iter_storage);                            \
+         component_##COMP_NAME##_iter_idx =                                    \
+             component_##COMP_NAME##__next_slot(                               \
+                 component_##COMP_NAME##_iter_storage,                         \
+                 component_##COMP_NAME##_iter_idx + 1)) {                      \
+      uint32_t KEY_NAME;                                                       \
+      typeof(component_##COMP_NAME##__lookup(COMP_NAME.storage, 0)) VAL_NAME = \
+          component_##COMP_NAME##__slot(component_##COMP_NAME##_iter_storage,  \
+                                        component_##COMP_NAME##_iter_idx,      \
+                                        &KEY_NAME);                            \
+      if (VAL_NAME != NULL) {                                                  \
+        __VA_ARGS__                                                            \
+      }                                                                        \
+    }
+
 /**
  * Union of all entities that have the given components.
  *
@@ -70,20 +539,275 @@
  */
 #define FOR_JOIN_COMPONENT_1(COMP_NAME, ITER_VAR, ...)                         \
   do {                                                                         \
-    HASH_TABLE_ITER(component_##COMP_NAME##_storage, k, v, COMP_NAME.storage,  \
-                    {                                                          \
-                      struct {                                                 \
-                        uint32_t id;                                           \
-                        typeof(v) COMP_NAME                                    \
-                      } ITER_VAR = {k, v};                                     \
-                      { __VA_ARGS__ }                                          \
-                    });                                                        \
-    while (0)
+    COMPONENT_ITER(COMP_NAME, k, v, {                                          \
+      struct {                                                                 \
+        uint32_t id;                                                           \
+        typeof(v) COMP_NAME;                                                   \
+      } ITER_VAR = {k, v};                                                     \
+      { __VA_ARGS__ }                                                          \
+    });                                                                        \
+  } while (0)
+
+#define COMPONENT_JOIN_MAX 8
+
+struct component_join_term {
+  void *storage;
+  const struct component_storage_ops *ops;
+  uint32_t id;
+};
+
+/**
+ * Look up `key` in the storage of `term`, counted in the component's lookup
+ * stats.
+ */
+static inline void *component_join_term_lookup(struct component_join_term *term,
+                                               uint32_t key) {
+  uint64_t probes = storage_probes;
+  void *val = term->ops->lookup(term->storage, key);
+  component__count_lookup(term->id, probes);
+  return val;
+}
+
+/**
+ * First slot of `term` at or after `idx` that may hold a value, for walking the
+ * driving term of a join.
+ */
+static inline uint32_t
+component_join_next_slot(struct component_join_term *term, uint32_t idx) {
+  return term->ops->next_slot ? term->ops->next_slot(term->storage, idx) : idx;
+}
+
+/**
+ * Order the terms of a join by increasing number of elements, the first one
+ * drives the join and the others are probed in that order.
+ */
+void component_join_plan(struct component_join_term *terms, uint32_t num_terms,
+                         uint32_t *order);
+
+/**
+ * Look up the driving slot `idx` and probe the other terms for its key,
+ * returns whether every term has a value for it.
+ */
+static inline bool component_join_probe(struct component_join_term *terms,
+                                        uint32_t num_terms,
+                                        const uint32_t *order, uint32_t idx,
+                                        uint32_t *key, void **vals) {
+  struct component_join_term *driver = &terms[order[0]];
+
+  vals[order[0]] = driver->ops->slot(driver->storage, idx, key);
+
+  if (vals[order[0]] == NULL) {
+    return false;
+  }
+
+  for (uint32_t i = 1; i < num_terms; i++) {
+    struct component_join_term *t = &terms[order[i]];
+    vals[order[i]] = component_join_term_lookup(t, *key);
+
+    if (vals[order[i]] == NULL) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+#define FOR_JOIN__TERM(I, COMP_NAME)                                           \
+  {COMPONENT_STORAGE(COMP_NAME), &component_##COMP_NAME##__ops, COMP_NAME.id},
+#define FOR_JOIN__MEMBER(I, COMP_NAME)                                         \
+  typeof(component_##COMP_NAME##__lookup(COMP_NAME.storage, 0)) COMP_NAME;
+#define FOR_JOIN__VALUE(I, COMP_NAME) , component_join_vals[I]
+
+/**
+ * Intersection of all entities that have the given components, for any number
+ * of components (up to COMPONENT_JOIN_MAX).
+ *
+ * The component with the fewest elements drives the join, the others are
+ * probed in order of increasing size, so the cost is bound by the smallest
+ * component rather than by the first one named.
+ * @param COMP_NAMES parenthesized list of components to iterate over.
+ * @param ITER_VAR variable to receive each value of the iteration will be given
+ * the type of `struct {uint32_t id; COMP_TYPE_0 *COMP_NAME_0; ...}` where
+ * `COMP_TYPE_x` is the storage type of the component `COMP_NAME_x`.
+ *
+ * Usage:
+ * FOR_JOIN_COMPONENTS((position, velocity, is_enemy), i, {
+ *    i.position->x += i.velocity->dx;
+ * });
+ */
+#define FOR_JOIN_COMPONENTS(COMP_NAMES, ITER_VAR, ...)                         \
+  do {                                                                         \
+    struct component_join_term component_join_terms[] = {                      \
+        MACRO_FOR_EACH(FOR_JOIN__TERM, MACRO_UNPAREN COMP_NAMES)};             \
+    const uint32_t component_join_num_terms =                                  \
+        sizeof(component_join_terms) / sizeof(component_join_terms[0]);        \
+    uint32_t component_join_order[COMPONENT_JOIN_MAX];                         \
+    component_join_plan(component_join_terms, component_join_num_terms,        \
+                        component_join_order);                                 \
+    struct component_join_term *component_join_driver =                        \
+        &component_join_terms[component_join_order[0]];                        \
+    for (uint32_t component_join_idx =                                         \
+             component_join_next_slot(component_join_driver, 0);               \
+         component_join_idx < component_join_driver->ops->num_slots(           \
+                                  component_join_driver->storage);             \
+         component_join_idx = component_join_next_slot(                        \
+             component_join_driver, component_join_idx + 1)) {                 \
+      uint32_t component_join_key;                                             \
+      void *component_join_vals[COMPONENT_JOIN_MAX];                           \
+      if (!component_join_probe(component_join_terms,                          \
+                                component_join_num_terms,                      \
+                                component_join_order, component_join_idx,      \
+                                &component_join_key, component_join_vals)) {   \
+        continue;                                                              \
+      }                                                                        \
+      struct {                                                                 \
+        uint32_t id;                                                           \
+        MACRO_FOR_EACH(FOR_JOIN__MEMBER, MACRO_UNPAREN COMP_NAMES)             \
+      } ITER_VAR = {component_join_key MACRO_FOR_EACH(                         \
+          FOR_JOIN__VALUE, MACRO_UNPAREN COMP_NAMES)};                         \
+      { __VA_ARGS__ }                                                          \
+    }                                                                          \
+  } while (0)
+
+/**
+ * Look up `key` in every term of a join, returns whether they all have a value
+ * for it.
+ */
+static inline bool component_join_lookup(struct component_join_term *terms,
+                                         uint32_t num_terms, uint32_t key,
+                                         void **vals) {
+  for (uint32_t i = 0; i < num_terms; i++) {
+    vals[i] = component_join_term_lookup(&terms[i], key);
+
+    if (vals[i] == NULL) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Intersect the presence bits of the components of a join into `out`,
+ * starting from the one with the fewest elements.
+ */
+void component_join_presence(struct component_join_term *terms,
+                             uint32_t num_terms, struct bit_array *out);
+
+/**
+ * Intersection of all entities that have the given components, like
+ * FOR_JOIN_COMPONENTS, found by intersecting the components' presence bits
+ * before any value is looked up. Only the entities that have all of them are
+ * visited, in order of entity index.
+ *
+ * Suits joins of components that are all large but overlap little: the
+ * intersection costs a few words per 4096 entities, rather than a probe per
+ * element of the smallest component. Don't `return` from the body, the
+ * intersection is freed once the loop ends.
+ *
+ * Usage:
+ * FOR_JOIN_BITSET_COMPONENTS((position, velocity, collider), i, {
+ *    i.position->x += i.velocity->dx;
+ * });
+ */
+#define FOR_JOIN_BITSET_COMPONENTS(COMP_NAMES, ITER_VAR, ...)                  \
+  do {                                                                         \
+    struct component_join_term component_join_terms[] = {                      \
+        MACRO_FOR_EACH(FOR_JOIN__TERM, MACRO_UNPAREN COMP_NAMES)};             \
+    const uint32_t component_join_num_terms =                                  \
+        sizeof(component_join_terms) / sizeof(component_join_terms[0]);        \
+    struct bit_array component_join_matches = bit_array_new(0);                \
+    component_join_presence(component_join_terms, component_join_num_terms,    \
+                            &component_join_matches);                          \
+    BIT_ARRAY_ITER(&component_join_matches, component_join_idx, {              \
+      uint32_t component_join_key = entity_id_at_index(component_join_idx);    \
+      void *component_join_vals[COMPONENT_JOIN_MAX];                           \
+      if (!component_join_lookup(component_join_terms,                         \
+                                 component_join_num_terms, component_join_key, \
+                                 component_join_vals)) {                       \
+        continue;                                                              \
+      }                                                                        \
+      struct {                                                                 \
+        uint32_t id;                                                           \
+        MACRO_FOR_EACH(FOR_JOIN__MEMBER, MACRO_UNPAREN COMP_NAMES)             \
+      } ITER_VAR = {component_join_key MACRO_FOR_EACH(                         \
+          FOR_JOIN__VALUE, MACRO_UNPAREN COMP_NAMES)};                         \
+      { __VA_ARGS__ }                                                          \
+    });                                                                        \
+    bit_array_free(&component_join_matches);                                   \
+  } while (0)
+
+#define FOR_JOIN__ID(I, COMP_NAME) COMP_NAME.id,
+
+#define FOR_JOIN__SINCE(COMP_NAMES, SINCE, ADDED, ITER_VAR, ...)               \
+  do {                                                                         \
+    struct component_join_term component_join_terms[] = {                      \
+        MACRO_FOR_EACH(FOR_JOIN__TERM, MACRO_UNPAREN COMP_NAMES)};             \
+    const uint32_t component_join_ids[] = {                                    \
+        MACRO_FOR_EACH(FOR_JOIN__ID, MACRO_UNPAREN COMP_NAMES)};               \
+    struct change_iter component_join_changes;                                 \
+    change_iter_init(&component_join_changes, component_join_ids[0], (SINCE),  \
+                     (ADDED));                                                 \
+    uint32_t component_join_key;                                               \
+    while (change_iter_next(&component_join_changes, &component_join_key)) {   \
+      void *component_join_vals[COMPONENT_JOIN_MAX];                           \
+      if (!component_join_lookup(                                              \
+              component_join_terms,                                            \
+              sizeof(component_join_terms) / sizeof(component_join_terms[0]),  \
+              component_join_key, component_join_vals)) {                      \
+        continue;                                                              \
+      }                                                                        \
+      struct {                                                                 \
+        uint32_t id;                                                           \
+        MACRO_FOR_EACH(FOR_JOIN__MEMBER, MACRO_UNPAREN COMP_NAMES)             \
+      } ITER_VAR = {component_join_key MACRO_FOR_EACH(                         \
+          FOR_JOIN__VALUE, MACRO_UNPAREN COMP_NAMES)};                         \
+      { __VA_ARGS__ }                                                          \
+    }                                                                          \
+  } while (0)
+
+/**
+ * Join of the entities whose value of the first component was added or
+ * changed after tick `SINCE` with the other components, see
+ * FOR_JOIN_COMPONENTS.
+ *
+ * Only the entities the first component changed are visited, the values that
+ * didn't change are never touched. Values count as changed when they are
+ * added, set through DEFER_SET_VALUE or marked with MARK_CHANGED.
+ * @param SINCE tick to look for changes after, e.g. system_last_run_tick().
+ *
+ * Usage:
+ * FOR_JOIN_CHANGED_COMPONENTS((position, collider), system_last_run_tick(), i, {
+ *    grid_move(i.id, i.position, i.collider);
+ * });
+ */
+#define FOR_JOIN_CHANGED_COMPONENTS(COMP_NAMES, SINCE, ITER_VAR, ...)          \
+  FOR_JOIN__SINCE(COMP_NAMES, SINCE, false, ITER_VAR, __VA_ARGS__)
+
+/**
+ * Like FOR_JOIN_CHANGED_COMPONENTS, but only visits the entities that got their
+ * value of the first component after tick `SINCE`.
+ */
+#define FOR_JOIN_ADDED_COMPONENTS(COMP_NAMES, SINCE, ITER_VAR, ...)            \
+  FOR_JOIN__SINCE(COMP_NAMES, SINCE, true, ITER_VAR, __VA_ARGS__)
+
+/**
+ * Mark an entity's value of a component changed after writing to it through a
+ * join's value pointer.
+ *
+ * Usage:
+ * FOR_JOIN_COMPONENT_2(position, velocity, d, {
+ *    d.position->x += d.velocity->dx;
+ *    MARK_CHANGED(position, d.id);
+ * });
+ */
+#define MARK_CHANGED(COMP_NAME, ENT_ID) change_mark(COMP_NAME.id, (ENT_ID))
 
 /**
  * Union of all entities that have the given components.
  *
- * Used to loop over all entites and components.
+ * Used to loop over all entites and components, driven by whichever component
+ * has fewer elements, see FOR_JOIN_COMPONENTS.
  * @param COMP_NAME_0, COMP_NAME_1 components to iterate over.
  * @param ITER_VAR variable to receive each value of the iteration
  *        will be given the type of `struct {uint32_t id; COMP_TYPE_0
@@ -91,35 +815,19 @@
  * type of the component `COMP_NAME_x`.
  *
  * Usage:
- * FOR_JOIN_COMPONENT_1(my_component, my_other_component, i, {
+ * FOR_JOIN_COMPONENT_2(my_component, my_other_component, i, {
  *    printf("entity id: %u, component_val: %d, my_other_component_val: %d\n",
  * i.id, i.my_component->whatever, i.my_other_component->something);
  * });
  */
 #define FOR_JOIN_COMPONENT_2(COMP_NAME_0, COMP_NAME_1, ITER_VAR, ...)          \
-  do {                                                                         \
-    HASH_TABLE_ITER(                                                           \
-        component_##COMP_NAME_0##_storage, k_0, v_0, COMP_NAME_0.storage, {    \
-          STRUCT_MEMBER_TYPE(                                                  \
-              struct hash_table_component_##COMP_NAME_1##_storage_elem,        \
-              val) *v_1 =                                                      \
-              hash_table_component_##COMP_NAME_1##_storage_lookup(             \
-                  COMP_NAME_1.storage, k_0);                                   \
-          if (v_1 != NULL) {                                                   \
-            struct {                                                           \
-              uint32_t id;                                                     \
-              typeof(v_0) COMP_NAME_0;                                         \
-              typeof(v_1) COMP_NAME_1;                                         \
-            } ITER_VAR = {k_0, v_0, v_1};                                      \
-            { __VA_ARGS__ }                                                    \
-          }                                                                    \
-        });                                                                    \
-  } while (0)
+  FOR_JOIN_COMPONENTS((COMP_NAME_0, COMP_NAME_1), ITER_VAR, __VA_ARGS__)
 
 /**
  * Union of all entities that have the given components.
  *
- * Used to loop over all entites and components.
+ * Used to loop over all entites and components, driven by whichever component
+ * has fewest elements, see FOR_JOIN_COMPONENTS.
  * @param COMP_NAME_0, COMP_NAME_1, COMP_NAME_2 components to iterate over.
  * @param ITER_VAR variable to receive each value of the iteration will be given
  * the type of `struct {uint32_t id; COMP_TYPE_0 *COMP_NAME_0, COMP_TYPE_1,
@@ -127,36 +835,111 @@
  * type of the component `COMP_NAME_x`.
  *
  * Usage:
- * FOR_JOIN_COMPONENT_1(my_component, my_other_component, another_component, i,
+ * FOR_JOIN_COMPONENT_3(my_component, my_other_component, another_component, i,
  * { printf("entity id: %u, component_val: %d, my_other_component_val: %d,
  * another_component_val: %d\n", i.id, i.my_component->whatever,
  * i.my_other_component->something, i.another_component->it);
  * });
  */
-#define FOR_JOIN_COMPONENT_3(COMP_NAME_0, COMP_NAME_1, ITER_VAR, ...)          \
+#define FOR_JOIN_COMPONENT_3(COMP_NAME_0, COMP_NAME_1, COMP_NAME_2, ITER_VAR,  \
+                             ...)                                              \
+  FOR_JOIN_COMPONENTS((COMP_NAME_0, COMP_NAME_1, COMP_NAME_2), ITER_VAR,       \
+                      __VA_ARGS__)
+
+/**
+ * Walk the archetypes that have all of the given archetype stored components.
+ *
+ * Every matching archetype's columns are walked directly, without any per
+ * entity lookups.
+ * @param COMP_NAME component to iterate over, must use `archetype` storage.
+ * @param ITER_VAR variable to receive each value of the iteration, see
+ * FOR_JOIN_COMPONENT_1.
+ */
+#define FOR_ARCHETYPE_JOIN_COMPONENT_1(COMP_NAME, ITER_VAR, ...)               \
+  do {                                                                         \
+    struct component_signature archetype_join_signature = {0};                 \
+    component_signature_set(&archetype_join_signature, COMP_NAME.id);          \
+    ARCHETYPE_ITER(&archetype_join_signature, arch, {                          \
+      typeof(component_##COMP_NAME##__lookup(COMP_NAME.storage, 0)) col =      \
+          archetype_column(arch, COMP_NAME.id);                                \
+      for (uint32_t row = 0; row < arch->num_rows; row++) {                    \
+        struct {                                                               \
+          uint32_t id;                                                         \
+          typeof(col) COMP_NAME;                                               \
+        } ITER_VAR = {arch->entities[row], &col[row]};                         \
+        { __VA_ARGS__ }                                                        \
+      }                                                                        \
+    });                                                                        \
+  } while (0)
+
+/**
+ * Walk the archetypes that have all of the given archetype stored components.
+ *
+ * @param COMP_NAME_0, COMP_NAME_1 components to iterate over, must use
+ * `archetype` storage.
+ * @param ITER_VAR variable to receive each value of the iteration, see
+ * FOR_JOIN_COMPONENT_2.
+ *
+ * Usage:
+ * FOR_ARCHETYPE_JOIN_COMPONENT_2(position, velocity, d, {
+ *    d.position->x += d.velocity->dx;
+ * });
+ */
+#define FOR_ARCHETYPE_JOIN_COMPONENT_2(COMP_NAME_0, COMP_NAME_1, ITER_VAR,     \
+                                       ...)                                    \
+  do {                                                                         \
+    struct component_signature archetype_join_signature = {0};                 \
+    component_signature_set(&archetype_join_signature, COMP_NAME_0.id);        \
+    component_signature_set(&archetype_join_signature, COMP_NAME_1.id);        \
+    ARCHETYPE_ITER(&archetype_join_signature, arch, {                          \
+      typeof(component_##COMP_NAME_0##__lookup(COMP_NAME_0.storage, 0))        \
+          col_0 = archetype_column(arch, COMP_NAME_0.id);                      \
+      typeof(component_##COMP_NAME_1##__lookup(COMP_NAME_1.storage, 0))        \
+          col_1 = archetype_column(arch, COMP_NAME_1.id);                      \
+      for (uint32_t row = 0; row < arch->num_rows; row++) {                    \
+        struct {                                                               \
+          uint32_t id;                                                         \
+          typeof(col_0) COMP_NAME_0;                                           \
+          typeof(col_1) COMP_NAME_1;                                           \
+        } ITER_VAR = {arch->entities[row], &col_0[row], &col_1[row]};          \
+        { __VA_ARGS__ }                                                        \
+      }                                                                        \
+    });                                                                        \
+  } while (0)
+
+/**
+ * Walk the archetypes that have all of the given archetype stored components.
+ *
+ * @param COMP_NAME_0, COMP_NAME_1, COMP_NAME_2 components to iterate over,
+ * must use `archetype` storage.
+ * @param ITER_VAR variable to receive each value of the iteration, see
+ * FOR_JOIN_COMPONENT_3.
+ */
+#define FOR_ARCHETYPE_JOIN_COMPONENT_3(COMP_NAME_0, COMP_NAME_1, COMP_NAME_2,  \
+                                       ITER_VAR, ...)                          \
   do {                                                                         \
-    HASH_TABLE_ITER(                                                           \
-        component_##COMP_NAME_0##_storage, k_0, v_0, COMP_NAME_0.storage, {    \
-          STRUCT_MEMBER_TYPE(                                                  \
-              struct hash_table_component_##COMP_NAME_1##_storage_elem,        \
-              val) *v_1 =                                                      \
-              hash_table_component_##COMP_NAME_1##_storage_lookup(             \
-                  COMP_NAME_1.storage, k_0);                                   \
-          STRUCT_MEMBER_TYPE(                                                  \
-              struct hash_table_component_##COMP_NAME_2##_storage_elem,        \
-              val) *v_2 =                                                      \
-              hash_table_component_##COMP_NAME_2##_storage_lookup(             \
-                  COMP_NAME_1.storage, k_0);                                   \
-          if (v_1 != NULL && v_2 != NULL) {                                    \
-            struct {                                                           \
-              uint32_t id;                                                     \
-              typeof(v_0) COMP_NAME_0;                                         \
-              typeof(v_1) COMP_NAME_1;                                         \
-              typeof(v_2) COMP_NAME_2;                                         \
-            } ITER_VAR = {k_0, v_0, v_1, v_2};                                 \
-            { __VA_ARGS__ }                                                    \
-          }                                                                    \
-        });                                                                    \
+    struct component_signature archetype_join_signature = {0};                 \
+    component_signature_set(&archetype_join_signature, COMP_NAME_0.id);        \
+    component_signature_set(&archetype_join_signature, COMP_NAME_1.id);        \
+    component_signature_set(&archetype_join_signature, COMP_NAME_2.id);        \
+    ARCHETYPE_ITER(&archetype_join_signature, arch, {                          \
+      typeof(component_##COMP_NAME_0##__lookup(COMP_NAME_0.storage, 0))        \
+          col_0 = archetype_column(arch, COMP_NAME_0.id);                      \
+      typeof(component_##COMP_NAME_1##__lookup(COMP_NAME_1.storage, 0))        \
+          col_1 = archetype_column(arch, COMP_NAME_1.id);                      \
+      typeof(component_##COMP_NAME_2##__lookup(COMP_NAME_2.storage, 0))        \
+          col_2 = archetype_column(arch, COMP_NAME_2.id);                      \
+      for (uint32_t row = 0; row < arch->num_rows; row++) {                    \
+        struct {                                                               \
+          uint32_t id;                                                         \
+          typeof(col_0) COMP_NAME_0;                                           \
+          typeof(col_1) COMP_NAME_1;                                           \
+          typeof(col_2) COMP_NAME_2;                                           \
+        } ITER_VAR = {arch->entities[row], &col_0[row], &col_1[row],           \
+                      &col_2[row]};                                            \
+        { __VA_ARGS__ }                                                        \
+      }                                                                        \
+    });                                                                        \
   } while (0)
 
 #endif // __COMPONENT_H_
@@ -0,0 +1,766 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "change.h"
+#include "component.h"
+#include "diff.h"
+#include "entity.h"
+#include "hash_table.h"
+#include "sparse_set.h"
+#include "vec.h"
+
+// A frame is a sequence of ops ended by DIFF_OP_END. Integers are LEB128
+// varints, entity ids within a values op are zigzag encoded deltas from the
+// previous one.
+enum diff_op {
+  DIFF_OP_END = 0,
+  // varint entity
+  DIFF_OP_DESPAWN,
+  DIFF_OP_SPAWN,
+  // varint component id, varint value size, varint name length, name
+  DIFF_OP_DEFINE,
+  // varint component id, then value ops up to DIFF_VALUE_END
+  DIFF_OP_VALUES,
+};
+
+// value ops are followed by the entity delta, adds and sets by the XOR of the
+// value with the previous one (zero for adds) as runs: varint number of zero
+// bytes, varint number of literal bytes, the literal bytes, until the whole
+// value is covered
+enum diff_value_op {
+  DIFF_VALUE_END = 0,
+  DIFF_VALUE_ADD,
+  DIFF_VALUE_SET,
+  DIFF_VALUE_REMOVE,
+};
+
+static const uint32_t diff_baseline_initial_cap = 64;
+// largest value a DIFF_OP_DEFINE may declare, bigger ones are taken as a
+// corrupt frame rather than allocated
+static const uint32_t diff_max_elem_size = 1u << 20;
+
+DEFINE_SPARSE_SET(uint32_t, diff_slots);
+MAKE_SPARSE_SET(uint32_t, diff_slots);
+DEFINE_HASH(uint32_t, diff_ids);
+MAKE_HASH(uint32_t, diff_ids);
+
+struct diff_removal {
+  uint32_t component_id;
+  uint32_t ent_id;
+};
+
+DEFINE_VECTOR(struct diff_removal, diff_removals);
+MAKE_VECTOR(struct diff_removal, diff_removals);
+DEFINE_VECTOR(uint32_t, diff_u32);
+MAKE_VECTOR(uint32_t, diff_u32);
+
+// the values of a component as the receiver has them
+struct diff_baseline {
+  // slot in `bytes` of every entity
+  struct sparse_set_diff_slots *slots;
+  uint8_t *bytes;
+  uint32_t elem_size;
+  uint32_t num_slots;
+  uint32_t cap;
+  struct vector_diff_u32 free_slots;
+};
+
+struct diff_sender {
+  // changes after this tick haven't been sent yet
+  uint32_t last_tick;
+  // by component id, created when the component is first sent
+  struct diff_baseline *baselines[COMPONENT_MAX];
+  // components the receiver got a DIFF_OP_DEFINE of
+  struct component_signature defined;
+  // entities the receiver has
+  struct sparse_set_diff_slots *entities;
+  // removals since the last frame, values are deleted from any worker
+  struct vector_diff_removals removals;
+  pthread_mutex_t removals_lock;
+  // the value ops of the component being encoded
+  struct diff_buffer records;
+};
+
+struct diff_remote_component {
+  bool defined;
+  uint32_t elem_size;
+  // NULL if this program doesn't have it
+  const struct component_info *info;
+};
+
+struct diff_receiver {
+  // sender entity id -> entity id here
+  struct hash_table_diff_ids *ids;
+  struct diff_remote_component components[COMPONENT_MAX];
+};
+
+void diff_buffer_free(struct diff_buffer *buf) {
+  free(buf->data);
+  *buf = (struct diff_buffer){0};
+}
+
+static void diff__reserve(struct diff_buffer *buf, size_t n) {
+  if (buf->len + n <= buf->cap) {
+    return;
+  }
+
+  size_t new_cap = buf->cap ? buf->cap : 256;
+  while (new_cap < buf->len + n) {
+    new_cap *= 2;
+  }
+
+  buf->data = realloc(buf->data, new_cap);
+  buf->cap = new_cap;
+}
+
+static void diff__put_byte(struct diff_buffer *buf, uint8_t b) {
+  diff__reserve(buf, 1);
+  buf->data[buf->len++] = b;
+}
+
+static void diff__put_varint(struct diff_buffer *buf, uint64_t v) {
+  diff__reserve(buf, 10);
+
+  while (v >= 0x80) {
+    buf->data[buf->len++] = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+
+  buf->data[buf->len++] = (uint8_t)v;
+}
+
+static void diff__put_entity(struct diff_buffer *buf, uint32_t ent_id,
+                             uint32_t *prev) {
+  int64_t delta = (int64_t)ent_id - (int64_t)*prev;
+  diff__put_varint(buf, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+  *prev = ent_id;
+}
+
+/**
+ * Put the XOR of `val` and `prev` (zero if NULL) as runs of zero and literal
+ * bytes, returns false without putting anything if they are the same.
+ */
+static bool diff__put_xor(struct diff_buffer *buf, const uint8_t *val,
+                          const uint8_t *prev, uint32_t size) {
+#define DIFF__XOR(I) (val[I] ^ (prev ? prev[I] : 0))
+  uint32_t pos = 0;
+
+  while (pos < size && !DIFF__XOR(pos)) {
+    pos++;
+  }
+
+  if (pos == size && prev != NULL) {
+    return false;
+  }
+
+  pos = 0;
+
+  while (pos < size) {
+    uint32_t zeros = 0;
+    while (pos + zeros < size && !DIFF__XOR(pos + zeros)) {
+      zeros++;
+    }
+    pos += zeros;
+
+    // a literal run only ends at two zero bytes in a row
+    uint32_t lit = 0;
+    while (pos + lit < size &&
+           (DIFF__XOR(pos + lit) ||
+            (pos + lit + 1 < size && DIFF__XOR(pos + lit + 1)))) {
+      lit++;
+    }
+
+    diff__put_varint(buf, zeros);
+    diff__put_varint(buf, lit);
+    diff__reserve(buf, lit);
+
+    for (uint32_t i = 0; i < lit; i++) {
+      buf->data[buf->len++] = DIFF__XOR(pos + i);
+    }
+
+    pos += lit;
+  }
+
+  return true;
+#undef DIFF__XOR
+}
+
+static struct diff_baseline *diff__baseline(struct diff_sender *sender,
+                                            uint32_t component_id) {
+  struct diff_baseline *baseline = sender->baselines[component_id];
+
+  if (baseline == NULL) {
+    baseline = calloc(1, sizeof(struct diff_baseline));
+    baseline->slots = sparse_set_diff_slots_new();
+    baseline->elem_size = component_registry_info(component_id)->elem_size;
+    baseline->cap = diff_baseline_initial_cap;
+    baseline->bytes = malloc(baseline->cap * baseline->elem_size);
+    baseline->free_slots = vector_diff_u32_new(diff_baseline_initial_cap);
+    sender->baselines[component_id] = baseline;
+  }
+
+  return baseline;
+}
+
+static uint8_t *diff__baseline_add(struct diff_baseline *baseline,
+                                   uint32_t ent_id) {
+  uint32_t slot;
+
+  if (baseline->free_slots.length) {
+    slot = vector_diff_u32_pop(&baseline->free_slots);
+  } else {
+    if (baseline->num_slots >= baseline->cap) {
+      baseline->cap *= 2;
+      baseline->bytes =
+          realloc(baseline->bytes, baseline->cap * baseline->elem_size);
+    }
+
+    slot = baseline->num_slots++;
+  }
+
+  sparse_set_diff_slots_insert(baseline->slots, ent_id, slot);
+  return &baseline->bytes[slot * baseline->elem_size];
+}
+
+static bool diff__baseline_remove(struct diff_baseline *baseline,
+                                  uint32_t ent_id) {
+  uint32_t *slot = sparse_set_diff_slots_lookup(baseline->slots, ent_id);
+
+  if (slot == NULL) {
+    return false;
+  }
+
+  vector_diff_u32_push(&baseline->free_slots, *slot);
+  sparse_set_diff_slots_delete(baseline->slots, ent_id);
+  return true;
+}
+
+static void diff__on_removed(uint32_t component_id, uint32_t ent_id,
+                             void *ctx) {
+  struct diff_sender *sender = ctx;
+  pthread_mutex_lock(&sender->removals_lock);
+  vector_diff_removals_push(&sender->removals,
+                            (struct diff_removal){component_id, ent_id});
+  pthread_mutex_unlock(&sender->removals_lock);
+}
+
+struct diff_sender *diff_sender_new(void) {
+  struct diff_sender *sender = calloc(1, sizeof(struct diff_sender));
+  sender->entities = sparse_set_diff_slots_new();
+  sender->removals = vector_diff_removals_new(diff_baseline_initial_cap);
+  pthread_mutex_init(&sender->removals_lock, NULL);
+  change_watch_removed(&diff__on_removed, sender);
+  return sender;
+}
+
+void diff_sender_free(struct diff_sender *sender) {
+  change_unwatch_removed(&diff__on_removed, sender);
+
+  for (uint32_t id = 0; id < COMPONENT_MAX; id++) {
+    struct diff_baseline *baseline = sender->baselines[id];
+
+    if (baseline != NULL) {
+      sparse_set_diff_slots_free(baseline->slots);
+      free(baseline->slots);
+      free(baseline->bytes);
+      vector_diff_u32_free(&baseline->free_slots);
+      free(baseline);
+    }
+  }
+
+  sparse_set_diff_slots_free(sender->entities);
+  free(sender->entities);
+  vector_diff_removals_free(&sender->removals);
+  pthread_mutex_destroy(&sender->removals_lock);
+  diff_buffer_free(&sender->records);
+  free(sender);
+}
+
+static int diff__compare_removals(const void *a, const void *b) {
+  const struct diff_removal *ra = a;
+  const struct diff_removal *rb = b;
+
+  if (ra->component_id != rb->component_id) {
+    return ra->component_id < rb->component_id ? -1 : 1;
+  }
+
+  return (ra->ent_id > rb->ent_id) - (ra->ent_id < rb->ent_id);
+}
+
+static void diff__put_define(struct diff_sender *sender,
+                             struct diff_buffer *out, uint32_t component_id) {
+  if (component_signature_has(&sender->defined, component_id)) {
+    return;
+  }
+
+  const struct component_info *info = component_registry_info(component_id);
+  size_t name_len = strlen(info->def->name);
+
+  diff__put_byte(out, DIFF_OP_DEFINE);
+  diff__put_varint(out, component_id);
+  diff__put_varint(out, info->elem_size);
+  diff__put_varint(out, name_len);
+  diff__reserve(out, name_len);
+  memcpy(&out->data[out->len], info->def->name, name_len);
+  out->len += name_len;
+
+  component_signature_set(&sender->defined, component_id);
+}
+
+/**
+ * Put the value ops of a component into `sender->records`: removals first,
+ * then the values added or changed since `since`.
+ */
+static void diff__put_values(struct diff_sender *sender, uint32_t component_id,
+                             uint32_t since,
+                             const struct diff_removal *removals,
+                             uint32_t num_removals) {
+  const struct component_info *info = component_registry_info(component_id);
+  struct diff_buffer *records = &sender->records;
+  uint32_t prev_ent = 0;
+
+  for (uint32_t i = 0; i < num_removals; i++) {
+    uint32_t ent_id = removals[i].ent_id;
+
+    // values of destroyed entities go with their despawn, values added back
+    // since are sent as sets below
+    if (sender->baselines[component_id] == NULL ||
+        info->def->lookup_value(ent_id) != NULL ||
+        !diff__baseline_remove(sender->baselines[component_id], ent_id) ||
+        !entity_is_alive(ent_id)) {
+      continue;
+    }
+
+    diff__put_byte(records, DIFF_VALUE_REMOVE);
+    diff__put_entity(records, ent_id, &prev_ent);
+  }
+
+  struct change_iter iter;
+  uint32_t ent_id;
+  change_iter_init(&iter, component_id, since, false);
+
+  while (change_iter_next(&iter, &ent_id)) {
+    const uint8_t *val = info->def->lookup_value(ent_id);
+
+    if (val == NULL) {
+      continue;
+    }
+
+    struct diff_baseline *baseline = diff__baseline(sender, component_id);
+    uint32_t *slot = sparse_set_diff_slots_lookup(baseline->slots, ent_id);
+
+    if (slot == NULL) {
+      diff__put_byte(records, DIFF_VALUE_ADD);
+      diff__put_entity(records, ent_id, &prev_ent);
+      diff__put_xor(records, val, NULL, info->elem_size);
+      memcpy(diff__baseline_add(baseline, ent_id), val, info->elem_size);
+      continue;
+    }
+
+    uint8_t *prev = &baseline->bytes[*slot * info->elem_size];
+    size_t mark = records->len;
+    uint32_t mark_ent = prev_ent;
+
+    diff__put_byte(records, DIFF_VALUE_SET);
+    diff__put_entity(records, ent_id, &prev_ent);
+
+    // marked changed but the bytes are the same, take the op back
+    if (!diff__put_xor(records, val, prev, info->elem_size)) {
+      records->len = mark;
+      prev_ent = mark_ent;
+      continue;
+    }
+
+    memcpy(prev, val, info->elem_size);
+  }
+}
+
+void diff_encode(struct diff_sender *sender, struct diff_buffer *out) {
+  uint32_t since = sender->last_tick;
+
+  // changes made from here on get a later tick and go out with the next frame
+  sender->last_tick = change_tick();
+  change_tick_advance();
+
+  struct diff_removal *removals = sender->removals.data;
+  uint32_t num_removals = sender->removals.length;
+  qsort(removals, num_removals, sizeof(struct diff_removal),
+        &diff__compare_removals);
+
+  // the receiver destroying an entity removes its values too
+  for (uint32_t i = 0; i < num_removals; i++) {
+    uint32_t ent_id = removals[i].ent_id;
+
+    if (!entity_is_alive(ent_id) &&
+        sparse_set_diff_slots_delete(sender->entities, ent_id)) {
+      diff__put_byte(out, DIFF_OP_DESPAWN);
+      diff__put_varint(out, ent_id);
+    }
+  }
+
+  for (uint32_t id = 0; id < component_registry_num(); id++) {
+    struct change_iter iter;
+    uint32_t ent_id;
+    change_iter_init(&iter, id, since, true);
+
+    while (change_iter_next(&iter, &ent_id)) {
+      if (sparse_set_diff_slots_lookup(sender->entities, ent_id) == NULL) {
+        sparse_set_diff_slots_insert(sender->entities, ent_id, 0);
+        diff__put_byte(out, DIFF_OP_SPAWN);
+        diff__put_varint(out, ent_id);
+      }
+    }
+  }
+
+  uint32_t first = 0;
+
+  for (uint32_t id = 0; id < component_registry_num(); id++) {
+    uint32_t last = first;
+    while (last < num_removals && removals[last].component_id == id) {
+      last++;
+    }
+
+    sender->records.len = 0;
+    diff__put_values(sender, id, since, &removals[first], last - first);
+    first = last;
+
+    if (sender->records.len == 0) {
+      continue;
+    }
+
+    diff__put_define(sender, out, id);
+    diff__put_byte(out, DIFF_OP_VALUES);
+    diff__put_varint(out, id);
+    diff__reserve(out, sender->records.len);
+    memcpy(&out->data[out->len], sender->records.data, sender->records.len);
+    out->len += sender->records.len;
+    diff__put_byte(out, DIFF_VALUE_END);
+  }
+
+  sender->removals.length = 0;
+  diff__put_byte(out, DIFF_OP_END);
+}
+
+struct diff_receiver *diff_receiver_new(void) {
+  struct diff_receiver *receiver = calloc(1, sizeof(struct diff_receiver));
+  receiver->ids = hash_table_diff_ids_new();
+  return receiver;
+}
+
+void diff_receiver_free(struct diff_receiver *receiver) {
+  hash_table_diff_ids_free(receiver->ids);
+  free(receiver->ids);
+  free(receiver);
+}
+
+uint32_t diff_receiver_local_id(struct diff_receiver *receiver,
+                                uint32_t remote_id) {
+  uint32_t *local = hash_table_diff_ids_lookup(receiver->ids, remote_id);
+  return local ? *local : UINT32_MAX;
+}
+
+struct diff_reader {
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+};
+
+static bool diff__get_byte(struct diff_reader *r, uint8_t *b) {
+  if (r->pos >= r->len) {
+    return false;
+  }
+
+  *b = r->data[r->pos++];
+  return true;
+}
+
+static bool diff__get_varint(struct diff_reader *r, uint64_t *v) {
+  *v = 0;
+
+  for (uint32_t shift = 0; shift < 64; shift += 7) {
+    uint8_t b;
+
+    if (!diff__get_byte(r, &b)) {
+      return false;
+    }
+
+    *v |= (uint64_t)(b & 0x7f) << shift;
+
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static bool diff__get_u32(struct diff_reader *r, uint32_t *v) {
+  uint64_t v64;
+
+  if (!diff__get_varint(r, &v64) || v64 > UINT32_MAX) {
+    return false;
+  }
+
+  *v = (uint32_t)v64;
+  return true;
+}
+
+static bool diff__get_entity(struct diff_reader *r, uint32_t *prev) {
+  uint64_t zigzag;
+
+  if (!diff__get_varint(r, &zigzag)) {
+    return false;
+  }
+
+  int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+  int64_t ent_id = (int64_t)*prev + delta;
+
+  if (ent_id < 0 || ent_id > UINT32_MAX) {
+    return false;
+  }
+
+  *prev = (uint32_t)ent_id;
+  return true;
+}
+
+/**
+ * XOR the runs of an add or set into `val`.
+ */
+static bool diff__get_xor(struct diff_reader *r, uint8_t *val, uint32_t size) {
+  uint32_t pos = 0;
+
+  while (pos < size) {
+    uint32_t zeros, lit;
+
+    if (!diff__get_u32(r, &zeros) || !diff__get_u32(r, &lit) ||
+        (uint64_t)pos + zeros + lit > size || r->len - r->pos < lit) {
+      return false;
+    }
+
+    pos += zeros;
+
+    for (uint32_t i = 0; i < lit; i++) {
+      val[pos + i] ^= r->data[r->pos + i];
+    }
+
+    pos += lit;
+    r->pos += lit;
+  }
+
+  return true;
+}
+
+static bool diff__apply_values(struct diff_receiver *receiver,
+                               struct diff_reader *r) {
+  uint32_t remote_component;
+
+  if (!diff__get_u32(r, &remote_component) ||
+      remote_component >= COMPONENT_MAX ||
+      !receiver->components[remote_component].defined) {
+    return false;
+  }
+
+  struct diff_remote_component *component =
+      &receiver->components[remote_component];
+  const struct component_info *info = component->info;
+  // values of components this program doesn't have are decoded into here
+  uint8_t *scratch = calloc(1, component->elem_size ? component->elem_size : 1);
+  uint32_t remote_id = 0;
+  bool ok = false;
+
+  for (;;) {
+    uint8_t op;
+
+    if (!diff__get_byte(r, &op)) {
+      break;
+    }
+
+    if (op == DIFF_VALUE_END) {
+      ok = true;
+      break;
+    }
+
+    if (op > DIFF_VALUE_REMOVE || !diff__get_entity(r, &remote_id)) {
+      break;
+    }
+
+    uint32_t local = diff_receiver_local_id(receiver, remote_id);
+    uint8_t *val = scratch;
+
+    if (op == DIFF_VALUE_ADD) {
+      memset(scratch, 0, component->elem_size);
+
+      if (!diff__get_xor(r, scratch, component->elem_size)) {
+        break;
+      }
+
+      if (info != NULL && local != UINT32_MAX) {
+        info->add_values(&local, scratch, 1);
+      }
+    } else if (op == DIFF_VALUE_SET) {
+      if (info != NULL && local != UINT32_MAX) {
+        val = info->def->lookup_value(local);
+      }
+
+      if (!diff__get_xor(r, val ? val : scratch, component->elem_size)) {
+        break;
+      }
+
+      if (val != NULL && val != scratch) {
+        change_mark(info->def->id, local);
+      }
+    } else if (info != NULL && local != UINT32_MAX) {
+      info->def->delete_value(local);
+    }
+  }
+
+  free(scratch);
+  return ok;
+}
+
+bool diff_apply(struct diff_receiver *receiver, const uint8_t *data,
+                size_t len) {
+  struct diff_reader r = {data, len, 0};
+
+  for (;;) {
+    uint8_t op;
+    uint32_t remote_id;
+
+    if (!diff__get_byte(&r, &op)) {
+      return false;
+    }
+
+    switch (op) {
+    case DIFF_OP_END:
+      return r.pos == r.len;
+
+    case DIFF_OP_DESPAWN: {
+      if (!diff__get_u32(&r, &remote_id)) {
+        return false;
+      }
+
+      uint32_t local = diff_receiver_local_id(receiver, remote_id);
+
+      if (local != UINT32_MAX) {
+        destroy_entity(local);
+        hash_table_diff_ids_delete(receiver->ids, remote_id);
+      }
+      break;
+    }
+
+    case DIFF_OP_SPAWN:
+      if (!diff__get_u32(&r, &remote_id)) {
+        return false;
+      }
+
+      hash_table_diff_ids_insert(receiver->ids, remote_id, new_entity_id());
+      break;
+
+    case DIFF_OP_DEFINE: {
+      uint32_t remote_component, elem_size, name_len;
+
+      if (!diff__get_u32(&r, &remote_component) ||
+          remote_component >= COMPONENT_MAX ||
+          !diff__get_u32(&r, &elem_size) || elem_size > diff_max_elem_size ||
+          !diff__get_u32(&r, &name_len) || r.len - r.pos < name_len) {
+        return false;
+      }
+
+      char *name = strndup((const char *)&r.data[r.pos], name_len);
+      const struct component_info *info = component_registry_find(name);
+      r.pos += name_len;
+      free(name);
+
+      // the sender's values wouldn't fit
+      if (info != NULL && info->elem_size != elem_size) {
+        return false;
+      }
+
+      receiver->components[remote_component] =
+          (struct diff_remote_component){true, elem_size, info};
+      break;
+    }
+
+    case DIFF_OP_VALUES:
+      if (!diff__apply_values(receiver, &r)) {
+        return false;
+      }
+      break;
+
+    default:
+      return false;
+    }
+  }
+}
+
+bool diff_write_fd(int fd, const uint8_t *data, size_t len) {
+  if (len > UINT32_MAX) {
+    return false;
+  }
+
+  uint32_t len32 = (uint32_t)len;
+  const uint8_t *parts[2] = {(const uint8_t *)&len32, data};
+  size_t sizes[2] = {sizeof(len32), len};
+
+  for (int i = 0; i < 2; i++) {
+    size_t done = 0;
+
+    while (done < sizes[i]) {
+      ssize_t n = write(fd, parts[i] + done, sizes[i] - done);
+
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if (n <= 0) {
+        return false;
+      }
+
+      done += (size_t)n;
+    }
+  }
+
+  return true;
+}
+
+static bool diff__read_all(int fd, uint8_t *data, size_t len) {
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t n = read(fd, data + done, len - done);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n <= 0) {
+      return false;
+    }
+
+    done += (size_t)n;
+  }
+
+  return true;
+}
+
+bool diff_read_fd(int fd, struct diff_buffer *buf) {
+  uint32_t len;
+
+  if (!diff__read_all(fd, (uint8_t *)&len, sizeof(len))) {
+    return false;
+  }
+
+  buf->len = 0;
+  diff__reserve(buf, len);
+
+  if (!diff__read_all(fd, buf->data, len)) {
+    return false;
+  }
+
+  buf->len = len;
+  return true;
+}
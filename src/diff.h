@@ -0,0 +1,79 @@
+#ifndef __DIFF_H_
+#define __DIFF_H_
+
+// Delta encoded world diffs, for replicating a world to observers or
+// recording it for replay: a sender encodes what changed since its previous
+// frame, a receiver patches its own world with it
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Growable byte buffer encoded frames are appended to.
+ */
+struct diff_buffer {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+};
+
+void diff_buffer_free(struct diff_buffer *buf);
+
+/**
+ * Keeps a copy of every value it sent, so changed values go out as the XOR
+ * of their bytes with the previous ones.
+ */
+struct diff_sender;
+
+struct diff_sender *diff_sender_new(void);
+
+void diff_sender_free(struct diff_sender *sender);
+
+/**
+ * Append a frame with everything that changed since the previous frame (since
+ * the start of the world for the first one) to `out`: despawned and spawned
+ * entities, values added, changed and removed. Only changes the change lists
+ * know of are sent, writes through a pointer have to be marked with
+ * MARK_CHANGED. Entities without any component aren't sent.
+ *
+ * Must be called outside of systems, e.g. after run_systems.
+ */
+void diff_encode(struct diff_sender *sender, struct diff_buffer *out);
+
+/**
+ * Keeps the ids the entities of the sender have in the receiving world.
+ */
+struct diff_receiver;
+
+struct diff_receiver *diff_receiver_new(void);
+
+void diff_receiver_free(struct diff_receiver *receiver);
+
+/**
+ * Apply one frame to the world, components are matched to the sender's by
+ * name. Returns false if the frame is malformed or a component's values differ
+ * in size from the sender's, it may have been applied in part.
+ */
+bool diff_apply(struct diff_receiver *receiver, const uint8_t *data,
+                size_t len);
+
+/**
+ * Id in the receiving world of the sender's entity `remote_id`, UINT32_MAX if
+ * there is none.
+ */
+uint32_t diff_receiver_local_id(struct diff_receiver *receiver,
+                                uint32_t remote_id);
+
+/**
+ * Write a frame to `fd` prefixed with its length, retrying short writes.
+ */
+bool diff_write_fd(int fd, const uint8_t *data, size_t len);
+
+/**
+ * Read a frame written by diff_write_fd into `buf`, replacing its contents.
+ * Returns false at the end of the stream or on errors.
+ */
+bool diff_read_fd(int fd, struct diff_buffer *buf);
+
+#endif // __DIFF_H_
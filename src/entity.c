@@ -1,9 +1,263 @@
-#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
+#include "common_macros.h"
+#include "component.h"
 #include "entity.h"
+#include "system.h"
+#include "world.h"
+
+// per index state is kept in fixed pages that are allocated on first use and
+// never moved, so it can be read without locks while other threads allocate
+#define ENTITY_PAGE_BITS 12
+#define ENTITY_PAGE_SIZE (1u << ENTITY_PAGE_BITS)
+#define ENTITY_NUM_PAGES (ENTITY_MAX_ENTITIES / ENTITY_PAGE_SIZE)
+
+#define ENTITY_GENERATION_MASK (UINT32_MAX >> ENTITY_INDEX_BITS)
+// set in the generation of indices waiting in the free list
+#define ENTITY_FREE_BIT (ENTITY_GENERATION_MASK + 1)
+
+static const uint32_t entity_free_list_end = UINT32_MAX;
+
+struct entity_slot {
+  // generation of the entity using the index, or of the next one to use it
+  // with ENTITY_FREE_BIT set
+  uint32_t generation;
+  // next index in the free list when destroyed
+  uint32_t next_free;
+};
+
+struct entity_world {
+  struct entity_slot *pages[ENTITY_NUM_PAGES];
+  // indices handed out so far, the ones below it have a slot
+  uint32_t num_indices;
+  // low half is the first free index, high half a counter bumped on every pop
+  // so a compare and swap can't succeed on a head that was popped and pushed
+  // back in the meantime
+  uint64_t free_head;
+};
+
+static uint64_t entity__free_head(uint32_t idx, uint32_t tag) {
+  return ((uint64_t)tag << 32) | idx;
+}
+
+void entity__world_init(struct world *world) {
+  world->entities = calloc(1, sizeof(struct entity_world));
+  world->entities->free_head = entity__free_head(entity_free_list_end, 0);
+}
+
+void entity__world_free(struct world *world) {
+  for (uint32_t page = 0; page < ENTITY_NUM_PAGES; page++) {
+    free(world->entities->pages[page]);
+  }
+
+  free(world->entities);
+}
+
+static struct entity_slot *entity__slot(struct entity_world *entities,
+                                        uint32_t idx) {
+  struct entity_slot *page = __atomic_load_n(
+      &entities->pages[idx >> ENTITY_PAGE_BITS], __ATOMIC_ACQUIRE);
+
+  if (page == NULL) {
+    return NULL;
+  }
+
+  return &page[idx & (ENTITY_PAGE_SIZE - 1)];
+}
+
+/**
+ * Slot of a freshly handed out index, allocating its page. Whichever thread
+ * loses the race to publish the page frees its own.
+ */
+static struct entity_slot *entity__new_slot(struct entity_world *entities,
+                                            uint32_t idx) {
+  struct entity_slot **page = &entities->pages[idx >> ENTITY_PAGE_BITS];
+
+  if (__atomic_load_n(page, __ATOMIC_ACQUIRE) == NULL) {
+    struct entity_slot *new_page =
+        calloc(ENTITY_PAGE_SIZE, sizeof(struct entity_slot));
+    struct entity_slot *expected = NULL;
+
+    if (!__atomic_compare_exchange_n(page, &expected, new_page, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      free(new_page);
+    }
+  }
+
+  return entity__slot(entities, idx);
+}
+
+static bool entity__pop_free(struct entity_world *entities, uint32_t *idx) {
+  uint64_t head = __atomic_load_n(&entities->free_head, __ATOMIC_ACQUIRE);
+
+  for (;;) {
+    uint32_t first = (uint32_t)head;
+
+    if (first == entity_free_list_end) {
+      return false;
+    }
+
+    uint32_t next =
+        __atomic_load_n(&entity__slot(entities, first)->next_free,
+                        __ATOMIC_RELAXED);
+    uint64_t new_head = entity__free_head(next, (head >> 32) + 1);
+
+    if (__atomic_compare_exchange_n(&entities->free_head, &head, new_head,
+                                    true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      *idx = first;
+      return true;
+    }
+  }
+}
+
+static void entity__push_free(struct entity_world *entities, uint32_t idx) {
+  struct entity_slot *slot = entity__slot(entities, idx);
+  uint64_t head = __atomic_load_n(&entities->free_head, __ATOMIC_ACQUIRE);
+
+  do {
+    __atomic_store_n(&slot->next_free, (uint32_t)head, __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(
+      &entities->free_head, &head, entity__free_head(idx, head >> 32), true,
+      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
 
 uint32_t new_entity_id(void) {
-  static uint32_t id_counter = 0;
+  struct entity_world *entities = world_current()->entities;
+  uint32_t idx;
+
+  if (entity__pop_free(entities, &idx)) {
+    struct entity_slot *slot = entity__slot(entities, idx);
+    uint32_t generation =
+        __atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE) & ~ENTITY_FREE_BIT;
+    __atomic_store_n(&slot->generation, generation, __ATOMIC_RELEASE);
+    return (generation << ENTITY_INDEX_BITS) | idx;
+  }
+
+  idx = __atomic_fetch_add(&entities->num_indices, 1, __ATOMIC_ACQ_REL);
+
+  if (idx >= ENTITY_MAX_ENTITIES) {
+    RUNTIME_ERROR("Too many entities alive, the maximum is %u",
+                  ENTITY_MAX_ENTITIES);
+  }
+
+  entity__new_slot(entities, idx);
+  return idx;
+}
+
+bool destroy_entity(uint32_t entity) {
+  // it deletes values of components the system may not have declared
+  if (system_running_declared()) {
+    RUNTIME_ERROR("Systems with declared accesses must destroy entities with "
+                  "DEFER_DESTROY_ENTITY");
+  }
+
+  struct entity_world *entities = world_current()->entities;
+  uint32_t idx = entity_index(entity);
+  uint32_t generation = entity_generation(entity);
+
+  if (idx >= __atomic_load_n(&entities->num_indices, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  struct entity_slot *slot = entity__slot(entities, idx);
+
+  if (slot == NULL ||
+      __atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE) != generation) {
+    return false;
+  }
+
+  component_delete_entity(entity);
+
+  // bumping the generation is what kills the entity, only one of several
+  // concurrent destroys can win it
+  if (!__atomic_compare_exchange_n(
+          &slot->generation, &generation,
+          ((generation + 1) & ENTITY_GENERATION_MASK) | ENTITY_FREE_BIT, false,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  entity__push_free(entities, idx);
+  return true;
+}
+
+bool entity_is_alive(uint32_t entity) {
+  struct entity_world *entities = world_current()->entities;
+  uint32_t idx = entity_index(entity);
+
+  if (idx >= __atomic_load_n(&entities->num_indices, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  struct entity_slot *slot = entity__slot(entities, idx);
+
+  return slot != NULL && __atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE) ==
+                             entity_generation(entity);
+}
+
+uint32_t entity_id_at_index(uint32_t idx) {
+  uint32_t generation = __atomic_load_n(
+      &entity__slot(world_current()->entities, idx)->generation,
+      __ATOMIC_ACQUIRE);
+  return ((generation & ENTITY_GENERATION_MASK) << ENTITY_INDEX_BITS) | idx;
+}
+
+void entity_snapshot_write(struct snapshot_writer *w) {
+  struct entity_world *entities = world_current()->entities;
+  uint32_t num_indices =
+      __atomic_load_n(&entities->num_indices, __ATOMIC_ACQUIRE);
+  uint32_t header[2] = {num_indices, (uint32_t)entities->free_head};
+  snapshot_write(w, header, sizeof(header));
+
+  for (uint32_t page = 0; page * ENTITY_PAGE_SIZE < num_indices; page++) {
+    snapshot_write(w, entities->pages[page],
+                   ENTITY_PAGE_SIZE * sizeof(struct entity_slot));
+  }
+}
+
+void entity_snapshot_read(struct snapshot_reader *r) {
+  struct entity_world *entities = world_current()->entities;
+  const uint32_t *header = snapshot_read(r, 2 * sizeof(uint32_t));
+
+  if (header == NULL || header[0] > ENTITY_MAX_ENTITIES) {
+    r->failed = true;
+    return;
+  }
+
+  uint32_t num_indices = header[0];
+
+  for (uint32_t page = 0; page < ENTITY_NUM_PAGES; page++) {
+    free(entities->pages[page]);
+    entities->pages[page] = NULL;
+  }
+
+  for (uint32_t page = 0; page * ENTITY_PAGE_SIZE < num_indices; page++) {
+    entities->pages[page] =
+        snapshot_read_array(r, &allocator_heap, sizeof(struct entity_slot),
+                            ENTITY_PAGE_SIZE, ENTITY_PAGE_SIZE);
+
+    if (entities->pages[page] == NULL) {
+      // no entities then, the pages read so far are reused by new ones
+      entities->num_indices = 0;
+      entities->free_head = entity__free_head(entity_free_list_end, 0);
+      return;
+    }
+  }
+
+  entities->num_indices = num_indices;
+  entities->free_head = entity__free_head(header[1], 0);
+}
+
+void entity_snapshot_skip(struct snapshot_reader *r) {
+  const uint32_t *header = snapshot_read(r, 2 * sizeof(uint32_t));
+
+  if (header == NULL || header[0] > ENTITY_MAX_ENTITIES) {
+    r->failed = true;
+    return;
+  }
 
-  return id_counter++;
+  for (uint64_t idx = 0; idx < header[0]; idx += ENTITY_PAGE_SIZE) {
+    snapshot_read(r, ENTITY_PAGE_SIZE * sizeof(struct entity_slot));
+  }
 }
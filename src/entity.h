@@ -1,11 +1,66 @@
 #ifndef __ENTITY_H_
 #define __ENTITY_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "snapshot.h"
+
+struct world;
+
+// Entity ids are generational handles: the low bits are an index that is
+// recycled once the entity is destroyed, the high bits count how many times
+// the index has been recycled so stale handles can be told apart
+
+#define ENTITY_INDEX_BITS 24
+#define ENTITY_INDEX_MASK ((1u << ENTITY_INDEX_BITS) - 1)
+#define ENTITY_MAX_ENTITIES (1u << ENTITY_INDEX_BITS)
+
+static inline uint32_t entity_index(uint32_t entity) {
+  return entity & ENTITY_INDEX_MASK;
+}
+
+static inline uint32_t entity_generation(uint32_t entity) {
+  return entity >> ENTITY_INDEX_BITS;
+}
+
 /**
- * Get a new entity id.
+ * Get a new entity id, reusing the index of a destroyed entity if there is
+ * one. Safe to call from several threads at once.
  */
 uint32_t new_entity_id(void);
 
+/**
+ * Delete every component of `entity` and release its index for reuse, its id
+ * (and any copy of it) stops being alive. Returns whether it was alive.
+ *
+ * Systems registered with REGISTER_SYSTEM_WITH_ACCESS may run next to systems
+ * using any of the entity's components, they have to use DEFER_DESTROY_ENTITY
+ * instead: calling this from one is a runtime error.
+ */
+bool destroy_entity(uint32_t entity);
+
+/**
+ * Whether `entity` was created and not destroyed since. The generation wraps
+ * around after 256 reuses of an index, so a very old id may alias a new one.
+ */
+bool entity_is_alive(uint32_t entity);
+
+/**
+ * Id of the entity using index `idx`, for storages that only keep indices.
+ * Only meaningful while that entity is alive.
+ */
+uint32_t entity_id_at_index(uint32_t idx);
+
+// the state of every index handed out so far, for snapshots. Reading replaces
+// it, so it's only for worlds with no entities yet. Skipping reads past it
+// without changing anything.
+void entity_snapshot_write(struct snapshot_writer *w);
+void entity_snapshot_read(struct snapshot_reader *r);
+void entity_snapshot_skip(struct snapshot_reader *r);
+
+// the entities of a world, created and freed with it (see world.h)
+void entity__world_init(struct world *world);
+void entity__world_free(struct world *world);
+
 #endif // __ENTITY_H_
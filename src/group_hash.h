@@ -0,0 +1,422 @@
+#ifndef __GROUP_HASH_H_
+#define __GROUP_HASH_H_
+
+// A hash table implementation using group probing: a separate array of one
+// byte control tags is matched a whole group of slots at a time, the slots are
+// only touched on a tag hit
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "common_macros.h"
+#include "snapshot.h"
+#include "storage_stats.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define GROUP_HASH_GROUP_WIDTH 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define GROUP_HASH_GROUP_WIDTH 16
+#else
+#define GROUP_HASH_GROUP_WIDTH 16
+#endif
+
+static const uint32_t group_hash_initial_cap = 32;
+static const uint8_t group_hash_load_factor_to_grow = 87;
+
+// control tags, full slots hold the top 7 bits of their hash
+static const uint8_t group_hash_ctrl_empty = 0x80;
+static const uint8_t group_hash_ctrl_deleted = 0xfe;
+
+/**
+ * Bitmask of the slots of the group starting at `ctrl` whose tag is `tag`.
+ */
+static inline uint32_t group_hash_match(const uint8_t *ctrl, uint8_t tag) {
+#if defined(__AVX2__)
+  __m256i group = _mm256_loadu_si256((const __m256i *)ctrl);
+  return _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(group, _mm256_set1_epi8((char)tag)));
+#elif defined(__SSE2__)
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < GROUP_HASH_GROUP_WIDTH; i++) {
+    mask |= (uint32_t)(ctrl[i] == tag) << i;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * Bitmask of the slots of the group starting at `ctrl` that are empty or
+ * deleted, the only tags with their top bit set.
+ */
+static inline uint32_t group_hash_match_free(const uint8_t *ctrl) {
+#if defined(__AVX2__)
+  return _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)ctrl));
+#elif defined(__SSE2__)
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < GROUP_HASH_GROUP_WIDTH; i++) {
+    mask |= (uint32_t)(ctrl[i] >> 7) << i;
+  }
+  return mask;
+#endif
+}
+
+static inline uint32_t group_hash_hash_fun(uint32_t k) {
+  const uint32_t hash_constant = 0x45d9f3b;
+
+  k = ((k >> 16) ^ k) * hash_constant;
+  k = ((k >> 16) ^ k) * hash_constant;
+  k = ((k >> 16) ^ k) * hash_constant;
+
+  return k;
+}
+
+static inline uint8_t group_hash_tag(uint32_t hash) { return hash >> 25; }
+
+#define DEFINE_GROUP_HASH(VALTYPE, NAME)                                       \
+  struct group_hash_##NAME##_elem {                                            \
+    uint32_t key;                                                              \
+    VALTYPE val;                                                               \
+  };                                                                           \
+                                                                               \
+  struct group_hash_##NAME {                                                   \
+    /* cap tags followed by a copy of the first group, so a group can be       \
+     * loaded at any slot without wrapping */                                  \
+    uint8_t *ctrl;                                                             \
+    struct group_hash_##NAME##_elem *elems;                                    \
+    uint32_t num_elems;                                                        \
+    uint32_t num_deleted;                                                      \
+    uint32_t cap;                                                              \
+    uint32_t mask;                                                             \
+    uint32_t resize_thresh;                                                    \
+    uint64_t num_grows;                                                        \
+    const struct allocator *alloc;                                             \
+  };                                                                           \
+  struct group_hash_##NAME *group_hash_##NAME##_new();                         \
+  struct group_hash_##NAME *group_hash_##NAME##_new_with_allocator(            \
+      const struct allocator *alloc);                                          \
+  void group_hash_##NAME##_free(struct group_hash_##NAME *table);              \
+  void group_hash_##NAME##_insert(struct group_hash_##NAME *table, uint32_t k, \
+                                  VALTYPE v);                                  \
+  bool group_hash_##NAME##_delete(struct group_hash_##NAME *table, uint32_t k); \
+  void group_hash_##NAME##_reserve(struct group_hash_##NAME *table,            \
+                                   uint32_t n);                                \
+  void group_hash_##NAME##_insert_many(struct group_hash_##NAME *table,        \
+                                       const uint32_t *keys,                   \
+                                       const VALTYPE *vals, uint32_t n);       \
+  void group_hash_##NAME##_snapshot_write(struct group_hash_##NAME *table,     \
+                                          struct snapshot_writer *w);          \
+  void group_hash_##NAME##_snapshot_read(struct group_hash_##NAME *table,      \
+                                         struct snapshot_reader *r);           \
+  void group_hash_##NAME##_stats(struct group_hash_##NAME *table,              \
+                                 struct storage_stats *stats);                 \
+                                                                               \
+  static inline int64_t group_hash_##NAME##__index(                            \
+      struct group_hash_##NAME *table, uint32_t k) {                           \
+    uint32_t hash = group_hash_hash_fun(k);                                    \
+    uint8_t tag = group_hash_tag(hash);                                        \
+    uint32_t pos = hash & table->mask;                                         \
+    uint32_t stride = 0;                                                       \
+                                                                               \
+    for (;;) {                                                                 \
+      const uint8_t *group = &table->ctrl[pos];                                \
+      storage_probes++;                                                        \
+                                                                               \
+      for (uint32_t m = group_hash_match(group, tag); m; m &= m - 1) {         \
+        uint32_t idx = (pos + __builtin_ctz(m)) & table->mask;                 \
+                                                                               \
+        if (table->elems[idx].key == k) {                                      \
+          return idx;                                                          \
+        }                                                                      \
+      }                                                                        \
+                                                                               \
+      /* an empty slot ends every probe sequence that reached it */            \
+      if (group_hash_match(group, group_hash_ctrl_empty)) {                    \
+        return -1;                                                             \
+      }                                                                        \
+                                                                               \
+      stride += GROUP_HASH_GROUP_WIDTH;                                        \
+      pos = (pos + stride) & table->mask;                                      \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline VALTYPE *group_hash_##NAME##_lookup(                           \
+      struct group_hash_##NAME *table, uint32_t k) {                           \
+    int64_t idx = group_hash_##NAME##__index(table, k);                        \
+                                                                               \
+    if (idx < 0) {                                                             \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    return &table->elems[idx].val;                                             \
+  }                                                                            \
+                                                                               \
+  /* slots are the buckets, empty and deleted ones hold no value */            \
+  static inline uint32_t group_hash_##NAME##_num_slots(                        \
+      struct group_hash_##NAME *table) {                                       \
+    return table->cap;                                                         \
+  }                                                                            \
+                                                                               \
+  static inline VALTYPE *group_hash_##NAME##_slot(                             \
+      struct group_hash_##NAME *table, uint32_t idx, uint32_t *key) {          \
+    if (table->ctrl[idx] & 0x80) {                                             \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    *key = table->elems[idx].key;                                              \
+    return &table->elems[idx].val;                                             \
+  }
+
+#define MAKE_GROUP_HASH(VALTYPE, NAME)                                         \
+  static void group_hash_##NAME##__construct(struct group_hash_##NAME *table,  \
+                                             uint32_t initial_capacity) {      \
+    table->ctrl = allocator_alloc(table->alloc,                                \
+                                  initial_capacity + GROUP_HASH_GROUP_WIDTH);  \
+    memset(table->ctrl, group_hash_ctrl_empty,                                 \
+           initial_capacity + GROUP_HASH_GROUP_WIDTH);                         \
+    table->elems = allocator_alloc(                                            \
+        table->alloc,                                                          \
+        initial_capacity * sizeof(struct group_hash_##NAME##_elem));           \
+    table->num_elems = 0;                                                      \
+    table->num_deleted = 0;                                                    \
+    table->cap = initial_capacity;                                             \
+    table->mask = initial_capacity - 1;                                        \
+    table->resize_thresh =                                                     \
+        ((uint64_t)initial_capacity * group_hash_load_factor_to_grow) / 100;   \
+  }                                                                            \
+                                                                               \
+  static void group_hash_##NAME##__set_ctrl(struct group_hash_##NAME *table,   \
+                                            uint32_t idx, uint8_t ctrl) {      \
+    table->ctrl[idx] = ctrl;                                                   \
+                                                                               \
+    /* keep the copy of the first group in sync */                             \
+    if (idx < GROUP_HASH_GROUP_WIDTH) {                                        \
+      table->ctrl[table->cap + idx] = ctrl;                                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* first empty or deleted slot in the probe sequence of `hash` */            \
+  static uint32_t group_hash_##NAME##__find_free(                              \
+      struct group_hash_##NAME *table, uint32_t hash) {                        \
+    uint32_t pos = hash & table->mask;                                         \
+    uint32_t stride = 0;                                                       \
+                                                                               \
+    for (;;) {                                                                 \
+      uint32_t m = group_hash_match_free(&table->ctrl[pos]);                   \
+                                                                               \
+      if (m) {                                                                 \
+        return (pos + __builtin_ctz(m)) & table->mask;                         \
+      }                                                                        \
+                                                                               \
+      stride += GROUP_HASH_GROUP_WIDTH;                                        \
+      pos = (pos + stride) & table->mask;                                      \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void group_hash_##NAME##__put(struct group_hash_##NAME *table,        \
+                                       struct group_hash_##NAME##_elem e) {    \
+    uint32_t hash = group_hash_hash_fun(e.key);                                \
+    uint32_t idx = group_hash_##NAME##__find_free(table, hash);                \
+                                                                               \
+    if (table->ctrl[idx] == group_hash_ctrl_deleted) {                         \
+      table->num_deleted--;                                                    \
+    }                                                                          \
+                                                                               \
+    group_hash_##NAME##__set_ctrl(table, idx, group_hash_tag(hash));           \
+    table->elems[idx] = e;                                                     \
+    table->num_elems++;                                                        \
+  }                                                                            \
+                                                                               \
+  /* rebuild the table at `new_cap`, which also drops every tombstone */       \
+  static void group_hash_##NAME##__rehash(struct group_hash_##NAME *table,     \
+                                          uint32_t new_cap) {                  \
+    struct group_hash_##NAME new_table;                                        \
+    new_table.alloc = table->alloc;                                            \
+    group_hash_##NAME##__construct(&new_table, new_cap);                       \
+    new_table.num_grows = table->num_grows + (new_cap > table->cap);           \
+                                                                               \
+    for (uint32_t i = 0; i < table->cap; i++) {                                \
+      if (!(table->ctrl[i] & 0x80)) {                                          \
+        group_hash_##NAME##__put(&new_table, table->elems[i]);                 \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    group_hash_##NAME##_free(table);                                           \
+    *table = new_table;                                                        \
+  }                                                                            \
+                                                                               \
+  struct group_hash_##NAME *group_hash_##NAME##_new_with_allocator(            \
+      const struct allocator *alloc) {                                         \
+    struct group_hash_##NAME *table =                                          \
+        allocator_alloc(alloc, sizeof(struct group_hash_##NAME));              \
+    table->alloc = alloc;                                                      \
+    group_hash_##NAME##__construct(table, group_hash_initial_cap);             \
+    table->num_grows = 0;                                                      \
+    return table;                                                              \
+  }                                                                            \
+                                                                               \
+  struct group_hash_##NAME *group_hash_##NAME##_new() {                        \
+    return group_hash_##NAME##_new_with_allocator(&allocator_heap);            \
+  }                                                                            \
+                                                                               \
+  void group_hash_##NAME##_free(struct group_hash_##NAME *table) {             \
+    allocator_free(table->alloc, table->ctrl,                                  \
+                   table->cap + GROUP_HASH_GROUP_WIDTH);                       \
+    allocator_free(table->alloc, table->elems,                                 \
+                   table->cap * sizeof(struct group_hash_##NAME##_elem));      \
+  }                                                                            \
+                                                                               \
+  void group_hash_##NAME##_insert(struct group_hash_##NAME *table, uint32_t k, \
+                                  VALTYPE v) {                                 \
+    int64_t idx = group_hash_##NAME##__index(table, k);                        \
+                                                                               \
+    /* already present, overwrite the value in place */                        \
+    if (idx >= 0) {                                                            \
+      table->elems[idx].val = v;                                               \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    if (table->num_elems + table->num_deleted + 1 >= table->resize_thresh) {   \
+      /* mostly tombstones, clean them up without growing */                   \
+      if (table->num_elems * 2 < table->resize_thresh) {                       \
+        group_hash_##NAME##__rehash(table, table->cap);                        \
+      } else {                                                                 \
+        group_hash_##NAME##__rehash(table, table->cap * 2);                    \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    group_hash_##NAME##__put(table,                                            \
+                             (struct group_hash_##NAME##_elem){k, v});         \
+  }                                                                            \
+                                                                               \
+  bool group_hash_##NAME##_delete(struct group_hash_##NAME *table,             \
+                                  uint32_t k) {                                \
+    int64_t idx = group_hash_##NAME##__index(table, k);                        \
+                                                                               \
+    if (idx < 0) {                                                             \
+      return false;                                                            \
+    }                                                                          \
+                                                                               \
+    group_hash_##NAME##__set_ctrl(table, idx, group_hash_ctrl_deleted);        \
+    table->num_elems--;                                                        \
+    table->num_deleted++;                                                      \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* rehash once so `n` elements fit without growing again */                  \
+  void group_hash_##NAME##_reserve(struct group_hash_##NAME *table,            \
+                                   uint32_t n) {                               \
+    uint64_t new_cap = table->cap;                                             \
+                                                                               \
+    while ((new_cap * group_hash_load_factor_to_grow) / 100 <= n + 1ull) {     \
+      new_cap *= 2;                                                            \
+    }                                                                          \
+                                                                               \
+    if (new_cap > UINT32_MAX) {                                                \
+      RUNTIME_ERROR("Can't reserve room for %u elements", n);                  \
+    }                                                                          \
+                                                                               \
+    /* same capacity, but the tombstones would force a rehash on the way */    \
+    if (new_cap > table->cap ||                                                \
+        n + table->num_deleted + 1 >= table->resize_thresh) {                  \
+      group_hash_##NAME##__rehash(table, new_cap);                             \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  void group_hash_##NAME##_insert_many(struct group_hash_##NAME *table,        \
+                                       const uint32_t *keys,                   \
+                                       const VALTYPE *vals, uint32_t n) {      \
+    group_hash_##NAME##_reserve(table, table->num_elems + n);                  \
+                                                                               \
+    for (uint32_t i = 0; i < n; i++) {                                         \
+      group_hash_##NAME##_insert(table, keys[i], vals[i]);                     \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* tags and slots as they are, the copy of the first group is rebuilt on     \
+   * load since the group width depends on how the loader was compiled */      \
+  void group_hash_##NAME##_snapshot_write(struct group_hash_##NAME *table,     \
+                                          struct snapshot_writer *w) {         \
+    uint32_t header[3] = {table->num_elems, table->num_deleted, table->cap};   \
+    snapshot_write(w, header, sizeof(header));                                 \
+    snapshot_write(w, table->ctrl, table->cap);                                \
+    snapshot_write(w, table->elems,                                            \
+                   (uint64_t)table->cap *                                      \
+                       sizeof(struct group_hash_##NAME##_elem));               \
+  }                                                                            \
+                                                                               \
+  void group_hash_##NAME##_snapshot_read(struct group_hash_##NAME *table,      \
+                                         struct snapshot_reader *r) {          \
+    const uint32_t *header = snapshot_read(r, 3 * sizeof(uint32_t));           \
+                                                                               \
+    /* lookups mask with cap - 1 and read whole groups */                      \
+    if (header == NULL || header[2] < GROUP_HASH_GROUP_WIDTH ||                \
+        (header[2] & (header[2] - 1)) || header[0] > header[2]) {              \
+      r->failed = true;                                                        \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    uint32_t cap = header[2];                                                  \
+    uint8_t *ctrl = snapshot_read_array(r, table->alloc, 1, cap,               \
+                                        cap + GROUP_HASH_GROUP_WIDTH);         \
+    struct group_hash_##NAME##_elem *elems = snapshot_read_array(              \
+        r, table->alloc, sizeof(struct group_hash_##NAME##_elem), cap, cap);   \
+                                                                               \
+    if (elems == NULL) {                                                       \
+      allocator_free(table->alloc, ctrl, cap + GROUP_HASH_GROUP_WIDTH);        \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    group_hash_##NAME##_free(table);                                           \
+    table->ctrl = ctrl;                                                        \
+    memcpy(&table->ctrl[cap], table->ctrl, GROUP_HASH_GROUP_WIDTH);            \
+    table->elems = elems;                                                      \
+    table->num_elems = header[0];                                              \
+    table->num_deleted = header[1];                                            \
+    table->cap = cap;                                                          \
+    table->mask = cap - 1;                                                     \
+    table->resize_thresh =                                                     \
+        ((uint64_t)cap * group_hash_load_factor_to_grow) / 100;                \
+  }                                                                            \
+                                                                               \
+  /* distances are in groups: how many a lookup of the value looks at before   \
+   * the one it's in */                                                        \
+  void group_hash_##NAME##_stats(struct group_hash_##NAME *table,              \
+                                 struct storage_stats *stats) {                \
+    for (uint32_t idx = 0; idx < table->cap; idx++) {                          \
+      if (table->ctrl[idx] & 0x80) {                                           \
+        continue;                                                              \
+      }                                                                        \
+                                                                               \
+      uint32_t pos = group_hash_hash_fun(table->elems[idx].key) & table->mask; \
+      uint32_t stride = 0;                                                     \
+      uint32_t distance = 0;                                                   \
+                                                                               \
+      while (((idx - pos) & table->mask) >= GROUP_HASH_GROUP_WIDTH) {          \
+        stride += GROUP_HASH_GROUP_WIDTH;                                      \
+        pos = (pos + stride) & table->mask;                                    \
+        distance++;                                                            \
+      }                                                                        \
+                                                                               \
+      storage_stats_add_probe(stats, distance);                                \
+    }                                                                          \
+                                                                               \
+    stats->num_elems = table->num_elems;                                       \
+    stats->cap = table->cap;                                                   \
+    stats->tombstones = table->num_deleted;                                    \
+    stats->bytes = table->cap + GROUP_HASH_GROUP_WIDTH +                       \
+                   table->cap * sizeof(struct group_hash_##NAME##_elem);       \
+    stats->grows = table->num_grows;                                           \
+    storage_stats_finish(stats);                                               \
+  }
+
+#endif // __GROUP_HASH_H_
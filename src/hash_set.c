@@ -1,22 +1,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#include "bit_array.h"
 #include "hash_set.h"
 #include "common_macros.h"
 
-bool hash_set_is_entry_deleted(struct hash_set *table, uint32_t idx) {
-  return get_bit_in_bitarray(table->deleted, idx);
-}
-
-static void hash_set__mark_deleted(struct hash_set *table, uint32_t idx) {
-  set_bit_in_bitarray(table->deleted, idx, true);
-}
-
-static void hash_set__reset_deleted(struct hash_set *table, uint32_t idx) {
-  set_bit_in_bitarray(table->deleted, idx, false);
-}
-
 uint32_t hash_set_hash_fun(uint32_t k) {
   const uint32_t hash_constant = 0x45d9f3b;
 
@@ -44,11 +31,6 @@ uint32_t hash_set_max_probes(struct hash_set *table, uint32_t hash,
   return (table->cap + idx - hash_set_hash_idx(table, hash)) & table->mask;
 }
 
-static void hash_set__set_elem(struct hash_set *table, uint32_t idx, uint32_t h,
-                               uint32_t k) {
-  table->elems[idx] = (struct hash_set_elem){h, k};
-}
-
 static void hash_set__insert(struct hash_set *table, struct hash_set_elem e) {
   uint32_t idx = hash_set_hash_idx(table, e.hash);
   uint32_t to_insert_elem_probes = 0;
@@ -64,22 +46,10 @@ static void hash_set__insert(struct hash_set *table, struct hash_set_elem e) {
     uint32_t current_elem_probes =
         hash_set_max_probes(table, table->elems[idx].hash, idx);
 
-    // if we're here, the element was occupied or deleted
+    // if we're here, the element was occupied
     // steal from the rich, give to the poor
     if (current_elem_probes < to_insert_elem_probes) {
-
-      // the element is deleted, just replace it
-      if (hash_set_is_entry_deleted(table, idx)) {
-
-        // undelete
-        hash_set__reset_deleted(table, idx);
-
-        table->elems[idx] = e;
-
-        return;
-      }
-
-      // element wasn't deleted, swap element to insert with it and continue
+      // swap element to insert with it and continue
       SWAP(e, table->elems[idx]);
       to_insert_elem_probes = current_elem_probes;
     }
@@ -92,16 +62,14 @@ static void hash_set__insert(struct hash_set *table, struct hash_set_elem e) {
   }
 }
 
-static int64_t hash_set__lookup(struct hash_set *table, uint32_t k) {
-  uint32_t hash = hash_set__fix_hash(hash_set_hash_fun(k));
-  uint32_t idx = hash_set_hash_idx(table, hash);
-
-  uint32_t num_probes = 0;
-
+// index of `k` in `table` probing from `idx`, which is `num_probes` past its
+// home bucket
+static int64_t hash_set__probe(struct hash_set *table, uint32_t hash,
+                               uint32_t k, uint32_t idx, uint32_t num_probes) {
   for (;;) {
     uint32_t current_hash = table->elems[idx].hash;
 
-    // if the entry is empty and not deleted, nothing is here
+    // if the entry is empty, nothing is here
     if (!current_hash) {
       return -1;
     }
@@ -112,9 +80,8 @@ static int64_t hash_set__lookup(struct hash_set *table, uint32_t k) {
       return -1;
     }
 
-    // current element isn't deleted, and both the hash and keys match
-    if (!hash_set_is_entry_deleted(table, idx) && current_hash == hash &&
-        table->elems[idx].key == k) {
+    // both the hash and keys match
+    if (current_hash == hash && table->elems[idx].key == k) {
       return idx;
     }
 
@@ -124,30 +91,128 @@ static int64_t hash_set__lookup(struct hash_set *table, uint32_t k) {
   }
 }
 
+// index of `k`, in `table` or in the set it's growing from
+static int64_t hash_set__lookup(struct hash_set *table, uint32_t k,
+                                struct hash_set **in) {
+  uint32_t hash = hash_set__fix_hash(hash_set_hash_fun(k));
+  int64_t idx =
+      hash_set__probe(table, hash, k, hash_set_hash_idx(table, hash), 0);
+  *in = table;
+
+  if (idx >= 0 || table->old == NULL) {
+    return idx;
+  }
+
+  struct hash_set *old = table->old;
+  uint32_t home = hash_set_hash_idx(old, hash);
+  uint32_t num_probes = 0;
+
+  // the moved buckets are empty now, the rest of the probe sequence picks up
+  // right after them
+  uint32_t into_migrated = (home - table->migrate_start) & old->mask;
+  if (into_migrated < table->num_migrated) {
+    num_probes = table->num_migrated - into_migrated;
+  }
+
+  *in = old;
+  return hash_set__probe(old, hash, k, (home + num_probes) & old->mask,
+                         num_probes);
+}
+
 static void hash_set__construct(struct hash_set *table,
                                 uint32_t initial_capacity) {
-  table->elems = calloc(initial_capacity, sizeof(struct hash_set_elem));
-  table->deleted = bit_array_new(initial_capacity);
+  table->elems = allocator_calloc(
+      table->alloc, initial_capacity * sizeof(struct hash_set_elem));
   table->num_elems = 0;
   table->cap = initial_capacity;
   table->mask = initial_capacity - 1;
   table->resize_thresh =
       (initial_capacity * hash_set_load_factor_to_grow) / 100;
+  table->old = NULL;
+  table->migrate_start = 0;
+  table->num_migrated = 0;
 }
 
-struct hash_set *hash_set_new() {
-  struct hash_set *table = malloc(sizeof(struct hash_set));
+struct hash_set *hash_set_new_with_allocator(const struct allocator *alloc) {
+  struct hash_set *table = allocator_alloc(alloc, sizeof(struct hash_set));
+  table->alloc = alloc;
   hash_set__construct(table, hash_set_initial_cap);
   return table;
 }
 
+struct hash_set *hash_set_new() {
+  return hash_set_new_with_allocator(&allocator_heap);
+}
+
+// frees the set being grown from
+static void hash_set__free_old(struct hash_set *table) {
+  struct hash_set *old = table->old;
+
+  allocator_free(table->alloc, old->elems,
+                 old->cap * sizeof(struct hash_set_elem));
+  allocator_free(table->alloc, old, sizeof(struct hash_set));
+  table->old = NULL;
+}
+
 void hash_set_free(struct hash_set *table) {
-  free(table->elems);
-  free(table->deleted);
+  if (table->old != NULL) {
+    hash_set__free_old(table);
+  }
+
+  allocator_free(table->alloc, table->elems,
+                 table->cap * sizeof(struct hash_set_elem));
+}
+
+bool hash_set_migrate(struct hash_set *table, uint32_t num_buckets) {
+  struct hash_set *old = table->old;
+
+  if (old == NULL) {
+    return false;
+  }
+
+  for (; num_buckets && table->num_migrated < old->cap; num_buckets--) {
+    uint32_t idx = (table->migrate_start + table->num_migrated) & old->mask;
+
+    if (old->elems[idx].hash) {
+      hash_set__insert(table, old->elems[idx]);
+      old->elems[idx].hash = 0;
+      old->num_elems--;
+    }
+
+    table->num_migrated++;
+  }
+
+  if (table->num_migrated == old->cap) {
+    hash_set__free_old(table);
+    return false;
+  }
+
+  return true;
 }
 
 void hash_set_grow(struct hash_set *table) {
+  // still moving the previous set, finish that first
+  hash_set_migrate(table, UINT32_MAX);
+
+  if (table->cap >= hash_set_incremental_min_cap) {
+    struct hash_set *old =
+        allocator_alloc(table->alloc, sizeof(struct hash_set));
+    *old = *table;
+    hash_set__construct(table, old->cap * 2);
+    table->num_elems = old->num_elems;
+    table->old = old;
+
+    // start moving at an empty bucket: no probe sequence runs into the moved
+    // buckets from before them
+    while (old->elems[table->migrate_start].hash) {
+      table->migrate_start++;
+    }
+
+    return;
+  }
+
   struct hash_set new_table;
+  new_table.alloc = table->alloc;
   hash_set__construct(&new_table, table->cap * 2);
 
   new_table.num_elems = table->num_elems;
@@ -155,7 +220,7 @@ void hash_set_grow(struct hash_set *table) {
   for (uint32_t i = 0; i < table->cap; i++) {
     struct hash_set_elem e = table->elems[i];
 
-    if (e.hash && !hash_set_is_entry_deleted(table, i)) {
+    if (e.hash) {
       hash_set__insert(&new_table, e);
     }
   }
@@ -167,6 +232,7 @@ void hash_set_grow(struct hash_set *table) {
 void hash_set_insert(struct hash_set *table, uint32_t k) {
   uint32_t hash = hash_set__fix_hash(hash_set_hash_fun(k));
 
+  hash_set_migrate(table, hash_set_migrate_step);
   table->num_elems++;
 
   if (table->num_elems >= table->resize_thresh) {
@@ -178,20 +244,42 @@ void hash_set_insert(struct hash_set *table, uint32_t k) {
 }
 
 bool hash_set_contains(struct hash_set *table, uint32_t k) {
-  int64_t idx = hash_set__lookup(table, k);
+  struct hash_set *in;
+  int64_t idx = hash_set__lookup(table, k, &in);
 
   return !(idx < 0);
 }
 
 bool hash_set_delete(struct hash_set *table, uint32_t k) {
-  uint32_t hash = hash_set__fix_hash(hash_set_hash_fun(k));
-  int64_t idx = hash_set__lookup(table, k);
+  hash_set_migrate(table, hash_set_migrate_step);
+
+  struct hash_set *in;
+  int64_t found = hash_set__lookup(table, k, &in);
 
-  if (idx < 0) {
+  if (found < 0) {
     return false;
   }
 
-  hash_set__mark_deleted(table, idx);
+  uint32_t idx = found;
+
+  // backward shift: pull the following elements of the cluster back one slot
+  // until one is already in its home bucket (or the slot is empty)
+  for (;;) {
+    uint32_t next = (idx + 1) & in->mask;
+    uint32_t next_hash = in->elems[next].hash;
+
+    if (!next_hash || !hash_set_max_probes(in, next_hash, next)) {
+      break;
+    }
+
+    in->elems[idx] = in->elems[next];
+    idx = next;
+  }
+
+  in->elems[idx].hash = 0;
+  if (in != table) {
+    in->num_elems--;
+  }
   table->num_elems--;
   return true;
 }
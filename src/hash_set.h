@@ -1,16 +1,21 @@
 #ifndef __HASH_SET_H_
 #define __HASH_SET_H_
 
-// A hash set implementation using robin hood hashing
+// A hash set implementation using robin hood hashing, with backward shift
+// deletion so there are no tombstones
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 
-#include "bit_array.h"
+#include "allocator.h"
 #include "common_macros.h"
 
 static const uint32_t hash_set_initial_cap = 256;
 static const uint8_t hash_set_load_factor_to_grow = 90;
+// sets at least this big grow incrementally, see hash_set_migrate
+static const uint32_t hash_set_incremental_min_cap = 1u << 16;
+static const uint32_t hash_set_migrate_step = 64;
 
 struct hash_set_elem {
   uint32_t hash;
@@ -19,15 +24,18 @@ struct hash_set_elem {
 
 struct hash_set {
   struct hash_set_elem *elems;
-  uint8_t *deleted;
   uint32_t num_elems;
   uint32_t cap;
   uint32_t mask;
   uint resize_thresh;
+  // while growing incrementally, the set being moved into this one. Its buckets
+  // from migrate_start on (wrapping around) are moved and empty
+  struct hash_set *old;
+  uint32_t migrate_start;
+  uint32_t num_migrated;
+  const struct allocator *alloc;
 };
 
-bool hash_set_is_entry_deleted(struct hash_set *table, uint32_t idx);
-
 uint32_t hash_set_hash_fun(uint32_t k);
 
 uint32_t hash_set_hash_idx(struct hash_set *table, uint32_t hash);
@@ -37,6 +45,8 @@ uint32_t hash_set_max_probes(struct hash_set *table, uint32_t hash,
 
 struct hash_set *hash_set_new();
 
+struct hash_set *hash_set_new_with_allocator(const struct allocator *alloc);
+
 void hash_set_free(struct hash_set *table);
 
 void hash_set_grow(struct hash_set *table);
@@ -46,13 +56,30 @@ bool hash_set_contains(struct hash_set *table, uint32_t k);
 
 bool hash_set_delete(struct hash_set *table, uint32_t k);
 
+/**
+ * Move up to `num_buckets` buckets of the set being grown from, returns whether
+ * some are left. Inserts and deletes move a few on their own, this lets idle
+ * time move more.
+ */
+bool hash_set_migrate(struct hash_set *table, uint32_t num_buckets);
+
+// slots are the buckets, followed by the old set's while growing incrementally
+static inline uint32_t hash_set_num_slots(struct hash_set *table) {
+  return table->cap + (table->old ? table->old->cap : 0);
+}
+
+static inline struct hash_set_elem *hash_set_slot(struct hash_set *table,
+                                                  uint32_t idx) {
+  return idx < table->cap ? &table->elems[idx]
+                          : &table->old->elems[idx - table->cap];
+}
+
 #define HASH_SET_ITER(ELEM_NAME, TABLE, ...)                                   \
-  for (uint32_t hash_set_iter_idx = 0; hash_set_iter_idx < (TABLE)->cap;       \
-       hash_set_iter_idx++) {                                                  \
-    struct hash_set_##NAME##_elem hash_set_iter_e =                            \
-        (TABLE)->elems[hash_set_iter_idx];                                     \
-    if (hash_set_iter_e.hash &&                                                \
-        !hash_set_##NAME##__is_entry_deleted((TABLE), hash_set_iter_idx)) {    \
+  for (uint32_t hash_set_iter_idx = 0;                                         \
+       hash_set_iter_idx < hash_set_num_slots(TABLE); hash_set_iter_idx++) {   \
+    struct hash_set_elem hash_set_iter_e =                                     \
+        *hash_set_slot((TABLE), hash_set_iter_idx);                            \
+    if (hash_set_iter_e.hash) {                                                \
       uint32_t ELEM_NAME = hash_set_iter_e.key;                                \
       { __VA_ARGS__ }                                                          \
     }                                                                          \
@@ -1,30 +1,75 @@
 #ifndef __HASH_H_
 #define __HASH_H_
 
-// A hash table implementation using robin hood hashing
+// A hash table implementation using robin hood hashing, with backward shift
+// deletion so there are no tombstones
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 
-#include "bit_array.h"
+#include "allocator.h"
 #include "common_macros.h"
+#include "snapshot.h"
+#include "storage_stats.h"
 
 static const uint32_t hash_table_initial_cap = 16;
 static const uint8_t hash_table_load_factor_to_grow = 90;
+// tables at least this big grow incrementally: the elements are moved to the
+// new array a few buckets per insert or delete instead of all at once
+static const uint32_t hash_table_incremental_min_cap = 1u << 16;
+static const uint32_t hash_table_migrate_step = 64;
+
+// where a batch of keys lands, for inserting them sorted by home bucket
+struct hash_table_bucket_order {
+  uint32_t hash;
+  uint32_t src;
+};
+
+// buckets are sorted on their top bits only, nearby buckets may stay out of
+// order but they share cache lines anyway
+static const uint32_t hash_table_bucket_sort_bits = 16;
+
+/**
+ * Counting sort of `n` entries of `in` by home bucket in a table of `cap`
+ * buckets, into `out`. The bins come from the table's allocator `alloc`.
+ */
+static inline void
+hash_table_sort_by_bucket(const struct hash_table_bucket_order *in,
+                          struct hash_table_bucket_order *out, uint32_t n,
+                          uint32_t cap, const struct allocator *alloc) {
+  uint32_t cap_bits = __builtin_ctz(cap);
+  uint32_t shift = cap_bits > hash_table_bucket_sort_bits
+                       ? cap_bits - hash_table_bucket_sort_bits
+                       : 0;
+  uint32_t num_bins = cap >> shift;
+  size_t starts_size = (num_bins + 1) * sizeof(uint32_t);
+  uint32_t *starts = allocator_calloc(alloc, starts_size);
+
+  for (uint32_t i = 0; i < n; i++) {
+    starts[((in[i].hash & (cap - 1)) >> shift) + 1]++;
+  }
+
+  for (uint32_t i = 1; i <= num_bins; i++) {
+    starts[i] += starts[i - 1];
+  }
+
+  for (uint32_t i = 0; i < n; i++) {
+    out[starts[(in[i].hash & (cap - 1)) >> shift]++] = in[i];
+  }
+
+  allocator_free(alloc, starts, starts_size);
+}
 
 #define HASH_TABLE_ITER(NAME, KEY_NAME, VAL_NAME, TABLE, ...)                  \
   for (uint32_t hash_table_##NAME##_iter_idx = 0;                              \
-       hash_table_##NAME##_iter_idx < (TABLE)->cap;                            \
+       hash_table_##NAME##_iter_idx < hash_table_##NAME##_num_slots(TABLE);    \
        hash_table_##NAME##_iter_idx++) {                                       \
-    struct hash_table_##NAME##_elem hash_table_##NAME##_iter_e =               \
-        (TABLE)->elems[hash_table_##NAME##_iter_idx];                          \
-    if (hash_table_##NAME##_iter_e.hash &&                                     \
-        !hash_table_##NAME##__is_entry_deleted(                                \
-            (TABLE), hash_table_##NAME##_iter_idx)) {                          \
-      uint32_t KEY_NAME = hash_table_##NAME##_iter_e.key;                      \
-      typeof(&hash_table_##NAME##_iter_e.val) VAL_NAME =                       \
-          &hash_table_##NAME##_iter_e.val;                                     \
-      { __VA_ARGS__ }                                                          \
+    uint32_t KEY_NAME;                                                         \
+    typeof(&(TABLE)->elems[0].val) VAL_NAME = hash_table_##NAME##_slot(        \
+        (TABLE), hash_table_##NAME##_iter_idx, &KEY_NAME);                     \
+    if (VAL_NAME != NULL) {                                                    \
+      __VA_ARGS__                                                              \
     }                                                                          \
   }
 
@@ -37,36 +82,63 @@ static const uint8_t hash_table_load_factor_to_grow = 90;
                                                                                \
   struct hash_table_##NAME {                                                   \
     struct hash_table_##NAME##_elem *elems;                                    \
-    uint8_t *deleted;                                                          \
     uint32_t num_elems;                                                        \
     uint32_t cap;                                                              \
     uint32_t mask;                                                             \
     uint resize_thresh;                                                        \
+    /* while growing incrementally, the table being moved into this one. Its   \
+     * buckets from migrate_start on (wrapping around) are moved and empty */  \
+    struct hash_table_##NAME *old;                                             \
+    uint32_t migrate_start;                                                    \
+    uint32_t num_migrated;                                                     \
+    uint64_t num_grows;                                                        \
+    const struct allocator *alloc;                                             \
   };                                                                           \
   struct hash_table_##NAME *hash_table_##NAME##_new();                         \
+  struct hash_table_##NAME *hash_table_##NAME##_new_with_allocator(            \
+      const struct allocator *alloc);                                          \
   void hash_table_##NAME##_free(struct hash_table_##NAME *table);              \
   void hash_table_##NAME##_insert(struct hash_table_##NAME *table, uint32_t k, \
                                   VALTYPE v);                                  \
   VALTYPE *hash_table_##NAME##_lookup(struct hash_table_##NAME *table,         \
                                       uint32_t k);                             \
-  bool hash_table_##NAME##_delete(struct hash_table_##NAME *table, uint32_t k);
-
-#define MAKE_HASH(VALTYPE, NAME)                                               \
-  bool hash_table_##NAME##__is_entry_deleted(struct hash_table_##NAME *table,  \
-                                             uint32_t idx) {                   \
-    return get_bit_in_bitarray(table->deleted, idx);                           \
+  bool hash_table_##NAME##_delete(struct hash_table_##NAME *table, uint32_t k); \
+  void hash_table_##NAME##_reserve(struct hash_table_##NAME *table,            \
+                                   uint32_t n);                                \
+  void hash_table_##NAME##_insert_many(struct hash_table_##NAME *table,        \
+                                       const uint32_t *keys,                   \
+                                       const VALTYPE *vals, uint32_t n);       \
+  bool hash_table_##NAME##_migrate(struct hash_table_##NAME *table,            \
+                                   uint32_t num_buckets);                      \
+  void hash_table_##NAME##_snapshot_write(struct hash_table_##NAME *table,     \
+                                          struct snapshot_writer *w);          \
+  void hash_table_##NAME##_snapshot_read(struct hash_table_##NAME *table,      \
+                                         struct snapshot_reader *r);           \
+  void hash_table_##NAME##_stats(struct hash_table_##NAME *table,              \
+                                 struct storage_stats *stats);                 \
+                                                                               \
+  /* slots are the buckets, followed by the old table's while growing          \
+   * incrementally, empty ones hold no value */                                \
+  static inline uint32_t hash_table_##NAME##_num_slots(                        \
+      struct hash_table_##NAME *table) {                                       \
+    return table->cap + (table->old ? table->old->cap : 0);                    \
   }                                                                            \
                                                                                \
-  static void hash_table_##NAME##__mark_deleted(                               \
-      struct hash_table_##NAME *table, uint32_t idx) {                         \
-    set_bit_in_bitarray(table->deleted, idx, true);                            \
-  }                                                                            \
+  static inline VALTYPE *hash_table_##NAME##_slot(                             \
+      struct hash_table_##NAME *table, uint32_t idx, uint32_t *key) {          \
+    struct hash_table_##NAME##_elem *e =                                       \
+        idx < table->cap ? &table->elems[idx]                                  \
+                         : &table->old->elems[idx - table->cap];               \
                                                                                \
-  static void hash_table_##NAME##__reset_deleted(                              \
-      struct hash_table_##NAME *table, uint32_t idx) {                         \
-    set_bit_in_bitarray(table->deleted, idx, false);                           \
-  }                                                                            \
+    if (!e->hash) {                                                            \
+      return NULL;                                                             \
+    }                                                                          \
                                                                                \
+    *key = e->key;                                                             \
+    return &e->val;                                                            \
+  }
+
+#define MAKE_HASH(VALTYPE, NAME)                                               \
   static uint32_t hash_table_##NAME##__hash_fun(uint32_t k) {                  \
     const uint32_t hash_constant = 0x45d9f3b;                                  \
                                                                                \
@@ -111,30 +183,16 @@ static const uint8_t hash_table_load_factor_to_grow = 90;
         return;                                                                \
       }                                                                        \
                                                                                \
-      /* printf("elem at: %d, k: %d, v: %d, deleted?: %d\n", idx,              \
-       * table->elems[idx].key, table->elems[idx].val,                         \
-       * hash_table_ ## NAME ## __is_entry_deleted(table, idx)); */            \
+      /* printf("elem at: %d, k: %d, v: %d\n", idx, table->elems[idx].key,     \
+       * table->elems[idx].val); */                                            \
                                                                                \
       uint32_t current_elem_probes =                                           \
           hash_table_##NAME##__max_probes(table, table->elems[idx].hash, idx); \
                                                                                \
-      /* if we're here, the element was occupied or deleted  */                \
+      /* if we're here, the element was occupied  */                           \
       /* steal from the rich, give to the poor  */                             \
       if (current_elem_probes < to_insert_elem_probes) {                       \
-                                                                               \
-        /* the element is deleted, just replace it  */                         \
-        if (hash_table_##NAME##__is_entry_deleted(table, idx)) {               \
-                                                                               \
-          /* undelete  */                                                      \
-          hash_table_##NAME##__reset_deleted(table, idx);                      \
-                                                                               \
-          table->elems[idx] = e;                                               \
-                                                                               \
-          return;                                                              \
-        }                                                                      \
-                                                                               \
-        /* element wasn't deleted, swap element to insert with it and continue \
-         */                                                                    \
+        /* swap element to insert with it and continue */                      \
         SWAP(e, table->elems[idx]);                                            \
         to_insert_elem_probes = current_elem_probes;                           \
       }                                                                        \
@@ -148,20 +206,21 @@ static const uint8_t hash_table_load_factor_to_grow = 90;
     }                                                                          \
   }                                                                            \
                                                                                \
-  static int64_t hash_table_##NAME##__lookup(struct hash_table_##NAME *table,  \
-                                             uint32_t k) {                     \
-    uint32_t hash =                                                            \
-        hash_table_##NAME##__fix_hash(hash_table_##NAME##__hash_fun(k));       \
-    uint32_t idx = hash_table_##NAME##__hash_idx(table, hash);                 \
-                                                                               \
-    uint32_t num_probes = 0;                                                   \
+  /* index of `k` in `table` probing from `idx`, which is `num_probes` past    \
+   * its home bucket */                                                        \
+  static int64_t hash_table_##NAME##__probe(struct hash_table_##NAME *table,   \
+                                            uint32_t hash, uint32_t k,         \
+                                            uint32_t idx,                      \
+                                            uint32_t num_probes) {             \
+    uint32_t first_probe = num_probes;                                         \
+    int64_t found = -1;                                                        \
                                                                                \
     for (;;) {                                                                 \
       uint32_t current_hash = table->elems[idx].hash;                          \
                                                                                \
-      /* if the entry is empty and not deleted, nothing is here  */            \
+      /* if the entry is empty, nothing is here  */                            \
       if (!current_hash) {                                                     \
-        return -1;                                                             \
+        break;                                                                 \
       }                                                                        \
                                                                                \
       /* if we've proved enough times to check every possible entry, nothing   \
@@ -169,43 +228,85 @@ static const uint8_t hash_table_load_factor_to_grow = 90;
       /* here  */                                                              \
       if (num_probes >                                                         \
           hash_table_##NAME##__max_probes(table, current_hash, idx)) {         \
-        return -1;                                                             \
+        break;                                                                 \
       }                                                                        \
                                                                                \
-      /* current element isn't deleted, and both the hash and keys match  */   \
-      if (!hash_table_##NAME##__is_entry_deleted(table, idx) &&                \
-          current_hash == hash && table->elems[idx].key == k) {                \
-        return idx;                                                            \
+      /* both the hash and keys match  */                                      \
+      if (current_hash == hash && table->elems[idx].key == k) {                \
+        found = idx;                                                           \
+        break;                                                                 \
       }                                                                        \
                                                                                \
       idx++;                                                                   \
       idx &= table->mask;                                                      \
       num_probes++;                                                            \
     }                                                                          \
+                                                                               \
+    storage_probes += num_probes - first_probe + 1;                            \
+    return found;                                                              \
+  }                                                                            \
+                                                                               \
+  /* index of `k`, in `table` or in the table it's growing from */             \
+  static int64_t hash_table_##NAME##__lookup(struct hash_table_##NAME *table,  \
+                                             uint32_t k,                       \
+                                             struct hash_table_##NAME **in) {  \
+    uint32_t hash =                                                            \
+        hash_table_##NAME##__fix_hash(hash_table_##NAME##__hash_fun(k));       \
+    int64_t idx = hash_table_##NAME##__probe(                                  \
+        table, hash, k, hash_table_##NAME##__hash_idx(table, hash), 0);        \
+    *in = table;                                                               \
+                                                                               \
+    if (idx >= 0 || table->old == NULL) {                                      \
+      return idx;                                                              \
+    }                                                                          \
+                                                                               \
+    struct hash_table_##NAME *old = table->old;                                \
+    uint32_t home = hash_table_##NAME##__hash_idx(old, hash);                  \
+    uint32_t num_probes = 0;                                                   \
+                                                                               \
+    /* the moved buckets are empty now, the rest of the probe sequence picks   \
+     * up right after them */                                                  \
+    uint32_t into_migrated = (home - table->migrate_start) & old->mask;        \
+    if (into_migrated < table->num_migrated) {                                 \
+      num_probes = table->num_migrated - into_migrated;                        \
+    }                                                                          \
+                                                                               \
+    *in = old;                                                                 \
+    return hash_table_##NAME##__probe(old, hash, k,                            \
+                                      (home + num_probes) & old->mask,         \
+                                      num_probes);                             \
   }                                                                            \
                                                                                \
   static void hash_table_##NAME##__construct(struct hash_table_##NAME *table,  \
                                              uint32_t initial_capacity) {      \
-    table->elems =                                                             \
-        calloc(initial_capacity, sizeof(struct hash_table_##NAME##_elem));     \
-    table->deleted = bit_array_new(initial_capacity);                          \
+    table->elems = allocator_calloc(                                           \
+        table->alloc,                                                          \
+        initial_capacity * sizeof(struct hash_table_##NAME##_elem));           \
     table->num_elems = 0;                                                      \
     table->cap = initial_capacity;                                             \
     table->mask = initial_capacity - 1;                                        \
     table->resize_thresh =                                                     \
-        (initial_capacity * hash_table_load_factor_to_grow) / 100;             \
+        ((uint64_t)initial_capacity * hash_table_load_factor_to_grow) / 100;   \
+    table->old = NULL;                                                         \
+    table->migrate_start = 0;                                                  \
+    table->num_migrated = 0;                                                   \
   }                                                                            \
                                                                                \
-  static void hash_table_##NAME##__grow(struct hash_table_##NAME *table) {     \
+  static void hash_table_##NAME##__resize(struct hash_table_##NAME *table,     \
+                                          uint32_t new_cap) {                  \
+    hash_table_##NAME##_migrate(table, UINT32_MAX);                            \
+                                                                               \
     struct hash_table_##NAME new_table;                                        \
-    hash_table_##NAME##__construct(&new_table, table->cap * 2);                \
+    new_table.alloc = table->alloc;                                            \
+    hash_table_##NAME##__construct(&new_table, new_cap);                       \
                                                                                \
     new_table.num_elems = table->num_elems;                                    \
+    new_table.num_grows = table->num_grows + 1;                                \
                                                                                \
     for (uint32_t i = 0; i < table->cap; i++) {                                \
       struct hash_table_##NAME##_elem e = table->elems[i];                     \
                                                                                \
-      if (e.hash && !hash_table_##NAME##__is_entry_deleted(table, i)) {        \
+      if (e.hash) {                                                            \
         hash_table_##NAME##__insert(&new_table, e);                            \
       }                                                                        \
     }                                                                          \
@@ -214,16 +315,91 @@ static const uint8_t hash_table_load_factor_to_grow = 90;
     *table = new_table;                                                        \
   }                                                                            \
                                                                                \
-  struct hash_table_##NAME *hash_table_##NAME##_new() {                        \
+  static void hash_table_##NAME##__grow(struct hash_table_##NAME *table) {     \
+    if (table->cap < hash_table_incremental_min_cap) {                         \
+      hash_table_##NAME##__resize(table, table->cap * 2);                      \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    /* still moving the previous table, finish that first */                   \
+    hash_table_##NAME##_migrate(table, UINT32_MAX);                            \
+                                                                               \
+    struct hash_table_##NAME *old =                                            \
+        allocator_alloc(table->alloc, sizeof(struct hash_table_##NAME));       \
+    *old = *table;                                                             \
+    hash_table_##NAME##__construct(table, old->cap * 2);                       \
+    table->num_elems = old->num_elems;                                         \
+    table->num_grows++;                                                        \
+    table->old = old;                                                          \
+                                                                               \
+    /* start moving at an empty bucket: no probe sequence runs into the moved  \
+     * buckets from before them */                                             \
+    while (old->elems[table->migrate_start].hash) {                            \
+      table->migrate_start++;                                                  \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  struct hash_table_##NAME *hash_table_##NAME##_new_with_allocator(            \
+      const struct allocator *alloc) {                                         \
     struct hash_table_##NAME *table =                                          \
-        malloc(sizeof(struct hash_table_##NAME));                              \
+        allocator_alloc(alloc, sizeof(struct hash_table_##NAME));              \
+    table->alloc = alloc;                                                      \
     hash_table_##NAME##__construct(table, hash_table_initial_cap);             \
+    table->num_grows = 0;                                                      \
     return table;                                                              \
   }                                                                            \
                                                                                \
+  struct hash_table_##NAME *hash_table_##NAME##_new() {                        \
+    return hash_table_##NAME##_new_with_allocator(&allocator_heap);            \
+  }                                                                            \
+                                                                               \
+  /* frees a table's arrays, and the table it's growing from */                \
+  static void hash_table_##NAME##__free_old(struct hash_table_##NAME *table) { \
+    struct hash_table_##NAME *old = table->old;                                \
+                                                                               \
+    allocator_free(table->alloc, old->elems,                                   \
+                   old->cap * sizeof(struct hash_table_##NAME##_elem));        \
+    allocator_free(table->alloc, old, sizeof(struct hash_table_##NAME));       \
+    table->old = NULL;                                                         \
+  }                                                                            \
+                                                                               \
   void hash_table_##NAME##_free(struct hash_table_##NAME *table) {             \
-    free(table->elems);                                                        \
-    free(table->deleted);                                                      \
+    if (table->old != NULL) {                                                  \
+      hash_table_##NAME##__free_old(table);                                    \
+    }                                                                          \
+                                                                               \
+    allocator_free(table->alloc, table->elems,                                 \
+                   table->cap * sizeof(struct hash_table_##NAME##_elem));      \
+  }                                                                            \
+                                                                               \
+  /* move up to `num_buckets` buckets of the table being grown from, returns   \
+   * whether some are left */                                                  \
+  bool hash_table_##NAME##_migrate(struct hash_table_##NAME *table,            \
+                                   uint32_t num_buckets) {                     \
+    struct hash_table_##NAME *old = table->old;                                \
+                                                                               \
+    if (old == NULL) {                                                         \
+      return false;                                                            \
+    }                                                                          \
+                                                                               \
+    for (; num_buckets && table->num_migrated < old->cap; num_buckets--) {     \
+      uint32_t idx = (table->migrate_start + table->num_migrated) & old->mask; \
+                                                                               \
+      if (old->elems[idx].hash) {                                              \
+        hash_table_##NAME##__insert(table, old->elems[idx]);                   \
+        old->elems[idx].hash = 0;                                              \
+        old->num_elems--;                                                      \
+      }                                                                        \
+                                                                               \
+      table->num_migrated++;                                                   \
+    }                                                                          \
+                                                                               \
+    if (table->num_migrated == old->cap) {                                     \
+      hash_table_##NAME##__free_old(table);                                    \
+      return false;                                                            \
+    }                                                                          \
+                                                                               \
+    return true;                                                               \
   }                                                                            \
                                                                                \
   void hash_table_##NAME##_insert(struct hash_table_##NAME *table, uint32_t k, \
@@ -234,6 +410,16 @@ static const uint8_t hash_table_load_factor_to_grow = 90;
     /* printf("num_elems: %d, resize_thresh: %d\n", table->num_elems,          \
      * table->resize_thresh); */                                               \
                                                                                \
+    hash_table_##NAME##_migrate(table, hash_table_migrate_step);               \
+                                                                               \
+    struct hash_table_##NAME *in;                                              \
+    int64_t found = hash_table_##NAME##__lookup(table, k, &in);                \
+                                                                               \
+    if (found >= 0) {                                                          \
+      in->elems[found].val = v;                                                \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
     table->num_elems++;                                                        \
                                                                                \
     if (table->num_elems >= table->resize_thresh) {                            \
@@ -245,28 +431,185 @@ static const uint8_t hash_table_load_factor_to_grow = 90;
         table, (struct hash_table_##NAME##_elem){hash, k, v});                 \
   }                                                                            \
                                                                                \
+  /* doesn't move buckets of an incremental grow, so it's safe to call from    \
+   * several threads at once */                                                \
   VALTYPE *hash_table_##NAME##_lookup(struct hash_table_##NAME *table,         \
                                       uint32_t k) {                            \
-    int64_t idx = hash_table_##NAME##__lookup(table, k);                       \
+    struct hash_table_##NAME *in;                                              \
+    int64_t idx = hash_table_##NAME##__lookup(table, k, &in);                  \
                                                                                \
     if (idx < 0) {                                                             \
       return NULL;                                                             \
     }                                                                          \
                                                                                \
-    return &table->elems[idx].val;                                             \
+    return &in->elems[idx].val;                                                \
   }                                                                            \
                                                                                \
   bool hash_table_##NAME##_delete(struct hash_table_##NAME *table,             \
                                   uint32_t k) {                                \
-    int64_t idx = hash_table_##NAME##__lookup(table, k);                       \
+    hash_table_##NAME##_migrate(table, hash_table_migrate_step);               \
                                                                                \
-    if (idx < 0) {                                                             \
+    struct hash_table_##NAME *in;                                              \
+    int64_t found = hash_table_##NAME##__lookup(table, k, &in);                \
+                                                                               \
+    if (found < 0) {                                                           \
       return false;                                                            \
     }                                                                          \
                                                                                \
-    hash_table_##NAME##__mark_deleted(table, idx);                             \
+    uint32_t idx = found;                                                      \
+                                                                               \
+    /* backward shift: pull the following elements of the cluster back one     \
+     * slot until one is already in its home bucket (or the slot is empty),    \
+     * the table stays as if the element had never been inserted */            \
+    for (;;) {                                                                 \
+      uint32_t next = (idx + 1) & in->mask;                                    \
+      uint32_t next_hash = in->elems[next].hash;                               \
+                                                                               \
+      if (!next_hash ||                                                        \
+          !hash_table_##NAME##__max_probes(in, next_hash, next)) {             \
+        break;                                                                 \
+      }                                                                        \
+                                                                               \
+      in->elems[idx] = in->elems[next];                                        \
+      idx = next;                                                              \
+    }                                                                          \
+                                                                               \
+    in->elems[idx].hash = 0;                                                   \
+    if (in != table) {                                                         \
+      in->num_elems--;                                                         \
+    }                                                                          \
     table->num_elems--;                                                        \
     return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* grow once so `n` elements fit without growing again */                    \
+  void hash_table_##NAME##_reserve(struct hash_table_##NAME *table,            \
+                                   uint32_t n) {                               \
+    uint64_t new_cap = table->cap;                                             \
+                                                                               \
+    while ((new_cap * hash_table_load_factor_to_grow) / 100 <= n) {            \
+      new_cap *= 2;                                                            \
+    }                                                                          \
+                                                                               \
+    if (new_cap > UINT32_MAX) {                                                \
+      RUNTIME_ERROR("Can't reserve room for %u elements", n);                  \
+    }                                                                          \
+                                                                               \
+    if (new_cap > table->cap) {                                                \
+      hash_table_##NAME##__resize(table, new_cap);                             \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* sized once, then inserted in order of home bucket so the probes sweep     \
+   * through the table instead of jumping around it. The sort keeps repeated   \
+   * keys in order, the last value wins */                                     \
+  void hash_table_##NAME##_insert_many(struct hash_table_##NAME *table,        \
+                                       const uint32_t *keys,                   \
+                                       const VALTYPE *vals, uint32_t n) {      \
+    hash_table_##NAME##_reserve(table, table->num_elems + n);                  \
+                                                                               \
+    size_t order_size = n * sizeof(struct hash_table_bucket_order);            \
+    struct hash_table_bucket_order *unsorted =                                 \
+        allocator_alloc(table->alloc, order_size);                             \
+    struct hash_table_bucket_order *order =                                    \
+        allocator_alloc(table->alloc, order_size);                             \
+                                                                               \
+    for (uint32_t i = 0; i < n; i++) {                                         \
+      unsorted[i] = (struct hash_table_bucket_order){                          \
+          hash_table_##NAME##__fix_hash(                                       \
+              hash_table_##NAME##__hash_fun(keys[i])),                         \
+          i};                                                                  \
+    }                                                                          \
+                                                                               \
+    hash_table_sort_by_bucket(unsorted, order, n, table->cap, table->alloc);   \
+    allocator_free(table->alloc, unsorted, order_size);                        \
+                                                                               \
+    for (uint32_t i = 0; i < n; i++) {                                         \
+      uint32_t src = order[i].src;                                             \
+      struct hash_table_##NAME *in;                                            \
+      int64_t found = hash_table_##NAME##__lookup(table, keys[src], &in);      \
+                                                                               \
+      if (found >= 0) {                                                        \
+        in->elems[found].val = vals[src];                                      \
+        continue;                                                              \
+      }                                                                        \
+                                                                               \
+      hash_table_##NAME##__insert(table,                                       \
+                                  (struct hash_table_##NAME##_elem){           \
+                                      order[i].hash, keys[src], vals[src]});   \
+      table->num_elems++;                                                      \
+    }                                                                          \
+    allocator_free(table->alloc, order, order_size);                           \
+  }                                                                            \
+                                                                               \
+  /* the buckets are written as they are, a grow in progress is finished       \
+   * first */                                                                  \
+  void hash_table_##NAME##_snapshot_write(struct hash_table_##NAME *table,     \
+                                          struct snapshot_writer *w) {         \
+    hash_table_##NAME##_migrate(table, UINT32_MAX);                            \
+                                                                               \
+    uint32_t header[2] = {table->num_elems, table->cap};                       \
+    snapshot_write(w, header, sizeof(header));                                 \
+    snapshot_write(w, table->elems,                                            \
+                   (uint64_t)table->cap *                                      \
+                       sizeof(struct hash_table_##NAME##_elem));               \
+  }                                                                            \
+                                                                               \
+  void hash_table_##NAME##_snapshot_read(struct hash_table_##NAME *table,      \
+                                         struct snapshot_reader *r) {          \
+    const uint32_t *header = snapshot_read(r, 2 * sizeof(uint32_t));           \
+                                                                               \
+    /* lookups mask with cap - 1 */                                            \
+    if (header == NULL || !header[1] || (header[1] & (header[1] - 1)) ||       \
+        header[0] > header[1]) {                                               \
+      r->failed = true;                                                        \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    uint32_t num_elems = header[0];                                            \
+    uint32_t cap = header[1];                                                  \
+    struct hash_table_##NAME##_elem *elems = snapshot_read_array(              \
+        r, table->alloc, sizeof(struct hash_table_##NAME##_elem), cap, cap);   \
+                                                                               \
+    if (elems == NULL) {                                                       \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    hash_table_##NAME##_free(table);                                           \
+    table->elems = elems;                                                      \
+    table->num_elems = num_elems;                                              \
+    table->cap = cap;                                                          \
+    table->mask = cap - 1;                                                     \
+    table->resize_thresh =                                                     \
+        ((uint64_t)cap * hash_table_load_factor_to_grow) / 100;                \
+    table->old = NULL;                                                         \
+    table->migrate_start = 0;                                                  \
+    table->num_migrated = 0;                                                   \
+  }                                                                            \
+                                                                               \
+  /* every value's distance from its home bucket, in the table it's in */      \
+  void hash_table_##NAME##_stats(struct hash_table_##NAME *table,              \
+                                 struct storage_stats *stats) {                \
+    struct hash_table_##NAME *tables[2] = {table, table->old};                 \
+                                                                               \
+    for (uint32_t t = 0; t < 2 && tables[t] != NULL; t++) {                    \
+      struct hash_table_##NAME *in = tables[t];                                \
+                                                                               \
+      for (uint32_t idx = 0; idx < in->cap; idx++) {                           \
+        if (in->elems[idx].hash) {                                             \
+          storage_stats_add_probe(                                             \
+              stats,                                                           \
+              hash_table_##NAME##__max_probes(in, in->elems[idx].hash, idx));  \
+        }                                                                      \
+      }                                                                        \
+                                                                               \
+      stats->cap += in->cap;                                                   \
+      stats->bytes += in->cap * sizeof(struct hash_table_##NAME##_elem);       \
+    }                                                                          \
+                                                                               \
+    stats->num_elems = table->num_elems;                                       \
+    stats->grows = table->num_grows;                                           \
+    storage_stats_finish(stats);                                               \
   }
 
 #endif // __HASH_H_
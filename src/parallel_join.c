@@ -0,0 +1,65 @@
+#include <stdlib.h>
+
+#include "change.h"
+#include "parallel_join.h"
+#include "world.h"
+
+// chunks below this many slots cost more to schedule than to run
+static const uint32_t parallel_join_min_chunk = 1024;
+// chunks per worker, so workers that finish early have something to steal
+static const uint32_t parallel_join_chunks_per_worker = 4;
+
+struct parallel_join_chunk {
+  struct parallel_join *join;
+  uint32_t begin;
+  uint32_t end;
+};
+
+static void parallel_join__run_chunk(void *arg, uint32_t worker) {
+  struct parallel_join_chunk *chunk = arg;
+  struct world *prev_world = world_enter(chunk->join->world);
+  uint32_t prev_tick = change_tick_enter(chunk->join->tick);
+  chunk->join->chunk(chunk->join, chunk->begin, chunk->end, worker);
+  change_tick_enter(prev_tick);
+  world_enter(prev_world);
+}
+
+void parallel_join_run(struct parallel_join *join) {
+  struct thread_pool *pool = world_thread_pool();
+  component_join_plan(join->terms, join->num_terms, join->order);
+
+  struct component_join_term *driver = &join->terms[join->order[0]];
+  uint32_t num_slots = driver->ops->num_slots(driver->storage);
+  uint32_t num_workers = thread_pool_num_workers(pool);
+
+  uint32_t chunk_size =
+      num_slots / (num_workers * parallel_join_chunks_per_worker);
+  if (chunk_size < parallel_join_min_chunk) {
+    chunk_size = parallel_join_min_chunk;
+  }
+
+  uint32_t num_chunks = (num_slots + chunk_size - 1) / chunk_size;
+
+  // nothing to split, skip the pool altogether
+  if (num_workers == 1 || num_chunks <= 1) {
+    join->chunk(join, 0, num_slots, thread_pool_current_worker());
+    return;
+  }
+
+  struct parallel_join_chunk *chunks =
+      malloc(num_chunks * sizeof(struct parallel_join_chunk));
+  struct thread_pool_group group = {0};
+  join->tick = change_tick();
+  join->world = world_current();
+
+  for (uint32_t i = 0; i < num_chunks; i++) {
+    uint32_t begin = i * chunk_size;
+    uint32_t end =
+        num_slots - begin < chunk_size ? num_slots : begin + chunk_size;
+    chunks[i] = (struct parallel_join_chunk){join, begin, end};
+    thread_pool_submit(pool, &group, &parallel_join__run_chunk, &chunks[i]);
+  }
+
+  thread_pool_wait(pool, &group);
+  free(chunks);
+}
@@ -0,0 +1,177 @@
+#ifndef __PARALLEL_JOIN_H_
+#define __PARALLEL_JOIN_H_
+
+// Joins whose body runs on the world's thread pool: the slot range of the
+// driving component is split into chunks that the workers steal from each
+// other
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common_macros.h"
+#include "component.h"
+#include "thread_pool.h"
+
+struct parallel_join {
+  struct component_join_term terms[COMPONENT_JOIN_MAX];
+  uint32_t num_terms;
+  uint32_t order[COMPONENT_JOIN_MAX];
+  void (*chunk)(struct parallel_join *join, uint32_t begin, uint32_t end,
+                uint32_t worker);
+  void *ctx;
+  // change tick of the caller, the workers stamp their changes with it
+  uint32_t tick;
+  // world of the caller, the workers run the chunks in it
+  struct world *world;
+};
+
+/**
+ * Plan the join, run its chunks on the current world's pool and return once
+ * every chunk has finished.
+ */
+void parallel_join_run(struct parallel_join *join);
+
+/**
+ * Define a join that runs in parallel, for any number of components (up to
+ * COMPONENT_JOIN_MAX). Must be used at file scope, run it with
+ * RUN_PARALLEL_JOIN.
+ *
+ * The body gets `join_ctx`, the context pointer given to RUN_PARALLEL_JOIN, and
+ * `join_worker`, the index of the worker running it (below
+ * THREAD_POOL_MAX_WORKERS, see DEFINE_REDUCTION). It may run concurrently for
+ * different entities, so it should only write to the entity's own components
+ * and to per worker state.
+ * @param JOB name of the join.
+ * @param COMP_NAMES parenthesized list of components to iterate over.
+ * @param ITER_VAR variable to receive each value of the iteration, see
+ * FOR_JOIN_COMPONENTS.
+ *
+ * Usage:
+ * DEFINE_PARALLEL_JOIN_COMPONENTS(integrate, (position, velocity), d, {
+ *    d.position->x += d.velocity->dx;
+ * });
+ *
+ * REGISTER_SYSTEM(update_positions, { RUN_PARALLEL_JOIN(integrate, NULL); });
+ */
+#define DEFINE_PARALLEL_JOIN_COMPONENTS(JOB, COMP_NAMES, ITER_VAR, ...)        \
+  static void parallel_join_chunk__##JOB(struct parallel_join *join,           \
+                                         uint32_t begin, uint32_t end,         \
+                                         uint32_t join_worker) {               \
+    void *join_ctx = join->ctx;                                                \
+    (void)join_ctx;                                                            \
+    (void)join_worker;                                                         \
+                                                                               \
+    struct component_join_term *component_join_driver =                        \
+        &join->terms[join->order[0]];                                          \
+    for (uint32_t component_join_idx =                                         \
+             component_join_next_slot(component_join_driver, begin);           \
+         component_join_idx < end;                                             \
+         component_join_idx = component_join_next_slot(                        \
+             component_join_driver, component_join_idx + 1)) {                 \
+      uint32_t component_join_key;                                             \
+      void *component_join_vals[COMPONENT_JOIN_MAX];                           \
+      if (!component_join_probe(join->terms, join->num_terms, join->order,     \
+                                component_join_idx, &component_join_key,       \
+                                component_join_vals)) {                        \
+        continue;                                                              \
+      }                                                                        \
+      struct {                                                                 \
+        uint32_t id;                                                           \
+        MACRO_FOR_EACH(FOR_JOIN__MEMBER, MACRO_UNPAREN COMP_NAMES)             \
+      } ITER_VAR = {component_join_key MACRO_FOR_EACH(                         \
+          FOR_JOIN__VALUE, MACRO_UNPAREN COMP_NAMES)};                         \
+      { __VA_ARGS__ }                                                          \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void parallel_join_run__##JOB(void *ctx) {                            \
+    struct component_join_term terms[] = {                                     \
+        MACRO_FOR_EACH(FOR_JOIN__TERM, MACRO_UNPAREN COMP_NAMES)};             \
+    struct parallel_join join = {                                              \
+        .num_terms = sizeof(terms) / sizeof(terms[0]),                         \
+        .chunk = &parallel_join_chunk__##JOB,                                  \
+        .ctx = ctx,                                                            \
+    };                                                                         \
+    memcpy(join.terms, terms, sizeof(terms));                                  \
+    parallel_join_run(&join);                                                  \
+  }
+
+#define DEFINE_PARALLEL_JOIN_COMPONENT_1(JOB, COMP_NAME, ITER_VAR, ...)        \
+  DEFINE_PARALLEL_JOIN_COMPONENTS(JOB, (COMP_NAME), ITER_VAR, __VA_ARGS__)
+
+#define DEFINE_PARALLEL_JOIN_COMPONENT_2(JOB, COMP_NAME_0, COMP_NAME_1,        \
+                                         ITER_VAR, ...)                        \
+  DEFINE_PARALLEL_JOIN_COMPONENTS(JOB, (COMP_NAME_0, COMP_NAME_1), ITER_VAR,   \
+                                  __VA_ARGS__)
+
+#define DEFINE_PARALLEL_JOIN_COMPONENT_3(JOB, COMP_NAME_0, COMP_NAME_1,        \
+                                         COMP_NAME_2, ITER_VAR, ...)           \
+  DEFINE_PARALLEL_JOIN_COMPONENTS(                                             \
+      JOB, (COMP_NAME_0, COMP_NAME_1, COMP_NAME_2), ITER_VAR, __VA_ARGS__)
+
+/**
+ * Run a join defined with DEFINE_PARALLEL_JOIN_COMPONENTS, returns once every
+ * entity has been visited.
+ */
+#define RUN_PARALLEL_JOIN(JOB, CTX) parallel_join_run__##JOB(CTX)
+
+/**
+ * Define a per worker reduction of `TYPE` values, every worker accumulates
+ * into its own cache line and the partial results are only combined at the
+ * end.
+ *
+ * Usage:
+ * DEFINE_REDUCTION(int64_t, i64);
+ *
+ * struct reduction_i64 total;
+ * reduction_i64_init(&total, 0, &reduction_i64_sum);
+ * // in the body of a parallel join:
+ * reduction_i64_add(join_ctx, join_worker, d.health->hp);
+ * // once the join returns:
+ * int64_t sum = reduction_i64_result(&total);
+ */
+#define DEFINE_REDUCTION(TYPE, NAME)                                           \
+  struct reduction_##NAME {                                                    \
+    struct {                                                                   \
+      TYPE val;                                                                \
+    } __attribute__((aligned(64))) slots[THREAD_POOL_MAX_WORKERS];             \
+    TYPE (*combine)(TYPE a, TYPE b);                                           \
+  };                                                                           \
+                                                                               \
+  static inline void reduction_##NAME##_init(                                  \
+      struct reduction_##NAME *r, TYPE identity,                               \
+      TYPE (*combine)(TYPE a, TYPE b)) {                                       \
+    for (uint32_t i = 0; i < THREAD_POOL_MAX_WORKERS; i++) {                   \
+      r->slots[i].val = identity;                                              \
+    }                                                                          \
+    r->combine = combine;                                                      \
+  }                                                                            \
+                                                                               \
+  /* the worker's own accumulator, for updating it in place */                 \
+  static inline TYPE *reduction_##NAME##_local(struct reduction_##NAME *r,     \
+                                               uint32_t worker) {              \
+    return &r->slots[worker].val;                                              \
+  }                                                                            \
+                                                                               \
+  static inline void reduction_##NAME##_add(struct reduction_##NAME *r,        \
+                                            uint32_t worker, TYPE val) {       \
+    r->slots[worker].val = r->combine(r->slots[worker].val, val);              \
+  }                                                                            \
+                                                                               \
+  static inline TYPE reduction_##NAME##_result(struct reduction_##NAME *r) {   \
+    TYPE result = r->slots[0].val;                                             \
+    for (uint32_t i = 1; i < THREAD_POOL_MAX_WORKERS; i++) {                   \
+      result = r->combine(result, r->slots[i].val);                            \
+    }                                                                          \
+    return result;                                                             \
+  }                                                                            \
+                                                                               \
+  static inline TYPE reduction_##NAME##_sum(TYPE a, TYPE b) { return a + b; }  \
+  static inline TYPE reduction_##NAME##_min(TYPE a, TYPE b) {                  \
+    return b < a ? b : a;                                                      \
+  }                                                                            \
+  static inline TYPE reduction_##NAME##_max(TYPE a, TYPE b) {                  \
+    return b > a ? b : a;                                                      \
+  }
+
+#endif // __PARALLEL_JOIN_H_
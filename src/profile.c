@@ -0,0 +1,293 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "system.h"
+#include "thread_pool.h"
+#include "world.h"
+
+#ifdef ECS_PROFILE
+
+_Static_assert((PROFILE_RING_EVENTS & (PROFILE_RING_EVENTS - 1)) == 0,
+               "PROFILE_RING_EVENTS must be a power of two");
+
+struct profile_event {
+  // NULL for a whole frame
+  const struct system_def *def;
+  // world the system ran in, frames are counted per world
+  const struct world *world;
+  uint64_t frame;
+  uint64_t start;
+  uint64_t end;
+};
+
+struct profile_ring {
+  struct profile_event events[PROFILE_RING_EVENTS];
+  // events ever recorded, the ring holds the last PROFILE_RING_EVENTS of them
+  uint64_t head;
+  // events folded into the statistics so far
+  uint64_t folded;
+  uint32_t tid;
+  uint32_t worker;
+  struct profile_ring *next;
+};
+
+struct profile_system {
+  const struct system_def *def;
+  // run times in profile_now units, the last PROFILE_WINDOW of them
+  uint64_t runs[PROFILE_WINDOW];
+  uint64_t num_runs;
+};
+
+// guards the list of rings and the statistics, recording takes no lock
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct profile_ring *profile_rings;
+static uint32_t profile_num_rings;
+static _Thread_local struct profile_ring *profile__ring;
+
+static struct profile_system *profile_systems;
+static uint32_t profile_num_systems;
+
+// a CLOCK_MONOTONIC time and the timestamp taken with it, timestamps are
+// converted along the line from there to the time of the conversion
+static uint64_t profile_base_ns;
+static uint64_t profile_base;
+
+static uint64_t profile__monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static double profile__ns_per_tick(void) {
+  uint64_t now = profile_now();
+  uint64_t now_ns = profile__monotonic_ns();
+
+  if (now <= profile_base || now_ns <= profile_base_ns) {
+    return 1.0;
+  }
+
+  return (double)(now_ns - profile_base_ns) / (double)(now - profile_base);
+}
+
+static struct profile_ring *profile__new_ring(void) {
+  struct profile_ring *ring = calloc(1, sizeof(struct profile_ring));
+  ring->worker = thread_pool_current_worker();
+
+  pthread_mutex_lock(&profile_lock);
+  if (profile_base_ns == 0) {
+    profile_base = profile_now();
+    profile_base_ns = profile__monotonic_ns();
+  }
+
+  ring->tid = profile_num_rings++;
+  ring->next = profile_rings;
+  profile_rings = ring;
+  pthread_mutex_unlock(&profile_lock);
+
+  return ring;
+}
+
+void profile_record(const struct system_def *def, uint64_t start,
+                    uint64_t end) {
+  struct profile_ring *ring = profile__ring;
+
+  if (ring == NULL) {
+    ring = profile__ring = profile__new_ring();
+  }
+
+  ring->events[ring->head & (PROFILE_RING_EVENTS - 1)] =
+      (struct profile_event){def, world_current(), system_frame(), start, end};
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static struct profile_system *profile__system(const struct system_def *def) {
+  for (uint32_t i = 0; i < profile_num_systems; i++) {
+    if (profile_systems[i].def == def) {
+      return &profile_systems[i];
+    }
+  }
+
+  profile_systems = realloc(profile_systems, (profile_num_systems + 1) *
+                                                 sizeof(struct profile_system));
+  struct profile_system *system = &profile_systems[profile_num_systems++];
+  memset(system, 0, sizeof(struct profile_system));
+  system->def = def;
+  return system;
+}
+
+// first event of `ring` that hasn't been overwritten
+static uint64_t profile__oldest(struct profile_ring *ring, uint64_t head) {
+  return head > PROFILE_RING_EVENTS ? head - PROFILE_RING_EVENTS : 0;
+}
+
+// add the runs recorded into `ring` since the last fold to the statistics,
+// under profile_lock
+static void profile__fold(struct profile_ring *ring) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t oldest = profile__oldest(ring, head);
+
+  for (uint64_t i = ring->folded > oldest ? ring->folded : oldest; i < head;
+       i++) {
+    struct profile_event *e = &ring->events[i & (PROFILE_RING_EVENTS - 1)];
+
+    if (e->def != NULL) {
+      struct profile_system *system = profile__system(e->def);
+      system->runs[system->num_runs++ % PROFILE_WINDOW] = e->end - e->start;
+    }
+  }
+
+  ring->folded = head;
+}
+
+void profile_frame_end(uint64_t start) {
+  profile_record(NULL, start, profile_now());
+
+  // every ring, the current world's systems may have run on any thread. Runs
+  // of other worlds are whole events too, they're folded along.
+  pthread_mutex_lock(&profile_lock);
+
+  for (struct profile_ring *ring = profile_rings; ring; ring = ring->next) {
+    profile__fold(ring);
+  }
+
+  pthread_mutex_unlock(&profile_lock);
+}
+
+void profile_thread_exit(void) {
+  struct profile_ring *ring = profile__ring;
+
+  if (ring == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&profile_lock);
+  // runs since the last frame ended would be lost with the ring
+  profile__fold(ring);
+
+  struct profile_ring **link = &profile_rings;
+  while (*link != ring) {
+    link = &(*link)->next;
+  }
+  *link = ring->next;
+  pthread_mutex_unlock(&profile_lock);
+
+  free(ring);
+  profile__ring = NULL;
+}
+
+static int profile__compare_u64(const void *a, const void *b) {
+  uint64_t ua = *(const uint64_t *)a;
+  uint64_t ub = *(const uint64_t *)b;
+  return (ua > ub) - (ua < ub);
+}
+
+bool profile_system_stats(const char *name, struct profile_stats *stats) {
+  uint64_t runs[PROFILE_WINDOW];
+  uint32_t num_runs = 0;
+
+  pthread_mutex_lock(&profile_lock);
+
+  for (uint32_t i = 0; i < profile_num_systems; i++) {
+    struct profile_system *system = &profile_systems[i];
+
+    if (!strcmp(system->def->name, name)) {
+      num_runs = system->num_runs < PROFILE_WINDOW ? system->num_runs
+                                                   : PROFILE_WINDOW;
+      memcpy(runs, system->runs, num_runs * sizeof(uint64_t));
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&profile_lock);
+
+  if (num_runs == 0) {
+    return false;
+  }
+
+  double ns_per_tick = profile__ns_per_tick();
+  uint64_t total = 0;
+  qsort(runs, num_runs, sizeof(uint64_t), &profile__compare_u64);
+
+  for (uint32_t i = 0; i < num_runs; i++) {
+    total += runs[i];
+  }
+
+  *stats = (struct profile_stats){
+      .num_runs = num_runs,
+      .min_ns = runs[0] * ns_per_tick,
+      .avg_ns = total * ns_per_tick / num_runs,
+      .p99_ns = runs[(num_runs - 1) * 99 / 100] * ns_per_tick,
+      .max_ns = runs[num_runs - 1] * ns_per_tick,
+  };
+  return true;
+}
+
+bool profile_write_trace(const char *path, uint32_t num_frames) {
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL) {
+    return false;
+  }
+
+  const struct world *world = world_current();
+  uint64_t frame = system_frame();
+  uint64_t first_frame = frame > num_frames ? frame - num_frames : 0;
+
+  pthread_mutex_lock(&profile_lock);
+
+  double ns_per_tick = profile__ns_per_tick();
+  const char *sep = "";
+
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+  for (struct profile_ring *ring = profile_rings; ring; ring = ring->next) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    fprintf(f,
+            "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+            "\"args\":{\"name\":\"worker %u\"}}",
+            sep, ring->tid, ring->worker);
+    sep = ",";
+
+    for (uint64_t i = profile__oldest(ring, head); i < head; i++) {
+      struct profile_event *e = &ring->events[i & (PROFILE_RING_EVENTS - 1)];
+
+      if (e->world != world || e->frame < first_frame || e->frame >= frame) {
+        continue;
+      }
+
+      // trace timestamps are in microseconds
+      double start_ns =
+          profile_base_ns + ((double)e->start - profile_base) * ns_per_tick;
+      fprintf(f,
+              ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+              "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%u,"
+              "\"frame\":%lu}}",
+              e->def ? e->def->name : "frame", e->def ? "system" : "frame",
+              ring->tid, start_ns / 1000.0,
+              (e->end - e->start) * ns_per_tick / 1000.0,
+              e->def ? e->def->id : 0,
+              e->frame);
+    }
+  }
+
+  pthread_mutex_unlock(&profile_lock);
+
+  fprintf(f, "\n]}\n");
+  return fclose(f) == 0;
+}
+
+#else
+
+bool profile_system_stats(const char *name, struct profile_stats *stats) {
+  return false;
+}
+
+bool profile_write_trace(const char *path, uint32_t num_frames) {
+  return false;
+}
+
+#endif // ECS_PROFILE
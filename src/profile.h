@@ -0,0 +1,104 @@
+#ifndef __PROFILE_H_
+#define __PROFILE_H_
+
+// Per system timing, built in with -DECS_PROFILE: run_systems records when
+// every system started and ended into a ring buffer of the thread it ran on,
+// keeps rolling statistics of each system's run time and can write the last
+// frames as a Chrome trace (chrome://tracing, Perfetto). Without ECS_PROFILE
+// nothing is recorded and the functions below report having nothing.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+struct system_def;
+
+// events each thread keeps, older ones are overwritten
+#ifndef PROFILE_RING_EVENTS
+#define PROFILE_RING_EVENTS (1u << 15)
+#endif
+
+// runs of a system the statistics are over
+#ifndef PROFILE_WINDOW
+#define PROFILE_WINDOW 256
+#endif
+
+struct profile_stats {
+  // runs the statistics are over, up to PROFILE_WINDOW
+  uint32_t num_runs;
+  uint64_t min_ns;
+  uint64_t avg_ns;
+  uint64_t p99_ns;
+  uint64_t max_ns;
+};
+
+/**
+ * Statistics of the last runs of the system called `name`, in any world,
+ * returns false if it hasn't run (or profiling is off).
+ */
+bool profile_system_stats(const char *name, struct profile_stats *stats);
+
+/**
+ * Write the systems that ran in the current world's last `num_frames` frames
+ * (as far as the ring buffers go back) to `path` as a Chrome trace_event JSON
+ * file. Returns false if the file couldn't be written or profiling is off.
+ *
+ * Must be called outside of run_systems.
+ */
+bool profile_write_trace(const char *path, uint32_t num_frames);
+
+#ifdef ECS_PROFILE
+
+/**
+ * Timestamp events are recorded with. On x86-64 it's the (invariant) TSC,
+ * about half the cost of clock_gettime, converted to CLOCK_MONOTONIC ns when
+ * read back. Elsewhere it's CLOCK_MONOTONIC ns.
+ */
+static inline uint64_t profile_now(void) {
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * Record a run of `def` on the calling thread, NULL for a whole frame, in the
+ * current world's running frame. Times are profile_now timestamps.
+ */
+void profile_record(const struct system_def *def, uint64_t start,
+                    uint64_t end);
+
+/**
+ * End the frame that started at `start`, folding the runs recorded during it
+ * into the statistics. Called by run_systems once no system is running.
+ */
+void profile_frame_end(uint64_t start);
+
+/**
+ * Fold the calling thread's ring buffer into the statistics and drop it.
+ * Called by the workers of a thread pool as the pool shuts down.
+ */
+void profile_thread_exit(void);
+
+#define PROFILE_START(VAR) uint64_t VAR = profile_now()
+#define PROFILE_SYSTEM(DEF, START) profile_record((DEF), (START), profile_now())
+#define PROFILE_FRAME_END(START) profile_frame_end(START)
+#define PROFILE_THREAD_EXIT() profile_thread_exit()
+
+#else
+
+#define PROFILE_START(VAR)
+#define PROFILE_SYSTEM(DEF, START)
+#define PROFILE_FRAME_END(START)
+#define PROFILE_THREAD_EXIT()
+
+#endif // ECS_PROFILE
+
+#endif // __PROFILE_H_
@@ -0,0 +1,173 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "query.h"
+#include "world.h"
+
+MAKE_SPARSE_SET(uint8_t, query_members);
+
+// the queries registered in the program, indexed once for every world when
+// one is first used (the component ids are only known once the program runs)
+static struct {
+  pthread_once_t once;
+  // queries matching each component, by component id
+  struct query_def **by_component[COMPONENT_MAX];
+  uint32_t num_by_component[COMPONENT_MAX];
+} queries = {.once = PTHREAD_ONCE_INIT};
+
+struct query_world {
+  bool built;
+  // the matching entities of every query, by query idx
+  struct sparse_set_query_members **members;
+};
+
+// no query may be registered, the section is missing then
+extern struct query_def *__start_query_def_array __attribute__((weak));
+extern struct query_def *__stop_query_def_array __attribute__((weak));
+
+static struct query_def **query__begin(void) {
+  return &__start_query_def_array;
+}
+
+static struct query_def **query__end(void) { return &__stop_query_def_array; }
+
+static uint32_t query__num(void) { return query__end() - query__begin(); }
+
+/**
+ * Index the queries by the components they match.
+ */
+static void query__index(void) {
+  for (uint32_t i = 0; i < query__num(); i++) {
+    struct query_def *query = query__begin()[i];
+    query->idx = i;
+
+    for (const uint32_t *const *id = query->ids; *id != NULL; id++) {
+      component_signature_set(&query->signature, **id);
+      queries.by_component[**id] =
+          realloc(queries.by_component[**id],
+                  (queries.num_by_component[**id] + 1) *
+                      sizeof(struct query_def *));
+      queries.by_component[**id][queries.num_by_component[**id]++] = query;
+    }
+  }
+}
+
+void query__world_init(struct world *world) {
+  world->queries = calloc(1, sizeof(struct query_world));
+  world->queries->members =
+      calloc(query__num(), sizeof(struct sparse_set_query_members *));
+}
+
+void query__world_free(struct world *world) {
+  struct query_world *state = world->queries;
+
+  for (uint32_t i = 0; i < query__num(); i++) {
+    if (state->members[i] != NULL) {
+      sparse_set_query_members_free(state->members[i]);
+      free(state->members[i]);
+    }
+  }
+
+  free(state->members);
+  free(state);
+}
+
+static void query__match(uint32_t ent_id,
+                         const struct component_signature *signature,
+                         void *arg) {
+  struct query_world *state = arg;
+
+  for (struct query_def **q = query__begin(); q != query__end(); q++) {
+    if (component_signature_contains(signature, &(*q)->signature)) {
+      sparse_set_query_members_insert(state->members[(*q)->idx], ent_id, 0);
+    }
+  }
+}
+
+/**
+ * Match every query against every entity of the current world, under the
+ * component lock so the signatures hold still and the hooks wait.
+ */
+static void query__build(struct query_world *state) {
+  pthread_once(&queries.once, &query__index);
+
+  for (uint32_t i = 0; i < query__num(); i++) {
+    if (state->members[i] != NULL) {
+      sparse_set_query_members_free(state->members[i]);
+      free(state->members[i]);
+    }
+    state->members[i] = sparse_set_query_members_new();
+  }
+
+  component_for_each_entity(&query__match, state);
+  __atomic_store_n(&state->built, true, __ATOMIC_RELEASE);
+}
+
+struct sparse_set_query_members *query_members(struct query_def *query) {
+  struct query_world *state = world_current()->queries;
+
+  // systems that don't conflict may use their queries first at the same
+  // time, only one of them builds
+  if (!__atomic_load_n(&state->built, __ATOMIC_ACQUIRE)) {
+    component__lock();
+    if (!state->built) {
+      query__build(state);
+    }
+    component__unlock();
+  }
+
+  return state->members[query->idx];
+}
+
+uint32_t query_count(struct query_def *query) {
+  return query_members(query)->num_elems;
+}
+
+void query__component_added(uint32_t ent_id, uint32_t component_id,
+                            const struct component_signature *signature) {
+  struct query_world *state = world_current()->queries;
+
+  if (!state->built) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < queries.num_by_component[component_id]; i++) {
+    struct query_def *query = queries.by_component[component_id][i];
+
+    if (component_signature_contains(signature, &query->signature)) {
+      sparse_set_query_members_insert(state->members[query->idx], ent_id, 0);
+    }
+  }
+}
+
+void query__component_removed(uint32_t ent_id, uint32_t component_id) {
+  struct query_world *state = world_current()->queries;
+
+  if (!state->built) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < queries.num_by_component[component_id]; i++) {
+    struct query_def *query = queries.by_component[component_id][i];
+    sparse_set_query_members_delete(state->members[query->idx], ent_id);
+  }
+}
+
+void query__entity_deleted(uint32_t ent_id,
+                           const struct component_signature *signature) {
+  struct query_world *state = world_current()->queries;
+
+  if (!state->built) {
+    return;
+  }
+
+  for (struct query_def **q = query__begin(); q != query__end(); q++) {
+    if (component_signature_contains(signature, &(*q)->signature)) {
+      sparse_set_query_members_delete(state->members[(*q)->idx], ent_id);
+    }
+  }
+}
+
+void query__invalidate(void) {
+  __atomic_store_n(&world_current()->queries->built, false, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,109 @@
+#ifndef __QUERY_H_
+#define __QUERY_H_
+
+// Cached queries: the entities that have every one of a set of components,
+// kept in a packed list that's updated as components are added and deleted,
+// so iterating a query only touches the entities that match it
+
+#include <stdint.h>
+
+#include "common_macros.h"
+#include "component.h"
+#include "sparse_set.h"
+
+DEFINE_SPARSE_SET(uint8_t, query_members);
+
+struct query_def {
+  const char *const name;
+  // ids of the components matched, NULL terminated
+  const uint32_t *const *const ids;
+  // set when the queries are first indexed, the same in every world
+  struct component_signature signature;
+  uint32_t idx;
+};
+
+#define QUERY__ID(I, COMP_NAME) &COMP_NAME.id,
+#define QUERY__FILL(I, COMP_NAME)                                              \
+  iter->COMP_NAME =                                                            \
+      component_##COMP_NAME##__lookup(COMPONENT_STORAGE(COMP_NAME), ent_id);
+
+/**
+ * Register a query of the entities that have all of the given components (up
+ * to 8), usage:
+ *
+ * REGISTER_QUERY(movers, (position, velocity));
+ *
+ * Queries are registered like systems and kept up to date from then on, see
+ * FOR_QUERY.
+ */
+#define REGISTER_QUERY(NAME, COMP_NAMES)                                       \
+  static const uint32_t *const query_ids__##NAME[] = {                         \
+      MACRO_FOR_EACH(QUERY__ID, MACRO_UNPAREN COMP_NAMES) NULL};               \
+  static struct query_def NAME = {.name = #NAME, .ids = query_ids__##NAME};    \
+  static struct query_def *query_ptr__##NAME                                   \
+      __attribute__((used, section("query_def_array"))) = &NAME;               \
+                                                                               \
+  struct query_##NAME##_iter {                                                 \
+    uint32_t id;                                                               \
+    MACRO_FOR_EACH(FOR_JOIN__MEMBER, MACRO_UNPAREN COMP_NAMES)                 \
+  };                                                                           \
+                                                                               \
+  static inline void query_##NAME##__fill(struct query_##NAME##_iter *iter,    \
+                                          uint32_t ent_id) {                   \
+    iter->id = ent_id;                                                         \
+    MACRO_FOR_EACH(QUERY__FILL, MACRO_UNPAREN COMP_NAMES)                      \
+  }
+
+/**
+ * Iterate over the entities matching a query registered with REGISTER_QUERY.
+ * `ITER_VAR` is a `struct {uint32_t id; COMP_TYPE_0 *COMP_NAME_0; ...}` like
+ * the joins'.
+ *
+ * Entities are visited last to first, so the body can delete the components
+ * of the entity it's visiting. Matches added meanwhile aren't visited.
+ *
+ * Usage:
+ * FOR_QUERY(movers, m, {
+ *    m.position->x += m.velocity->dx;
+ * });
+ */
+#define FOR_QUERY(NAME, ITER_VAR, ...)                                         \
+  do {                                                                         \
+    struct sparse_set_query_members *query_set = query_members(&NAME);         \
+    for (uint32_t query_idx = query_set->num_elems; query_idx-- > 0;) {        \
+      if (query_idx >= query_set->num_elems) {                                 \
+        continue;                                                              \
+      }                                                                        \
+      struct query_##NAME##_iter ITER_VAR;                                     \
+      query_##NAME##__fill(&ITER_VAR, query_set->keys[query_idx]);             \
+      { __VA_ARGS__ }                                                          \
+    }                                                                          \
+  } while (0)
+
+/**
+ * The entities matching `query` in the current world (the set's keys are
+ * packed), matching them against every entity the first time a query is used
+ * in the world.
+ */
+struct sparse_set_query_members *query_members(struct query_def *query);
+
+/**
+ * Number of entities matching `query`.
+ */
+uint32_t query_count(struct query_def *query);
+
+// keep the queries in sync with the entities' components, called by
+// component.c as the signatures change
+void query__component_added(uint32_t ent_id, uint32_t component_id,
+                            const struct component_signature *signature);
+void query__component_removed(uint32_t ent_id, uint32_t component_id);
+void query__entity_deleted(uint32_t ent_id,
+                           const struct component_signature *signature);
+// match every query again on next use, after the signatures were replaced
+void query__invalidate(void);
+
+// the queries' matches in a world, created and freed with it (see world.h)
+void query__world_init(struct world *world);
+void query__world_free(struct world *world);
+
+#endif // __QUERY_H_
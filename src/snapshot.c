@@ -0,0 +1,303 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "change.h"
+#include "component.h"
+#include "entity.h"
+#include "snapshot.h"
+
+// "SECS" in a little endian file
+static const uint32_t snapshot_magic = 0x53434553;
+static const uint32_t snapshot_version = 1;
+
+static uint64_t snapshot__padding(uint64_t size) { return (8 - size % 8) % 8; }
+
+void snapshot_write(struct snapshot_writer *w, const void *data,
+                    uint64_t size) {
+  static const uint8_t zeros[8];
+  uint64_t padding = snapshot__padding(size);
+
+  if (w->failed) {
+    return;
+  }
+
+  w->num_records++;
+
+  if (fwrite(&size, sizeof(size), 1, w->file) != 1 ||
+      fwrite(data, 1, size, w->file) != size ||
+      fwrite(zeros, 1, padding, w->file) != padding) {
+    w->failed = true;
+  }
+}
+
+// size of the next record, which starts at the current offset. Fails the
+// reader if the file ends before the record does.
+static bool snapshot__record_size(struct snapshot_reader *r, uint64_t *size) {
+  if (r->failed || r->size - r->offset < sizeof(*size)) {
+    r->failed = true;
+    return false;
+  }
+
+  memcpy(size, r->data + r->offset, sizeof(*size));
+
+  if (r->size - r->offset - sizeof(*size) < *size) {
+    r->failed = true;
+    return false;
+  }
+
+  return true;
+}
+
+static const void *snapshot__next(struct snapshot_reader *r, uint64_t size) {
+  const void *data = r->data + r->offset + sizeof(uint64_t);
+  r->offset += sizeof(uint64_t) + size + snapshot__padding(size);
+
+  if (r->offset > r->size) {
+    r->offset = r->size;
+  }
+
+  return data;
+}
+
+const void *snapshot_read(struct snapshot_reader *r, uint64_t size) {
+  uint64_t record_size;
+
+  if (!snapshot__record_size(r, &record_size)) {
+    return NULL;
+  }
+
+  if (record_size != size) {
+    r->failed = true;
+    return NULL;
+  }
+
+  return snapshot__next(r, size);
+}
+
+void *snapshot_read_array(struct snapshot_reader *r,
+                          const struct allocator *alloc, size_t elem_size,
+                          uint32_t count, uint32_t cap) {
+  if (count > cap) {
+    r->failed = true;
+    return NULL;
+  }
+
+  const void *data = snapshot_read(r, (uint64_t)count * elem_size);
+
+  if (data == NULL) {
+    return NULL;
+  }
+
+  void *array = allocator_alloc(alloc, (cap ? cap : 1) * elem_size);
+  memcpy(array, data, count * elem_size);
+  return array;
+}
+
+bool snapshot_save(const char *path) {
+  FILE *file = fopen(path, "wb");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  struct snapshot_writer w = {.file = file};
+  uint32_t header[4] = {snapshot_magic, snapshot_version,
+                        component_registry_num(), change_tick()};
+  snapshot_write(&w, header, sizeof(header));
+
+  entity_snapshot_write(&w);
+
+  for (uint32_t id = 0; id < component_registry_num(); id++) {
+    const struct component_info *info = component_registry_info(id);
+    uint64_t elem_size = info->elem_size;
+
+    // number of records of the component, so a loader that doesn't have it
+    // can skip them
+    long count_pos = ftell(file);
+    uint32_t num_records = 0;
+    snapshot_write(&w, &num_records, sizeof(num_records));
+
+    uint64_t first_record = w.num_records;
+    snapshot_write(&w, info->def->name, strlen(info->def->name) + 1);
+    snapshot_write(&w, &elem_size, sizeof(elem_size));
+    info->snapshot_write(&w);
+    change_snapshot_write(id, &w);
+    num_records = w.num_records - first_record;
+
+    long end = ftell(file);
+    if (fseek(file, count_pos, SEEK_SET) != 0) {
+      w.failed = true;
+    }
+    snapshot_write(&w, &num_records, sizeof(num_records));
+    if (fseek(file, end, SEEK_SET) != 0) {
+      w.failed = true;
+    }
+  }
+
+  component_signatures_snapshot_write(&w);
+
+  bool ok = !w.failed;
+
+  if (fclose(file) != 0) {
+    ok = false;
+  }
+
+  return ok;
+}
+
+static void snapshot__skip(struct snapshot_reader *r, uint64_t num_records) {
+  uint64_t size;
+
+  for (uint64_t record = 0; record < num_records; record++) {
+    if (!snapshot__record_size(r, &size)) {
+      return;
+    }
+
+    snapshot__next(r, size);
+  }
+}
+
+// magic, version, number of components and change tick, NULL if it isn't a
+// snapshot this program can load
+static const uint32_t *snapshot__header(struct snapshot_reader *r) {
+  const uint32_t *header = snapshot_read(r, 4 * sizeof(uint32_t));
+
+  if (header == NULL || header[0] != snapshot_magic ||
+      header[1] != snapshot_version || header[2] > COMPONENT_MAX) {
+    return NULL;
+  }
+
+  return header;
+}
+
+// the records in front of a component's storage: how many records it has,
+// and which component of this program it is, NULL if none. False if they're
+// broken or its values have another size than in this program.
+static bool snapshot__component(struct snapshot_reader *r,
+                                uint32_t *num_records,
+                                const struct component_info **info) {
+  const uint32_t *count = snapshot_read(r, sizeof(uint32_t));
+  uint64_t name_size;
+
+  if (count == NULL || *count < 2 || !snapshot__record_size(r, &name_size)) {
+    return false;
+  }
+
+  const char *name = snapshot__next(r, name_size);
+  const uint64_t *elem_size = snapshot_read(r, sizeof(uint64_t));
+
+  if (elem_size == NULL || name_size == 0 || name[name_size - 1] != '\0') {
+    return false;
+  }
+
+  *num_records = *count;
+  *info = component_registry_find(name);
+  return *info == NULL || (*info)->elem_size == *elem_size;
+}
+
+// walk the whole snapshot without loading anything, so a file that is
+// truncated or doesn't match the program leaves the world as it was
+static bool snapshot__check(struct snapshot_reader r) {
+  const uint32_t *header = snapshot__header(&r);
+
+  if (header == NULL) {
+    return false;
+  }
+
+  entity_snapshot_skip(&r);
+
+  for (uint32_t i = 0; i < header[2] && !r.failed; i++) {
+    uint32_t num_records;
+    const struct component_info *info;
+
+    if (!snapshot__component(&r, &num_records, &info)) {
+      return false;
+    }
+
+    snapshot__skip(&r, num_records - 2);
+  }
+
+  // the signatures are the rest of the file
+  while (!r.failed && r.offset < r.size) {
+    snapshot__skip(&r, 1);
+  }
+
+  return !r.failed;
+}
+
+static bool snapshot__load(struct snapshot_reader *r) {
+  if (!snapshot__check(*r)) {
+    return false;
+  }
+
+  const uint32_t *header = snapshot__header(r);
+  uint32_t num_components = header[2];
+  change_tick_reset(header[3]);
+
+  // id of every component of the snapshot in this program
+  uint32_t id_map[COMPONENT_MAX];
+
+  entity_snapshot_read(r);
+
+  for (uint32_t i = 0; i < num_components && !r->failed; i++) {
+    uint32_t num_records;
+    const struct component_info *info;
+
+    if (!snapshot__component(r, &num_records, &info)) {
+      return false;
+    }
+
+    id_map[i] = info ? info->def->id : UINT32_MAX;
+
+    if (info == NULL) {
+      // not in this program, skip its storage and change records
+      snapshot__skip(r, num_records - 2);
+      continue;
+    }
+
+    info->snapshot_read(r);
+    change_snapshot_read(info->def->id, r);
+  }
+
+  if (r->failed) {
+    return false;
+  }
+
+  component_signatures_snapshot_read(r, id_map, num_components);
+  return !r->failed;
+}
+
+bool snapshot_load(const char *path) {
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  // private mapping: the arrays are copied out of the page cache in bulk,
+  // writes to the mapping would never reach the file
+  const uint8_t *data =
+      mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  struct snapshot_reader r = {.data = data, .size = st.st_size};
+  bool ok = snapshot__load(&r);
+
+  munmap((void *)data, st.st_size);
+  return ok;
+}
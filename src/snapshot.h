@@ -0,0 +1,71 @@
+#ifndef __SNAPSHOT_H_
+#define __SNAPSHOT_H_
+
+// Binary snapshots of the whole world: entities, and every component's storage
+// with its arrays written as they are in memory. Loading maps the file and
+// copies the arrays back in bulk, nothing is inserted or rehashed.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "allocator.h"
+
+struct snapshot_writer {
+  FILE *file;
+  uint64_t num_records;
+  bool failed;
+};
+
+/**
+ * A mapped snapshot, records are read front to back. Once a read fails every
+ * read after it fails too.
+ */
+struct snapshot_reader {
+  const uint8_t *data;
+  uint64_t size;
+  uint64_t offset;
+  bool failed;
+};
+
+/**
+ * Write a record of `size` bytes, records start 8 byte aligned in the file.
+ */
+void snapshot_write(struct snapshot_writer *w, const void *data, uint64_t size);
+
+/**
+ * Read the next record, it has to be `size` bytes long. Returns a pointer into
+ * the mapping, valid until the load returns, or NULL and fails the reader if
+ * the file is truncated or the record has another size.
+ */
+const void *snapshot_read(struct snapshot_reader *r, uint64_t size);
+
+/**
+ * Read the next record of `count` elements of `elem_size` into a new array of
+ * `cap` elements from `alloc`, `cap` >= `count`. Returns NULL like
+ * snapshot_read, nothing is allocated then. Storages read all their records
+ * before they replace their arrays, so a failed read leaves them as they were.
+ */
+void *snapshot_read_array(struct snapshot_reader *r,
+                          const struct allocator *alloc, size_t elem_size,
+                          uint32_t count, uint32_t cap);
+
+/**
+ * Save every entity and the values of every registered component to `path`.
+ * Returns false if the file couldn't be written.
+ */
+bool snapshot_save(const char *path);
+
+/**
+ * Load a snapshot written by snapshot_save, into a world that has no entities
+ * yet. Components are matched by name, their value sizes have to match and
+ * components the program doesn't register are skipped. Returns false if the
+ * file couldn't be read, is truncated, isn't a snapshot of this version or a
+ * value size doesn't match, the world is left as it was then. A storage whose
+ * layout changed since the save can still fail the load halfway, loading only
+ * part of the world. The values themselves aren't checked, the file has to
+ * come from snapshot_save.
+ */
+bool snapshot_load(const char *path);
+
+#endif // __SNAPSHOT_H_
@@ -0,0 +1,336 @@
+#ifndef __SPARSE_SET_H_
+#define __SPARSE_SET_H_
+
+// A sparse set implementation: a paged sparse index keyed by entity index that
+// points into packed (dense) arrays of keys and values
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "common_macros.h"
+#include "entity.h"
+#include "snapshot.h"
+#include "storage_stats.h"
+
+static const uint32_t sparse_set_initial_cap = 16;
+static const uint32_t sparse_set_page_bits = 12;
+static const uint32_t sparse_set_page_size = 1u << 12;
+static const uint32_t sparse_set_page_mask = (1u << 12) - 1;
+static const uint32_t sparse_set_empty = UINT32_MAX;
+
+#define SPARSE_SET_ITER(NAME, KEY_NAME, VAL_NAME, SET, ...)                    \
+  for (uint32_t sparse_set_##NAME##_iter_idx = 0;                              \
+       sparse_set_##NAME##_iter_idx < (SET)->num_elems;                        \
+       sparse_set_##NAME##_iter_idx++) {                                       \
+    uint32_t KEY_NAME = (SET)->keys[sparse_set_##NAME##_iter_idx];             \
+    typeof(&(SET)->vals[0]) VAL_NAME =                                         \
+        &(SET)->vals[sparse_set_##NAME##_iter_idx];                            \
+    { __VA_ARGS__ }                                                            \
+  }
+
+#define DEFINE_SPARSE_SET(VALTYPE, NAME)                                       \
+  struct sparse_set_##NAME {                                                   \
+    uint32_t **pages;                                                          \
+    uint32_t num_pages;                                                        \
+    uint32_t *keys;                                                            \
+    VALTYPE *vals;                                                             \
+    uint32_t num_elems;                                                        \
+    uint32_t cap;                                                              \
+    uint64_t num_grows;                                                        \
+    const struct allocator *alloc;                                             \
+  };                                                                           \
+  struct sparse_set_##NAME *sparse_set_##NAME##_new();                         \
+  struct sparse_set_##NAME *sparse_set_##NAME##_new_with_allocator(            \
+      const struct allocator *alloc);                                          \
+  void sparse_set_##NAME##_free(struct sparse_set_##NAME *set);                \
+  void sparse_set_##NAME##_insert(struct sparse_set_##NAME *set, uint32_t k,   \
+                                  VALTYPE v);                                  \
+  bool sparse_set_##NAME##_delete(struct sparse_set_##NAME *set, uint32_t k);  \
+  void sparse_set_##NAME##_reserve(struct sparse_set_##NAME *set, uint32_t n); \
+  void sparse_set_##NAME##_insert_many(struct sparse_set_##NAME *set,          \
+                                       const uint32_t *keys,                   \
+                                       const VALTYPE *vals, uint32_t n);       \
+  void sparse_set_##NAME##_snapshot_write(struct sparse_set_##NAME *set,       \
+                                          struct snapshot_writer *w);          \
+  void sparse_set_##NAME##_snapshot_read(struct sparse_set_##NAME *set,        \
+                                         struct snapshot_reader *r);           \
+  void sparse_set_##NAME##_stats(struct sparse_set_##NAME *set,                \
+                                 struct storage_stats *stats);                 \
+                                                                               \
+  /* index of `k` in the dense arrays, or -1 if it isn't in the set */         \
+  static inline int64_t sparse_set_##NAME##__index(                            \
+      struct sparse_set_##NAME *set, uint32_t k) {                             \
+    uint32_t page = entity_index(k) >> sparse_set_page_bits;                   \
+                                                                               \
+    if (page >= set->num_pages || !set->pages[page]) {                         \
+      return -1;                                                               \
+    }                                                                          \
+                                                                               \
+    uint32_t idx = set->pages[page][k & sparse_set_page_mask];                 \
+                                                                               \
+    /* the entry may belong to an earlier generation of the entity */          \
+    if (idx == sparse_set_empty || set->keys[idx] != k) {                      \
+      return -1;                                                               \
+    }                                                                          \
+                                                                               \
+    return idx;                                                                \
+  }                                                                            \
+                                                                               \
+  static inline VALTYPE *sparse_set_##NAME##_lookup(                           \
+      struct sparse_set_##NAME *set, uint32_t k) {                             \
+    int64_t idx = sparse_set_##NAME##__index(set, k);                          \
+                                                                               \
+    if (idx < 0) {                                                             \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    return &set->vals[idx];                                                    \
+  }                                                                            \
+                                                                               \
+  /* slots are the dense indices, every one of them holds a value */           \
+  static inline uint32_t sparse_set_##NAME##_num_slots(                        \
+      struct sparse_set_##NAME *set) {                                         \
+    return set->num_elems;                                                     \
+  }                                                                            \
+                                                                               \
+  static inline VALTYPE *sparse_set_##NAME##_slot(                             \
+      struct sparse_set_##NAME *set, uint32_t idx, uint32_t *key) {            \
+    *key = set->keys[idx];                                                     \
+    return &set->vals[idx];                                                    \
+  }
+
+#define MAKE_SPARSE_SET(VALTYPE, NAME)                                         \
+  /* sparse entry for the index of `k`, allocating its page if needed */       \
+  static uint32_t *sparse_set_##NAME##__sparse_entry(                          \
+      struct sparse_set_##NAME *set, uint32_t k) {                             \
+    uint32_t page = entity_index(k) >> sparse_set_page_bits;                   \
+                                                                               \
+    if (page >= set->num_pages) {                                              \
+      uint32_t new_num_pages = set->num_pages ? set->num_pages : 1;            \
+      while (new_num_pages <= page) {                                          \
+        new_num_pages *= 2;                                                    \
+      }                                                                        \
+                                                                               \
+      set->pages = allocator_realloc(set->alloc, set->pages,                   \
+                                     set->num_pages * sizeof(uint32_t *),      \
+                                     new_num_pages * sizeof(uint32_t *));      \
+      memset(&set->pages[set->num_pages], 0,                                   \
+             (new_num_pages - set->num_pages) * sizeof(uint32_t *));           \
+      set->num_pages = new_num_pages;                                          \
+    }                                                                          \
+                                                                               \
+    if (!set->pages[page]) {                                                   \
+      set->pages[page] = allocator_alloc(                                      \
+          set->alloc, sparse_set_page_size * sizeof(uint32_t));                \
+      /* every byte 0xff makes every entry sparse_set_empty */                 \
+      memset(set->pages[page], 0xff, sparse_set_page_size * sizeof(uint32_t)); \
+    }                                                                          \
+                                                                               \
+    return &set->pages[page][k & sparse_set_page_mask];                        \
+  }                                                                            \
+                                                                               \
+  static void sparse_set_##NAME##__resize(struct sparse_set_##NAME *set,       \
+                                          uint32_t new_cap) {                  \
+    set->keys = allocator_realloc(set->alloc, set->keys,                       \
+                                  set->cap * sizeof(uint32_t),                 \
+                                  new_cap * sizeof(uint32_t));                 \
+    set->vals = allocator_realloc(set->alloc, set->vals,                       \
+                                  set->cap * sizeof(VALTYPE),                  \
+                                  new_cap * sizeof(VALTYPE));                  \
+    set->num_grows += new_cap > set->cap;                                      \
+    set->cap = new_cap;                                                        \
+  }                                                                            \
+                                                                               \
+  static void sparse_set_##NAME##__grow(struct sparse_set_##NAME *set) {       \
+    sparse_set_##NAME##__resize(set, set->cap * 2);                            \
+  }                                                                            \
+                                                                               \
+  struct sparse_set_##NAME *sparse_set_##NAME##_new_with_allocator(            \
+      const struct allocator *alloc) {                                         \
+    struct sparse_set_##NAME *set =                                            \
+        allocator_alloc(alloc, sizeof(struct sparse_set_##NAME));              \
+    set->alloc = alloc;                                                        \
+    set->pages = NULL;                                                         \
+    set->num_pages = 0;                                                        \
+    set->keys =                                                                \
+        allocator_alloc(alloc, sparse_set_initial_cap * sizeof(uint32_t));     \
+    set->vals =                                                                \
+        allocator_alloc(alloc, sparse_set_initial_cap * sizeof(VALTYPE));      \
+    set->num_elems = 0;                                                        \
+    set->cap = sparse_set_initial_cap;                                         \
+    set->num_grows = 0;                                                        \
+    return set;                                                                \
+  }                                                                            \
+                                                                               \
+  struct sparse_set_##NAME *sparse_set_##NAME##_new() {                        \
+    return sparse_set_##NAME##_new_with_allocator(&allocator_heap);            \
+  }                                                                            \
+                                                                               \
+  void sparse_set_##NAME##_free(struct sparse_set_##NAME *set) {               \
+    for (uint32_t i = 0; i < set->num_pages; i++) {                            \
+      allocator_free(set->alloc, set->pages[i],                                \
+                     sparse_set_page_size * sizeof(uint32_t));                 \
+    }                                                                          \
+    allocator_free(set->alloc, set->pages,                                     \
+                   set->num_pages * sizeof(uint32_t *));                       \
+    allocator_free(set->alloc, set->keys, set->cap * sizeof(uint32_t));        \
+    allocator_free(set->alloc, set->vals, set->cap * sizeof(VALTYPE));         \
+  }                                                                            \
+                                                                               \
+  void sparse_set_##NAME##_insert(struct sparse_set_##NAME *set, uint32_t k,   \
+                                  VALTYPE v) {                                 \
+    uint32_t *entry = sparse_set_##NAME##__sparse_entry(set, k);               \
+                                                                               \
+    /* already present, or left over by a destroyed entity with the same       \
+     * index, overwrite it in place */                                         \
+    if (*entry != sparse_set_empty) {                                          \
+      set->keys[*entry] = k;                                                   \
+      set->vals[*entry] = v;                                                   \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    if (set->num_elems >= set->cap) {                                          \
+      sparse_set_##NAME##__grow(set);                                          \
+    }                                                                          \
+                                                                               \
+    *entry = set->num_elems;                                                   \
+    set->keys[set->num_elems] = k;                                             \
+    set->vals[set->num_elems] = v;                                             \
+    set->num_elems++;                                                          \
+  }                                                                            \
+                                                                               \
+  bool sparse_set_##NAME##_delete(struct sparse_set_##NAME *set, uint32_t k) { \
+    int64_t idx = sparse_set_##NAME##__index(set, k);                          \
+                                                                               \
+    if (idx < 0) {                                                             \
+      return false;                                                            \
+    }                                                                          \
+                                                                               \
+    /* keep the dense arrays packed by moving the last element into the hole   \
+     */                                                                        \
+    uint32_t last = set->num_elems - 1;                                        \
+                                                                               \
+    if (idx != last) {                                                         \
+      set->keys[idx] = set->keys[last];                                        \
+      set->vals[idx] = set->vals[last];                                        \
+      *sparse_set_##NAME##__sparse_entry(set, set->keys[idx]) = idx;           \
+    }                                                                          \
+                                                                               \
+    *sparse_set_##NAME##__sparse_entry(set, k) = sparse_set_empty;             \
+    set->num_elems--;                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* size the dense arrays once so `n` elements fit */                         \
+  void sparse_set_##NAME##_reserve(struct sparse_set_##NAME *set,              \
+                                   uint32_t n) {                               \
+    if (n > set->cap) {                                                        \
+      sparse_set_##NAME##__resize(set, n);                                     \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  void sparse_set_##NAME##_insert_many(struct sparse_set_##NAME *set,          \
+                                       const uint32_t *keys,                   \
+                                       const VALTYPE *vals, uint32_t n) {      \
+    sparse_set_##NAME##_reserve(set, set->num_elems + n);                      \
+                                                                               \
+    for (uint32_t i = 0; i < n; i++) {                                         \
+      sparse_set_##NAME##_insert(set, keys[i], vals[i]);                       \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* which pages exist, then the pages and the dense arrays as they are */     \
+  void sparse_set_##NAME##_snapshot_write(struct sparse_set_##NAME *set,       \
+                                          struct snapshot_writer *w) {         \
+    uint32_t header[3] = {set->num_pages, set->num_elems, set->cap};           \
+    snapshot_write(w, header, sizeof(header));                                 \
+                                                                               \
+    uint8_t *has_page = allocator_alloc(set->alloc, set->num_pages + 1);       \
+    for (uint32_t i = 0; i < set->num_pages; i++) {                            \
+      has_page[i] = set->pages[i] != NULL;                                     \
+    }                                                                          \
+    snapshot_write(w, has_page, set->num_pages);                               \
+    allocator_free(set->alloc, has_page, set->num_pages + 1);                  \
+                                                                               \
+    for (uint32_t i = 0; i < set->num_pages; i++) {                            \
+      if (set->pages[i]) {                                                     \
+        snapshot_write(w, set->pages[i],                                       \
+                       sparse_set_page_size * sizeof(uint32_t));               \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    snapshot_write(w, set->keys, (uint64_t)set->num_elems * sizeof(uint32_t)); \
+    snapshot_write(w, set->vals, (uint64_t)set->num_elems * sizeof(VALTYPE));  \
+  }                                                                            \
+                                                                               \
+  void sparse_set_##NAME##_snapshot_read(struct sparse_set_##NAME *set,        \
+                                         struct snapshot_reader *r) {          \
+    const uint32_t *header = snapshot_read(r, 3 * sizeof(uint32_t));           \
+                                                                               \
+    if (header == NULL) {                                                      \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    const uint8_t *has_page = snapshot_read(r, header[0]);                     \
+                                                                               \
+    if (has_page == NULL) {                                                    \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    /* read into a new set, the old one is only freed once all of it is */     \
+    struct sparse_set_##NAME read = {                                          \
+        .num_pages = header[0],                                                \
+        .num_elems = header[1],                                                \
+        .cap = header[2],                                                      \
+        .num_grows = set->num_grows,                                           \
+        .alloc = set->alloc,                                                   \
+    };                                                                         \
+    read.pages =                                                               \
+        allocator_calloc(set->alloc, read.num_pages * sizeof(uint32_t *));     \
+                                                                               \
+    for (uint32_t i = 0; i < read.num_pages; i++) {                            \
+      if (has_page[i]) {                                                       \
+        read.pages[i] =                                                        \
+            snapshot_read_array(r, set->alloc, sizeof(uint32_t),               \
+                                sparse_set_page_size, sparse_set_page_size);   \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    read.keys = snapshot_read_array(r, set->alloc, sizeof(uint32_t),           \
+                                    read.num_elems, read.cap);                 \
+    read.vals = snapshot_read_array(r, set->alloc, sizeof(VALTYPE),            \
+                                    read.num_elems, read.cap);                 \
+                                                                               \
+    if (r->failed) {                                                           \
+      sparse_set_##NAME##_free(&read);                                         \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    sparse_set_##NAME##_free(set);                                             \
+    *set = read;                                                               \
+  }                                                                            \
+                                                                               \
+  /* lookups index the page directly, every value is at distance 0 */          \
+  void sparse_set_##NAME##_stats(struct sparse_set_##NAME *set,                \
+                                 struct storage_stats *stats) {                \
+    uint32_t num_allocated_pages = 0;                                          \
+                                                                               \
+    for (uint32_t i = 0; i < set->num_pages; i++) {                            \
+      num_allocated_pages += set->pages[i] != NULL;                            \
+    }                                                                          \
+                                                                               \
+    stats->num_elems = set->num_elems;                                         \
+    stats->cap = set->cap;                                                     \
+    stats->probe_histogram[0] = set->num_elems;                                \
+    stats->bytes = set->num_pages * sizeof(uint32_t *) +                       \
+                   (size_t)num_allocated_pages * sparse_set_page_size *        \
+                       sizeof(uint32_t) +                                      \
+                   set->cap * (sizeof(uint32_t) + sizeof(VALTYPE));            \
+    stats->grows = set->num_grows;                                             \
+    storage_stats_finish(stats);                                               \
+  }
+
+#endif // __SPARSE_SET_H_
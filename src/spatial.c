@@ -0,0 +1,678 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "change.h"
+#include "common_macros.h"
+#include "component.h"
+#include "hash_table.h"
+#include "sparse_set.h"
+#include "spatial.h"
+#include "vec.h"
+#include "world.h"
+
+static const uint32_t spatial_none = UINT32_MAX;
+static const uint32_t spatial_bucket_initial_cap = 8;
+// entities a quadtree node holds before it splits
+static const uint32_t spatial_node_capacity = 16;
+// cell coordinates are clamped to this, so far away or infinite positions
+// still get a cell
+static const float spatial_cell_limit = 1 << 30;
+
+struct spatial_entry {
+  uint32_t ent_id;
+  struct spatial_point pos;
+};
+
+// where the entry of an entity is
+struct spatial_slot {
+  uint32_t bucket;
+  uint32_t idx;
+};
+
+DEFINE_VECTOR(struct spatial_entry, spatial_entries);
+MAKE_VECTOR(struct spatial_entry, spatial_entries);
+DEFINE_VECTOR(uint32_t, spatial_u32);
+MAKE_VECTOR(uint32_t, spatial_u32);
+DEFINE_SPARSE_SET(struct spatial_slot, spatial_slots);
+MAKE_SPARSE_SET(struct spatial_slot, spatial_slots);
+DEFINE_HASH(uint32_t, spatial_cells);
+MAKE_HASH(uint32_t, spatial_cells);
+
+struct spatial_node {
+  // center of the node's box and half its side, the node holds the entities
+  // in a box twice as big
+  struct spatial_point center;
+  float half;
+  uint32_t depth;
+  // first of the 4 children, one per quadrant, 0 for leaves (node 0 is the
+  // root)
+  uint32_t children;
+};
+
+struct spatial_index {
+  // the world the component's values and change lists are in
+  struct world *world;
+  uint32_t component_id;
+  spatial_position_fn position;
+  // changes after this tick haven't been indexed yet
+  uint32_t last_tick;
+  uint32_t num_entities;
+  struct sparse_set_spatial_slots *slots;
+  // the entries of every cell or node
+  struct vector_spatial_entries *buckets;
+  uint32_t num_buckets;
+  uint32_t cap_buckets;
+  bool quadtree;
+  // grid: bucket of every cell with entities, and the buckets of the cells
+  // that emptied
+  float cell_size;
+  float inv_cell_size;
+  struct hash_table_spatial_cells *cells;
+  struct vector_spatial_u32 free_buckets;
+  // quadtree: node of every bucket
+  struct spatial_node *nodes;
+  struct spatial_node root;
+};
+
+static uint32_t spatial__new_bucket(struct spatial_index *index) {
+  if (!index->quadtree && index->free_buckets.length > 0) {
+    return vector_spatial_u32_pop(&index->free_buckets);
+  }
+
+  if (index->num_buckets == index->cap_buckets) {
+    index->cap_buckets = index->cap_buckets ? index->cap_buckets * 2 : 16;
+    index->buckets =
+        realloc(index->buckets,
+                index->cap_buckets * sizeof(struct vector_spatial_entries));
+
+    if (index->quadtree) {
+      index->nodes = realloc(index->nodes,
+                             index->cap_buckets * sizeof(struct spatial_node));
+    }
+  }
+
+  index->buckets[index->num_buckets] =
+      vector_spatial_entries_new(spatial_bucket_initial_cap);
+  return index->num_buckets++;
+}
+
+static void spatial__init_buckets(struct spatial_index *index) {
+  index->slots = sparse_set_spatial_slots_new();
+
+  if (index->quadtree) {
+    uint32_t root = spatial__new_bucket(index);
+    index->nodes[root] = index->root;
+  } else {
+    index->cells = hash_table_spatial_cells_new();
+    index->free_buckets = vector_spatial_u32_new(spatial_bucket_initial_cap);
+  }
+}
+
+static void spatial__free_buckets(struct spatial_index *index) {
+  for (uint32_t i = 0; i < index->num_buckets; i++) {
+    vector_spatial_entries_free(&index->buckets[i]);
+  }
+
+  free(index->buckets);
+  free(index->nodes);
+  sparse_set_spatial_slots_free(index->slots);
+  free(index->slots);
+
+  if (!index->quadtree) {
+    hash_table_spatial_cells_free(index->cells);
+    free(index->cells);
+    vector_spatial_u32_free(&index->free_buckets);
+  }
+
+  index->buckets = NULL;
+  index->nodes = NULL;
+  index->num_buckets = 0;
+  index->cap_buckets = 0;
+  index->num_entities = 0;
+}
+
+static int32_t spatial__cell(const struct spatial_index *index, float v) {
+  float cell = floorf(v * index->inv_cell_size);
+
+  // NaN fails both and goes to the lowest cell
+  if (!(cell >= -spatial_cell_limit)) {
+    cell = -spatial_cell_limit;
+  } else if (cell > spatial_cell_limit) {
+    cell = spatial_cell_limit;
+  }
+
+  return (int32_t)cell;
+}
+
+static uint32_t spatial__cell_key(int32_t x, int32_t y) {
+  return (uint32_t)(uint16_t)x | (uint32_t)(uint16_t)y << 16;
+}
+
+static uint32_t spatial__pos_key(const struct spatial_index *index,
+                                 struct spatial_point pos) {
+  return spatial__cell_key(spatial__cell(index, pos.x),
+                           spatial__cell(index, pos.y));
+}
+
+// whether `pos` is in the box of `node` grown `scale` times
+static bool spatial__node_contains(const struct spatial_node *node,
+                                   struct spatial_point pos, float scale) {
+  return fabsf(pos.x - node->center.x) <= node->half * scale &&
+         fabsf(pos.y - node->center.y) <= node->half * scale;
+}
+
+// whether the box of the entities `node` holds overlaps the box from `min` to
+// `max`
+static bool spatial__node_overlaps(const struct spatial_node *node,
+                                   struct spatial_point min,
+                                   struct spatial_point max) {
+  float loose = node->half * 2;
+  return min.x <= node->center.x + loose && max.x >= node->center.x - loose &&
+         min.y <= node->center.y + loose && max.y >= node->center.y - loose;
+}
+
+static uint32_t spatial__quadrant(const struct spatial_node *node,
+                                  struct spatial_point pos) {
+  return (pos.x >= node->center.x) | (pos.y >= node->center.y) << 1;
+}
+
+static void spatial__push(struct spatial_index *index, uint32_t bucket,
+                          struct spatial_entry entry) {
+  uint32_t idx = vector_spatial_entries_push(&index->buckets[bucket], entry);
+  sparse_set_spatial_slots_insert(index->slots, entry.ent_id,
+                                  (struct spatial_slot){bucket, idx});
+}
+
+// drop the entry at `idx`, the last one of the bucket takes its place
+static void spatial__remove_at(struct spatial_index *index, uint32_t bucket,
+                               uint32_t idx) {
+  struct vector_spatial_entries *entries = &index->buckets[bucket];
+  struct spatial_entry last = entries->data[--entries->length];
+
+  if (idx < entries->length) {
+    entries->data[idx] = last;
+    sparse_set_spatial_slots_lookup(index->slots, last.ent_id)->idx = idx;
+  }
+}
+
+/**
+ * Give a leaf 4 children and move its entries down to them, except those that
+ * are only in its loose box.
+ */
+static void spatial__split(struct spatial_index *index, uint32_t node) {
+  if (index->nodes[node].children ||
+      index->buckets[node].length <= spatial_node_capacity ||
+      index->nodes[node].depth >= SPATIAL_MAX_DEPTH) {
+    return;
+  }
+
+  // never reused, so the children's buckets follow each other
+  uint32_t first = spatial__new_bucket(index);
+  for (uint32_t i = 1; i < 4; i++) {
+    spatial__new_bucket(index);
+  }
+
+  struct spatial_node *parent = &index->nodes[node];
+  float quarter = parent->half / 2;
+
+  for (uint32_t i = 0; i < 4; i++) {
+    index->nodes[first + i] = (struct spatial_node){
+        .center = {parent->center.x + (i & 1 ? quarter : -quarter),
+                   parent->center.y + (i & 2 ? quarter : -quarter)},
+        .half = quarter,
+        .depth = parent->depth + 1,
+    };
+  }
+
+  parent->children = first;
+  struct vector_spatial_entries *entries = &index->buckets[node];
+
+  for (uint32_t i = 0; i < entries->length;) {
+    struct spatial_entry entry = entries->data[i];
+
+    if (!spatial__node_contains(parent, entry.pos, 1)) {
+      i++;
+      continue;
+    }
+
+    spatial__remove_at(index, node, i);
+    spatial__push(index, first + spatial__quadrant(parent, entry.pos), entry);
+  }
+
+  for (uint32_t i = 0; i < 4; i++) {
+    spatial__split(index, first + i);
+  }
+}
+
+static void spatial__insert(struct spatial_index *index,
+                            struct spatial_entry entry) {
+  index->num_entities++;
+
+  if (!index->quadtree) {
+    uint32_t key = spatial__pos_key(index, entry.pos);
+    uint32_t *found = hash_table_spatial_cells_lookup(index->cells, key);
+    uint32_t bucket;
+
+    if (found != NULL) {
+      bucket = *found;
+    } else {
+      bucket = spatial__new_bucket(index);
+      hash_table_spatial_cells_insert(index->cells, key, bucket);
+    }
+
+    spatial__push(index, bucket, entry);
+    return;
+  }
+
+  // entities outside of the root's box stay in it
+  uint32_t node = 0;
+  if (spatial__node_contains(&index->nodes[0], entry.pos, 1)) {
+    while (index->nodes[node].children) {
+      node = index->nodes[node].children +
+             spatial__quadrant(&index->nodes[node], entry.pos);
+    }
+  }
+
+  spatial__push(index, node, entry);
+  spatial__split(index, node);
+}
+
+static void spatial__remove(struct spatial_index *index, uint32_t ent_id) {
+  struct spatial_slot *found =
+      sparse_set_spatial_slots_lookup(index->slots, ent_id);
+
+  if (found == NULL) {
+    return;
+  }
+
+  struct spatial_slot slot = *found;
+  struct spatial_point pos = index->buckets[slot.bucket].data[slot.idx].pos;
+  sparse_set_spatial_slots_delete(index->slots, ent_id);
+  spatial__remove_at(index, slot.bucket, slot.idx);
+  index->num_entities--;
+
+  // empty cells are dropped, so the table only holds the occupied ones
+  if (!index->quadtree && index->buckets[slot.bucket].length == 0) {
+    hash_table_spatial_cells_delete(index->cells,
+                                    spatial__pos_key(index, pos));
+    vector_spatial_u32_push(&index->free_buckets, slot.bucket);
+  }
+}
+
+// whether an entity that moved from `from` to `to` can keep its entry
+static bool spatial__stays(const struct spatial_index *index, uint32_t bucket,
+                           struct spatial_point from, struct spatial_point to) {
+  if (!index->quadtree) {
+    return spatial__pos_key(index, from) == spatial__pos_key(index, to);
+  }
+
+  return spatial__node_contains(&index->nodes[bucket], to, 2) ||
+         (bucket == 0 && !spatial__node_contains(&index->nodes[0], to, 1));
+}
+
+static void spatial__place(struct spatial_index *index, uint32_t ent_id,
+                           struct spatial_point pos) {
+  struct spatial_slot *slot =
+      sparse_set_spatial_slots_lookup(index->slots, ent_id);
+
+  if (slot != NULL) {
+    struct spatial_entry *entry = &index->buckets[slot->bucket].data[slot->idx];
+
+    if (spatial__stays(index, slot->bucket, entry->pos, pos)) {
+      entry->pos = pos;
+      return;
+    }
+
+    spatial__remove(index, ent_id);
+  }
+
+  spatial__insert(index, (struct spatial_entry){ent_id, pos});
+}
+
+static void spatial__on_removed(uint32_t component_id, uint32_t ent_id,
+                                void *ctx) {
+  struct spatial_index *index = ctx;
+
+  if (component_id == index->component_id) {
+    spatial__remove(index, ent_id);
+  }
+}
+
+static struct spatial_index *spatial__new(uint32_t component_id,
+                                          spatial_position_fn position) {
+  struct spatial_index *index = calloc(1, sizeof(struct spatial_index));
+  index->world = world_current();
+  index->component_id = component_id;
+  index->position = position;
+  change_watch_removed(&spatial__on_removed, index);
+  return index;
+}
+
+struct spatial_index *spatial_grid_new(uint32_t component_id,
+                                       spatial_position_fn position,
+                                       float cell_size) {
+  if (!(cell_size > 0)) {
+    RUNTIME_ERROR("Spatial grid cells must have a positive size, got %f",
+                  cell_size);
+  }
+
+  struct spatial_index *index = spatial__new(component_id, position);
+  index->cell_size = cell_size;
+  index->inv_cell_size = 1 / cell_size;
+  spatial__init_buckets(index);
+  return index;
+}
+
+struct spatial_index *spatial_quadtree_new(uint32_t component_id,
+                                           spatial_position_fn position,
+                                           struct spatial_point min,
+                                           struct spatial_point max) {
+  if (!(max.x > min.x && max.y > min.y)) {
+    RUNTIME_ERROR("Spatial quadtree box is empty");
+  }
+
+  struct spatial_index *index = spatial__new(component_id, position);
+  float half_x = (max.x - min.x) / 2;
+  float half_y = (max.y - min.y) / 2;
+
+  index->quadtree = true;
+  index->root = (struct spatial_node){
+      .center = {min.x + half_x, min.y + half_y},
+      .half = half_x > half_y ? half_x : half_y,
+  };
+  spatial__init_buckets(index);
+  return index;
+}
+
+void spatial_index_free(struct spatial_index *index) {
+  struct world *prev = world_enter(index->world);
+  change_unwatch_removed(&spatial__on_removed, index);
+  world_enter(prev);
+
+  spatial__free_buckets(index);
+  free(index);
+}
+
+void spatial_index_update(struct spatial_index *index) {
+  struct world *prev = world_enter(index->world);
+  const struct component_def *def =
+      component_registry_info(index->component_id)->def;
+  uint32_t since = index->last_tick;
+
+  // the current tick may get more changes after this, so it's walked again
+  // next time (placing an entity that didn't move again is cheap)
+  index->last_tick = change_tick() - 1;
+
+  struct change_iter iter;
+  uint32_t ent_id;
+  change_iter_init(&iter, index->component_id, since, false);
+
+  while (change_iter_next(&iter, &ent_id)) {
+    const void *val = def->lookup_value(ent_id);
+
+    if (val != NULL) {
+      spatial__place(index, ent_id, index->position(val));
+    }
+  }
+
+  world_enter(prev);
+}
+
+void spatial_index_reset(struct spatial_index *index) {
+  spatial__free_buckets(index);
+  spatial__init_buckets(index);
+  index->last_tick = 0;
+}
+
+uint32_t spatial_index_num_entities(struct spatial_index *index) {
+  return index->num_entities;
+}
+
+void spatial_iter_box(struct spatial_iter *iter, struct spatial_index *index,
+                      struct spatial_point min, struct spatial_point max) {
+  *iter = (struct spatial_iter){
+      .index = index, .min = min, .max = max, .bucket = spatial_none};
+  bool empty = !(min.x <= max.x && min.y <= max.y);
+
+  if (index->quadtree) {
+    iter->num_stack = empty ? 0 : 1;
+    iter->stack[0] = 0;
+    return;
+  }
+
+  if (empty) {
+    // no cell row to walk
+    iter->cell_min_y = 1;
+    iter->cell_max_y = 0;
+    iter->cell_y = 1;
+    return;
+  }
+
+  iter->cell_min_x = spatial__cell(index, min.x);
+  iter->cell_min_y = spatial__cell(index, min.y);
+  iter->cell_max_x = spatial__cell(index, max.x);
+  iter->cell_max_y = spatial__cell(index, max.y);
+  iter->cell_x = iter->cell_min_x - 1;
+  iter->cell_y = iter->cell_min_y;
+
+  // past 65536 cells a side the keys wrap around and cells would be visited
+  // twice, and past the number of buckets walking them is cheaper anyway
+  int64_t width = (int64_t)iter->cell_max_x - iter->cell_min_x + 1;
+  int64_t height = (int64_t)iter->cell_max_y - iter->cell_min_y + 1;
+  iter->all_buckets = width > UINT16_MAX || height > UINT16_MAX ||
+                      width * height > index->num_buckets;
+}
+
+void spatial_iter_radius(struct spatial_iter *iter,
+                         struct spatial_index *index,
+                         struct spatial_point center, float radius) {
+  spatial_iter_box(iter, index,
+                   (struct spatial_point){center.x - radius, center.y - radius},
+                   (struct spatial_point){center.x + radius, center.y + radius});
+  iter->circle = true;
+  iter->center = center;
+  iter->radius_sq = radius * radius;
+}
+
+static bool spatial__next_bucket(struct spatial_iter *iter) {
+  struct spatial_index *index = iter->index;
+
+  if (index->quadtree) {
+    if (iter->num_stack == 0) {
+      return false;
+    }
+
+    iter->bucket = iter->stack[--iter->num_stack];
+    uint32_t children = index->nodes[iter->bucket].children;
+
+    for (uint32_t i = 0; children && i < 4; i++) {
+      if (spatial__node_overlaps(&index->nodes[children + i], iter->min,
+                                 iter->max)) {
+        iter->stack[iter->num_stack++] = children + i;
+      }
+    }
+
+    return true;
+  }
+
+  if (iter->all_buckets) {
+    iter->bucket = iter->bucket == spatial_none ? 0 : iter->bucket + 1;
+    return iter->bucket < index->num_buckets;
+  }
+
+  for (;;) {
+    if (++iter->cell_x > iter->cell_max_x) {
+      iter->cell_x = iter->cell_min_x;
+      iter->cell_y++;
+    }
+
+    if (iter->cell_y > iter->cell_max_y) {
+      return false;
+    }
+
+    uint32_t *bucket = hash_table_spatial_cells_lookup(
+        index->cells, spatial__cell_key(iter->cell_x, iter->cell_y));
+
+    if (bucket != NULL) {
+      iter->bucket = *bucket;
+      return true;
+    }
+  }
+}
+
+static bool spatial__iter_matches(const struct spatial_iter *iter,
+                                  struct spatial_point pos) {
+  if (!(pos.x >= iter->min.x && pos.x <= iter->max.x &&
+        pos.y >= iter->min.y && pos.y <= iter->max.y)) {
+    return false;
+  }
+
+  float dx = pos.x - iter->center.x;
+  float dy = pos.y - iter->center.y;
+  return !iter->circle || dx * dx + dy * dy <= iter->radius_sq;
+}
+
+bool spatial_iter_next(struct spatial_iter *iter, uint32_t *ent_id,
+                       struct spatial_point *pos) {
+  struct spatial_index *index = iter->index;
+
+  for (;;) {
+    // last to first: removing the entry just returned moves one that was
+    // already visited into its place
+    while (iter->idx > 0) {
+      const struct spatial_entry *entry =
+          &index->buckets[iter->bucket].data[--iter->idx];
+
+      if (spatial__iter_matches(iter, entry->pos)) {
+        *ent_id = entry->ent_id;
+        *pos = entry->pos;
+        return true;
+      }
+    }
+
+    if (!spatial__next_bucket(iter)) {
+      return false;
+    }
+
+    iter->idx = index->buckets[iter->bucket].length;
+  }
+}
+
+struct spatial_candidate {
+  float dist_sq;
+  uint32_t ent_id;
+};
+
+// restore the max heap below `i`
+static void spatial__sift_down(struct spatial_candidate *heap, uint32_t n,
+                               uint32_t i) {
+  for (;;) {
+    uint32_t largest = i;
+    uint32_t left = 2 * i + 1;
+    uint32_t right = left + 1;
+
+    if (left < n && heap[left].dist_sq > heap[largest].dist_sq) {
+      largest = left;
+    }
+
+    if (right < n && heap[right].dist_sq > heap[largest].dist_sq) {
+      largest = right;
+    }
+
+    if (largest == i) {
+      return;
+    }
+
+    struct spatial_candidate tmp = heap[i];
+    heap[i] = heap[largest];
+    heap[largest] = tmp;
+    i = largest;
+  }
+}
+
+static void spatial__sift_up(struct spatial_candidate *heap, uint32_t i) {
+  while (i > 0 && heap[(i - 1) / 2].dist_sq < heap[i].dist_sq) {
+    struct spatial_candidate tmp = heap[i];
+    heap[i] = heap[(i - 1) / 2];
+    heap[(i - 1) / 2] = tmp;
+    i = (i - 1) / 2;
+  }
+}
+
+/**
+ * Radius of the circle that holds `k` entities if they're spread evenly over
+ * the occupied cells, or over the quadtree's box.
+ */
+static float spatial__search_radius(const struct spatial_index *index,
+                                    uint32_t k) {
+  float area;
+
+  if (index->quadtree) {
+    area = 4 * index->root.half * index->root.half;
+  } else {
+    uint32_t num_cells = index->num_buckets - index->free_buckets.length;
+    area = num_cells * index->cell_size * index->cell_size;
+  }
+
+  float radius = sqrtf(area * k / (M_PI * index->num_entities));
+  return radius > 0 ? radius : 1;
+}
+
+uint32_t spatial_nearest(struct spatial_index *index,
+                         struct spatial_point center, uint32_t k,
+                         float max_dist, uint32_t *ent_ids) {
+  if (k == 0 || index->num_entities == 0) {
+    return 0;
+  }
+
+  // the k closest so far, the furthest of them on top
+  struct spatial_candidate *heap =
+      malloc(k * sizeof(struct spatial_candidate));
+  uint32_t num = 0;
+  float radius = spatial__search_radius(index, k);
+
+  // search ever bigger circles until one holds k entities, everything outside
+  // of it is further away than they are
+  for (;;) {
+    radius = radius < max_dist ? radius : max_dist;
+    uint32_t num_seen = 0;
+    num = 0;
+
+    struct spatial_iter iter;
+    uint32_t ent_id;
+    struct spatial_point pos;
+    spatial_iter_radius(&iter, index, center, radius);
+
+    while (spatial_iter_next(&iter, &ent_id, &pos)) {
+      float dx = pos.x - center.x;
+      float dy = pos.y - center.y;
+      struct spatial_candidate candidate = {dx * dx + dy * dy, ent_id};
+      num_seen++;
+
+      if (num < k) {
+        heap[num] = candidate;
+        spatial__sift_up(heap, num++);
+      } else if (candidate.dist_sq < heap[0].dist_sq) {
+        heap[0] = candidate;
+        spatial__sift_down(heap, num, 0);
+      }
+    }
+
+    if (num == k || num_seen == index->num_entities || radius >= max_dist ||
+        isinf(radius)) {
+      break;
+    }
+
+    radius *= 2;
+  }
+
+  // closest first
+  for (uint32_t n = num; n > 0; n--) {
+    ent_ids[n - 1] = heap[0].ent_id;
+    heap[0] = heap[n - 1];
+    spatial__sift_down(heap, n - 1, 0);
+  }
+
+  free(heap);
+  return num;
+}
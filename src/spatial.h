@@ -0,0 +1,187 @@
+#ifndef __SPATIAL_H_
+#define __SPATIAL_H_
+
+// Spatial index over the entities of a position component, for finding the
+// entities near a point without walking all of them. Positions are kept either
+// in a uniform grid, its cells in a hash table keyed by cell, or in a loose
+// quadtree for entities that bunch up. The index follows the component through
+// its change lists, see spatial_index_update
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct spatial_point {
+  float x, y;
+};
+
+/**
+ * Where an entity is, from its value of the indexed component.
+ */
+typedef struct spatial_point (*spatial_position_fn)(const void *val);
+
+/**
+ * Define `spatial_position_COMP_NAME`, reading the position from the fields
+ * `X_FIELD` and `Y_FIELD` of the component's values. Must be used at file
+ * scope.
+ *
+ * Usage:
+ * DEFINE_SPATIAL_POSITION(position, x, y);
+ *
+ * struct spatial_index *near =
+ *     spatial_grid_new(position.id, &spatial_position_position, 64);
+ */
+#define DEFINE_SPATIAL_POSITION(COMP_NAME, X_FIELD, Y_FIELD)                   \
+  static struct spatial_point spatial_position_##COMP_NAME(const void *val) {  \
+    typeof(COMP_NAME.lookup_value(0)) v = (void *)val;                         \
+    return (struct spatial_point){v->X_FIELD, v->Y_FIELD};                     \
+  }
+
+// levels below the quadtree's root, nodes that deep don't split any more
+#define SPATIAL_MAX_DEPTH 16
+
+struct spatial_index;
+
+/**
+ * Index the values of a component in a grid of `cell_size` square cells.
+ * Queries visit every cell they overlap, a cell about the size of the usual
+ * query radius works best. Cells are keyed by their coordinates modulo 65536,
+ * cells further apart share a key but only cost time.
+ *
+ * The index belongs to the current world, it's updated and freed in it.
+ */
+struct spatial_index *spatial_grid_new(uint32_t component_id,
+                                       spatial_position_fn position,
+                                       float cell_size);
+
+/**
+ * Index the values of a component in a loose quadtree over the box from `min`
+ * to `max`. Nodes split once they hold too many entities, and every node holds
+ * the entities in a box twice its size, so an entity only moves to another
+ * node once it has left its own by half the node's size. Entities outside of
+ * the box are kept in the root.
+ */
+struct spatial_index *spatial_quadtree_new(uint32_t component_id,
+                                           spatial_position_fn position,
+                                           struct spatial_point min,
+                                           struct spatial_point max);
+
+void spatial_index_free(struct spatial_index *index);
+
+/**
+ * Catch up with the values added or changed since the previous update, every
+ * value on the first one. Removed values are dropped as they're removed.
+ * Writes through a pointer have to be marked with MARK_CHANGED.
+ *
+ * Must not run concurrently with queries on the index, e.g. update it at the
+ * start of the system that queries it.
+ */
+void spatial_index_update(struct spatial_index *index);
+
+/**
+ * Drop every entity, the next update indexes every value again. Needed after
+ * loading a snapshot.
+ */
+void spatial_index_reset(struct spatial_index *index);
+
+uint32_t spatial_index_num_entities(struct spatial_index *index);
+
+/**
+ * Walks the entities in a box or a circle, as of the last update.
+ */
+struct spatial_iter {
+  struct spatial_index *index;
+  struct spatial_point min;
+  struct spatial_point max;
+  // circles also check the distance to the center
+  bool circle;
+  struct spatial_point center;
+  float radius_sq;
+  // grid: the cells the box overlaps and the current one, or the current
+  // bucket when walking all of them is cheaper
+  bool all_buckets;
+  int32_t cell_min_x, cell_min_y, cell_max_x, cell_max_y;
+  int32_t cell_x, cell_y;
+  // quadtree: nodes left to visit, at most 3 siblings per level
+  uint32_t stack[4 * SPATIAL_MAX_DEPTH];
+  uint32_t num_stack;
+  // bucket being walked, UINT32_MAX before the first one, and how many of
+  // its entries are left
+  uint32_t bucket;
+  uint32_t idx;
+};
+
+/**
+ * Walk the entities whose position is in the box from `min` to `max`,
+ * inclusive.
+ */
+void spatial_iter_box(struct spatial_iter *iter, struct spatial_index *index,
+                      struct spatial_point min, struct spatial_point max);
+
+/**
+ * Walk the entities within `radius` of `center`.
+ */
+void spatial_iter_radius(struct spatial_iter *iter,
+                         struct spatial_index *index,
+                         struct spatial_point center, float radius);
+
+/**
+ * Get the next entity and its position, returns false once there are none
+ * left. Entities come in no particular order. Deleting the indexed component
+ * of the entity just returned is fine, other removals have to be deferred
+ * until the walk is over.
+ */
+bool spatial_iter_next(struct spatial_iter *iter, uint32_t *ent_id,
+                       struct spatial_point *pos);
+
+/**
+ * Find the `k` entities closest to `center`, no further than `max_dist`
+ * (INFINITY for any distance). Writes their ids to `ent_ids` closest first and
+ * returns how many it found.
+ */
+uint32_t spatial_nearest(struct spatial_index *index,
+                         struct spatial_point center, uint32_t k,
+                         float max_dist, uint32_t *ent_ids);
+
+/**
+ * Iterate over the entities within `RADIUS` of `CENTER`.
+ *
+ * @param INDEX the spatial index.
+ * @param CENTER struct spatial_point to search around.
+ * @param RADIUS search radius.
+ * @param ENT_VAR variable to receive the entity id.
+ * @param POS_VAR variable to receive its position.
+ *
+ * The body can delete the indexed component of ENT_VAR, see spatial_iter_next.
+ *
+ * Usage:
+ * FOR_SPATIAL_RADIUS(near, center, 10, other, pos, {
+ *   collide(ent, other);
+ * });
+ */
+#define FOR_SPATIAL_RADIUS(INDEX, CENTER, RADIUS, ENT_VAR, POS_VAR, ...)       \
+  do {                                                                         \
+    struct spatial_iter spatial_iter;                                          \
+    spatial_iter_radius(&spatial_iter, (INDEX), (CENTER), (RADIUS));           \
+    uint32_t ENT_VAR;                                                          \
+    struct spatial_point POS_VAR;                                              \
+    while (spatial_iter_next(&spatial_iter, &ENT_VAR, &POS_VAR)) {             \
+      __VA_ARGS__                                                              \
+    }                                                                          \
+  } while (0)
+
+/**
+ * Iterate over the entities in the box from `MIN` to `MAX`, see
+ * FOR_SPATIAL_RADIUS.
+ */
+#define FOR_SPATIAL_BOX(INDEX, MIN, MAX, ENT_VAR, POS_VAR, ...)                \
+  do {                                                                         \
+    struct spatial_iter spatial_iter;                                          \
+    spatial_iter_box(&spatial_iter, (INDEX), (MIN), (MAX));                    \
+    uint32_t ENT_VAR;                                                          \
+    struct spatial_point POS_VAR;                                              \
+    while (spatial_iter_next(&spatial_iter, &ENT_VAR, &POS_VAR)) {             \
+      __VA_ARGS__                                                              \
+    }                                                                          \
+  } while (0)
+
+#endif // __SPATIAL_H_
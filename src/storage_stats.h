@@ -0,0 +1,69 @@
+#ifndef __STORAGE_STATS_H_
+#define __STORAGE_STATS_H_
+
+// Health of a component storage: how full it is, how far its values sit from
+// where their lookups start, how much memory it holds, and how it's been used
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the last bucket of the probe distance histogram also counts longer ones
+#define STORAGE_STATS_PROBE_BUCKETS 16
+
+struct storage_stats {
+  // storage backend, e.g. "hash_table"
+  const char *storage;
+  uint32_t num_elems;
+  // slots allocated, with the old array of a hash_table being grown
+  uint32_t cap;
+  double load_factor;
+  // deleted slots still taking up room, only group_hash leaves any behind
+  uint32_t tombstones;
+  // values by how many buckets (groups for group_hash) past their home bucket
+  // they sit, 0 for storages that index directly
+  uint32_t probe_histogram[STORAGE_STATS_PROBE_BUCKETS];
+  uint32_t max_probe;
+  double mean_probe;
+  // bytes of the arrays holding the values and their index
+  size_t bytes;
+  // times the storage grew or rehashed
+  uint64_t grows;
+  // lookups of values since the start of the program, and the buckets (or
+  // groups) they looked at
+  uint64_t lookups;
+  uint64_t lookup_probes;
+};
+
+/**
+ * Buckets (or groups) looked at by the calling thread's hash storage probes,
+ * the component layer reads it around its lookups.
+ */
+extern _Thread_local uint64_t storage_probes;
+
+static inline void storage_stats_add_probe(struct storage_stats *stats,
+                                           uint32_t distance) {
+  uint32_t bucket = distance < STORAGE_STATS_PROBE_BUCKETS
+                        ? distance
+                        : STORAGE_STATS_PROBE_BUCKETS - 1;
+  stats->probe_histogram[bucket]++;
+
+  if (distance > stats->max_probe) {
+    stats->max_probe = distance;
+  }
+
+  // summed here, divided in storage_stats_finish
+  stats->mean_probe += distance;
+}
+
+/**
+ * Work out the load factor and mean probe distance, once the storage filled in
+ * the rest.
+ */
+static inline void storage_stats_finish(struct storage_stats *stats) {
+  stats->load_factor =
+      stats->cap ? (double)stats->num_elems / (double)stats->cap : 0;
+  stats->mean_probe = stats->num_elems ? stats->mean_probe / stats->num_elems
+                                       : 0;
+}
+
+#endif // __STORAGE_STATS_H_
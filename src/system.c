@@ -1,17 +1,256 @@
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "archetype.h"
+#include "change.h"
+#include "command_buffer.h"
+#include "profile.h"
 #include "system.h"
+#include "thread_pool.h"
+#include "world.h"
+
+struct system_node {
+  struct system_def *def;
+  // the world the system runs in, whichever worker picks it up
+  struct world *world;
+  bool declared;
+  struct component_signature reads;
+  struct component_signature writes;
+  // number of earlier systems this one has to wait for
+  uint32_t num_deps;
+  // later systems waiting for this one
+  uint32_t *dependents;
+  uint32_t num_dependents;
+  // dependencies left to finish in the current frame
+  uint32_t remaining;
+  // change tick of the system's last run, 0 before the first one
+  uint32_t last_run_tick;
+};
+
+struct system_world {
+  bool built;
+  struct system_node *nodes;
+  uint32_t num_nodes;
+  struct thread_pool_group group;
+  uint64_t frame;
+};
+
+// system running on the calling thread
+static _Thread_local struct system_node *system__running;
+
+void system__world_init(struct world *world) {
+  world->systems = calloc(1, sizeof(struct system_world));
+}
+
+void system__world_free(struct world *world) {
+  struct system_world *schedule = world->systems;
+
+  for (uint32_t i = 0; i < schedule->num_nodes; i++) {
+    free(schedule->nodes[i].dependents);
+  }
+
+  free(schedule->nodes);
+  free(schedule);
+}
+
+static struct system_def **system__begin(void) {
+  extern struct system_def *__start_system_def_array;
+  return &__start_system_def_array;
+}
+
+static struct system_def **system__end(void) {
+  extern struct system_def *__stop_system_def_array;
+  return &__stop_system_def_array;
+}
+
+static void system__signature(struct component_signature *signature,
+                              const uint32_t *const *ids) {
+  *signature = (struct component_signature){0};
+
+  for (; *ids != NULL; ids++) {
+    component_signature_set(signature, **ids);
+  }
+}
+
+// archetype components share their world's tables, adding or deleting one
+// moves the rows of all the others: a write of one is a write of every one
+static void system__widen_archetype_writes(struct component_signature *writes) {
+  bool any = false;
+
+  for (uint32_t id = 0; id < COMPONENT_MAX && !any; id++) {
+    any = component_signature_has(writes, id) && archetype_is_component(id);
+  }
+
+  for (uint32_t id = 0; any && id < COMPONENT_MAX; id++) {
+    if (archetype_is_component(id)) {
+      component_signature_set(writes, id);
+    }
+  }
+}
+
+static bool system__overlaps(const struct component_signature *a,
+                             const struct component_signature *b) {
+  for (uint32_t i = 0; i < COMPONENT_SIGNATURE_WORDS; i++) {
+    if (a->bits[i] & b->bits[i]) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static bool system__conflicts(struct system_node *a, struct system_node *b) {
+  if (!a->declared || !b->declared) {
+    return true;
+  }
+
+  return system__overlaps(&a->writes, &b->reads) ||
+         system__overlaps(&a->writes, &b->writes) ||
+         system__overlaps(&a->reads, &b->writes);
+}
+
+/**
+ * Build the dependency graph of the systems in `world`, every system depends
+ * on the earlier systems it conflicts with.
+ */
+static void system__build_schedule(struct world *world) {
+  struct system_world *schedule = world->systems;
+  schedule->num_nodes = system__end() - system__begin();
+  schedule->nodes = calloc(schedule->num_nodes, sizeof(struct system_node));
+
+  for (uint32_t i = 0; i < schedule->num_nodes; i++) {
+    struct system_node *node = &schedule->nodes[i];
+    node->def = system__begin()[i];
+    node->world = world;
+    node->declared = node->def->reads != NULL && node->def->writes != NULL;
+    node->dependents = malloc(schedule->num_nodes * sizeof(uint32_t));
+
+    if (node->declared) {
+      system__signature(&node->reads, node->def->reads);
+      system__signature(&node->writes, node->def->writes);
+      system__widen_archetype_writes(&node->writes);
+    }
+
+    for (uint32_t j = 0; j < i; j++) {
+      struct system_node *earlier = &schedule->nodes[j];
+
+      if (system__conflicts(earlier, node)) {
+        earlier->dependents[earlier->num_dependents++] = i;
+        node->num_deps++;
+      }
+    }
+  }
+
+  schedule->built = true;
+}
+
+// run a system in its world under a change tick of its own
+static void system__run(struct system_node *node) {
+  struct world *prev_world = world_enter(node->world);
+  uint32_t tick = change_tick_advance();
+  uint32_t prev_tick = change_tick_enter(tick);
+  struct system_node *prev_running = system__running;
+
+  system__running = node;
+  PROFILE_START(start);
+  node->def->cb();
+  PROFILE_SYSTEM(node->def, start);
+  node->last_run_tick = tick;
+
+  system__running = prev_running;
+  change_tick_enter(prev_tick);
+  world_enter(prev_world);
+}
+
+// sync point once every system has run: deferred structural changes land here,
+// stamped with a tick newer than any system's
+static void system__sync(void) {
+  change_tick_advance();
+  command_buffer_flush();
+  change_compact();
+}
+
+static void system__run_node(void *arg, uint32_t worker) {
+  struct system_node *node = arg;
+  struct system_world *schedule = node->world->systems;
+  system__run(node);
+
+  for (uint32_t i = 0; i < node->num_dependents; i++) {
+    struct system_node *dependent = &schedule->nodes[node->dependents[i]];
+
+    if (__atomic_sub_fetch(&dependent->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+      thread_pool_submit(world_thread_pool(), &schedule->group,
+                         &system__run_node, dependent);
+    }
+  }
+}
 
 void run_systems(void) {
-  for (struct system_def **s = ({
-         extern struct system_def *__start_system_def_array;
-         &__start_system_def_array;
-       });
-       s != ({
-         extern struct system_def *__stop_system_def_array;
-         &__stop_system_def_array;
-       });
-       s++) {
-    (*s)->cb();
+  struct world *world = world_current();
+  struct system_world *schedule = world->systems;
+  struct thread_pool *pool = world_thread_pool();
+  PROFILE_START(frame_start);
+
+  if (!schedule->built) {
+    system__build_schedule(world);
   }
+
+  if (thread_pool_num_workers(pool) == 1) {
+    for (uint32_t i = 0; i < schedule->num_nodes; i++) {
+      system__run(&schedule->nodes[i]);
+    }
+
+    system__sync();
+    PROFILE_FRAME_END(frame_start);
+    schedule->frame++;
+    return;
+  }
+
+  for (uint32_t i = 0; i < schedule->num_nodes; i++) {
+    schedule->nodes[i].remaining = schedule->nodes[i].num_deps;
+  }
+
+  for (uint32_t i = 0; i < schedule->num_nodes; i++) {
+    if (schedule->nodes[i].num_deps == 0) {
+      thread_pool_submit(pool, &schedule->group, &system__run_node,
+                         &schedule->nodes[i]);
+    }
+  }
+
+  thread_pool_wait(pool, &schedule->group);
+  system__sync();
+  PROFILE_FRAME_END(frame_start);
+  schedule->frame++;
+}
+
+void run_world_systems(struct world *world) {
+  struct world *prev = world_enter(world);
+  run_systems();
+  world_enter(prev);
+}
+
+uint32_t system_last_run_tick(void) {
+  if (system__running == NULL) {
+    return 0;
+  }
+
+  return system__running->last_run_tick;
+}
+
+uint64_t system_frame(void) { return world_current()->systems->frame; }
+
+bool system_running_declared(void) {
+  return system__running != NULL && system__running->declared;
+}
+
+void system_set_num_workers(uint32_t num_workers) {
+  struct world *world = world_current();
+
+  if (world->pool == NULL) {
+    thread_pool_set_global_workers(num_workers);
+    return;
+  }
+
+  thread_pool_free(world->pool);
+  world->pool = thread_pool_new(num_workers);
 }
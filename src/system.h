@@ -1,9 +1,14 @@
 #ifndef __SYSTEM_H_
 #define __SYSTEM_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "common_macros.h"
+
+struct world;
+
 // Systems of the entity component system
 
 // TODO:
@@ -33,15 +38,93 @@
   /*          sizeof(struct system_def));                                         \ */
   /* } */
 
+#define SYSTEM__ACCESS(I, COMP_NAME) &COMP_NAME.id,
+#define SYSTEM__ACCESS_LIST(...)                                               \
+  __VA_OPT__(MACRO_FOR_EACH(SYSTEM__ACCESS, __VA_ARGS__))
+
+/**
+ * Register a system along with the components it reads and writes, usage:
+ *
+ * REGISTER_SYSTEM_WITH_ACCESS(name, (velocity), (position), {
+ *     FOR_JOIN_COMPONENT_2(position, velocity, d, { ... });
+ * });
+ *
+ * Either list can be empty, `()`. Systems whose accesses don't conflict can run
+ * concurrently, see system_set_num_workers, and may add and delete values of
+ * the components they write. Archetype stored components share their tables,
+ * so writing any of them conflicts with every access to any of them. Entities
+ * have to be destroyed with DEFER_DESTROY_ENTITY. Systems registered with
+ * REGISTER_SYSTEM conflict with every other system.
+ */
+#define REGISTER_SYSTEM_WITH_ACCESS(NAME, READS, WRITES, ...)                  \
+  static void system_callback__##NAME(void) { __VA_ARGS__ }                    \
+  static const uint32_t *const system_reads__##NAME[] = {                      \
+      SYSTEM__ACCESS_LIST READS NULL};                                         \
+  static const uint32_t *const system_writes__##NAME[] = {                     \
+      SYSTEM__ACCESS_LIST WRITES NULL};                                        \
+  static struct system_def NAME = {.name = #NAME,                              \
+                                   .id = __COUNTER__,                          \
+                                   .cb = &system_callback__##NAME,             \
+                                   .reads = system_reads__##NAME,              \
+                                   .writes = system_writes__##NAME};           \
+  static struct system_def *system_ptr__##NAME                                 \
+      __attribute__((used, section("system_def_array"))) = &NAME;
+
 struct system_def {
   const char *const name;
   const uint32_t id;
   void (*const cb)(void);
+  // ids of the components read and written, NULL terminated, both NULL if the
+  // system didn't declare them
+  const uint32_t *const *const reads;
+  const uint32_t *const *const writes;
 };
 
 /**
- * Run all systems in the program.
+ * Run all systems in the program, in the current world.
+ *
+ * Systems that conflict (one writes a component the other reads or writes, or
+ * either didn't declare its accesses) run in registration order, the others
+ * run concurrently on the world's thread pool. Commands the systems deferred
+ * (see DEFER_ADD_VALUE) are applied once they've all run.
  */
 void run_systems(void);
 
+/**
+ * Run all systems in `world`, see run_systems.
+ */
+void run_world_systems(struct world *world);
+
+/**
+ * Change tick the running system last ran at, for asking which values changed
+ * since (see FOR_JOIN_CHANGED_COMPONENTS). 0 on its first run and outside of
+ * systems.
+ *
+ * Every system run gets a tick of its own, changes the system makes are
+ * stamped with it.
+ */
+uint32_t system_last_run_tick(void);
+
+/**
+ * Frames run_systems has finished in the current world, so the index of the
+ * one it's running (or runs next). Every world counts its own.
+ */
+uint64_t system_frame(void);
+
+/**
+ * Whether the calling thread is running a system registered with
+ * REGISTER_SYSTEM_WITH_ACCESS, which may run next to other systems.
+ */
+bool system_running_declared(void);
+
+/**
+ * Set the number of workers the current world's systems run on, 0 for one per
+ * online CPU. With a single worker (the default) systems run one after another
+ * on the calling thread, in registration order.
+ */
+void system_set_num_workers(uint32_t num_workers);
+
+void system__world_init(struct world *world);
+void system__world_free(struct world *world);
+
 #endif // __SYSTEM_H_
@@ -0,0 +1,253 @@
+#ifndef __TAG_SET_H_
+#define __TAG_SET_H_
+
+// Storage for components with no value (tags): a bit per entity index, set if
+// the entity using the index has the tag
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "common_macros.h"
+#include "entity.h"
+#include "snapshot.h"
+#include "storage_stats.h"
+
+static const uint32_t tag_set_word_bits = 64;
+
+/**
+ * Define a set of entities in a bitset indexed by entity index. `VALTYPE` must
+ * be an empty struct, the values have nothing to store and lookups hand out a
+ * pointer that is only good for comparing against NULL.
+ *
+ * The slots of the set are its bits, so the ids of the entities have to be
+ * rebuilt from the indices: only alive entities can be in the set, their
+ * components are deleted before they're destroyed and inserts of dead ones are
+ * ignored.
+ */
+#define DEFINE_TAG_SET(VALTYPE, NAME)                                          \
+  _Static_assert(sizeof(VALTYPE) == 0, "tags can't have values");              \
+                                                                               \
+  struct tag_set_##NAME {                                                      \
+    uint64_t *words;                                                           \
+    uint32_t num_words;                                                        \
+    uint32_t num_elems;                                                        \
+    uint64_t num_grows;                                                        \
+    const struct allocator *alloc;                                             \
+  };                                                                           \
+  struct tag_set_##NAME *tag_set_##NAME##_new();                               \
+  struct tag_set_##NAME *tag_set_##NAME##_new_with_allocator(                  \
+      const struct allocator *alloc);                                          \
+  void tag_set_##NAME##_free(struct tag_set_##NAME *set);                      \
+  void tag_set_##NAME##_insert(struct tag_set_##NAME *set, uint32_t k,         \
+                               VALTYPE v);                                     \
+  bool tag_set_##NAME##_delete(struct tag_set_##NAME *set, uint32_t k);        \
+  void tag_set_##NAME##_reserve(struct tag_set_##NAME *set, uint32_t n);       \
+  void tag_set_##NAME##_insert_many(struct tag_set_##NAME *set,                \
+                                    const uint32_t *keys,                      \
+                                    const VALTYPE *vals, uint32_t n);          \
+  void tag_set_##NAME##_snapshot_write(struct tag_set_##NAME *set,             \
+                                       struct snapshot_writer *w);             \
+  void tag_set_##NAME##_snapshot_read(struct tag_set_##NAME *set,              \
+                                      struct snapshot_reader *r);              \
+  void tag_set_##NAME##_stats(struct tag_set_##NAME *set,                      \
+                              struct storage_stats *stats);                    \
+                                                                               \
+  static inline bool tag_set_##NAME##__has_index(struct tag_set_##NAME *set,   \
+                                                 uint32_t idx) {               \
+    uint32_t word = idx / tag_set_word_bits;                                   \
+    return word < set->num_words &&                                            \
+           (set->words[word] >> (idx % tag_set_word_bits) & 1);                \
+  }                                                                            \
+                                                                               \
+  /* lookup of an id known to be alive, e.g. a key joins probe with: a bit     \
+   * test */                                                                   \
+  static inline VALTYPE *tag_set_##NAME##_probe(struct tag_set_##NAME *set,    \
+                                                uint32_t k) {                  \
+    if (!tag_set_##NAME##__has_index(set, entity_index(k))) {                  \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    return (VALTYPE *)set;                                                     \
+  }                                                                            \
+                                                                               \
+  /* a bit test, then a check that `k` isn't a stale id of the index */        \
+  static inline VALTYPE *tag_set_##NAME##_lookup(struct tag_set_##NAME *set,   \
+                                                 uint32_t k) {                 \
+    if (!tag_set_##NAME##_probe(set, k) || !entity_is_alive(k)) {              \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    return (VALTYPE *)set;                                                     \
+  }                                                                            \
+                                                                               \
+  /* slots are the bits, one per entity index */                               \
+  static inline uint32_t tag_set_##NAME##_num_slots(                           \
+      struct tag_set_##NAME *set) {                                            \
+    return set->num_words * tag_set_word_bits;                                 \
+  }                                                                            \
+                                                                               \
+  static inline VALTYPE *tag_set_##NAME##_slot(struct tag_set_##NAME *set,     \
+                                               uint32_t idx, uint32_t *key) {  \
+    if (!tag_set_##NAME##__has_index(set, idx)) {                              \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    *key = entity_id_at_index(idx);                                            \
+    return (VALTYPE *)set;                                                     \
+  }                                                                            \
+                                                                               \
+  /* first set bit at or after `idx`, a word at a time, or num_slots */        \
+  static inline uint32_t tag_set_##NAME##_next_slot(                           \
+      struct tag_set_##NAME *set, uint32_t idx) {                              \
+    uint32_t word = idx / tag_set_word_bits;                                   \
+                                                                               \
+    if (word >= set->num_words) {                                              \
+      return tag_set_##NAME##_num_slots(set);                                  \
+    }                                                                          \
+                                                                               \
+    uint64_t bits =                                                            \
+        set->words[word] & (UINT64_MAX << idx % tag_set_word_bits);            \
+                                                                               \
+    while (bits == 0) {                                                        \
+      if (++word == set->num_words) {                                          \
+        return tag_set_##NAME##_num_slots(set);                                \
+      }                                                                        \
+      bits = set->words[word];                                                 \
+    }                                                                          \
+                                                                               \
+    return word * tag_set_word_bits + __builtin_ctzll(bits);                   \
+  }
+
+#define MAKE_TAG_SET(VALTYPE, NAME)                                            \
+  /* grow the words so the bit of `idx` is in them */                          \
+  static void tag_set_##NAME##__cover(struct tag_set_##NAME *set,              \
+                                      uint32_t idx) {                          \
+    uint32_t word = idx / tag_set_word_bits;                                   \
+                                                                               \
+    if (word < set->num_words) {                                               \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    uint32_t new_num_words = set->num_words ? set->num_words : 1;              \
+    while (new_num_words <= word) {                                            \
+      new_num_words *= 2;                                                      \
+    }                                                                          \
+                                                                               \
+    set->words = allocator_realloc(set->alloc, set->words,                     \
+                                   set->num_words * sizeof(uint64_t),          \
+                                   new_num_words * sizeof(uint64_t));          \
+    memset(&set->words[set->num_words], 0,                                     \
+           (new_num_words - set->num_words) * sizeof(uint64_t));               \
+    set->num_words = new_num_words;                                            \
+    set->num_grows++;                                                          \
+  }                                                                            \
+                                                                               \
+  struct tag_set_##NAME *tag_set_##NAME##_new_with_allocator(                  \
+      const struct allocator *alloc) {                                         \
+    struct tag_set_##NAME *set =                                               \
+        allocator_alloc(alloc, sizeof(struct tag_set_##NAME));                 \
+    set->alloc = alloc;                                                        \
+    set->words = NULL;                                                         \
+    set->num_words = 0;                                                        \
+    set->num_elems = 0;                                                        \
+    set->num_grows = 0;                                                        \
+    return set;                                                                \
+  }                                                                            \
+                                                                               \
+  struct tag_set_##NAME *tag_set_##NAME##_new() {                              \
+    return tag_set_##NAME##_new_with_allocator(&allocator_heap);               \
+  }                                                                            \
+                                                                               \
+  void tag_set_##NAME##_free(struct tag_set_##NAME *set) {                     \
+    allocator_free(set->alloc, set->words,                                     \
+                   set->num_words * sizeof(uint64_t));                         \
+  }                                                                            \
+                                                                               \
+  /* the bit would tag whichever entity reuses the index */                    \
+  void tag_set_##NAME##_insert(struct tag_set_##NAME *set, uint32_t k,         \
+                               VALTYPE v) {                                    \
+    if (!entity_is_alive(k)) {                                                 \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    uint32_t idx = entity_index(k);                                            \
+    tag_set_##NAME##__cover(set, idx);                                         \
+                                                                               \
+    uint64_t bit = 1ull << idx % tag_set_word_bits;                            \
+    uint64_t *word = &set->words[idx / tag_set_word_bits];                     \
+    set->num_elems += !(*word & bit);                                          \
+    *word |= bit;                                                              \
+  }                                                                            \
+                                                                               \
+  bool tag_set_##NAME##_delete(struct tag_set_##NAME *set, uint32_t k) {       \
+    if (tag_set_##NAME##_lookup(set, k) == NULL) {                             \
+      return false;                                                            \
+    }                                                                          \
+                                                                               \
+    uint32_t idx = entity_index(k);                                            \
+    set->words[idx / tag_set_word_bits] &= ~(1ull << idx % tag_set_word_bits); \
+    set->num_elems--;                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* the bits are indexed by entity, how many there are says nothing about     \
+   * how many words they need */                                               \
+  void tag_set_##NAME##_reserve(struct tag_set_##NAME *set, uint32_t n) {      \
+    (void)set;                                                                 \
+    (void)n;                                                                   \
+  }                                                                            \
+                                                                               \
+  void tag_set_##NAME##_insert_many(struct tag_set_##NAME *set,                \
+                                    const uint32_t *keys,                      \
+                                    const VALTYPE *vals, uint32_t n) {         \
+    for (uint32_t i = 0; i < n; i++) {                                         \
+      tag_set_##NAME##_insert(set, keys[i], (VALTYPE){});                      \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  void tag_set_##NAME##_snapshot_write(struct tag_set_##NAME *set,             \
+                                       struct snapshot_writer *w) {            \
+    uint32_t header[2] = {set->num_words, set->num_elems};                     \
+    snapshot_write(w, header, sizeof(header));                                 \
+    snapshot_write(w, set->words,                                              \
+                   (uint64_t)set->num_words * sizeof(uint64_t));               \
+  }                                                                            \
+                                                                               \
+  void tag_set_##NAME##_snapshot_read(struct tag_set_##NAME *set,              \
+                                      struct snapshot_reader *r) {             \
+    const uint32_t *header = snapshot_read(r, 2 * sizeof(uint32_t));           \
+                                                                               \
+    if (header == NULL) {                                                      \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    uint32_t num_words = header[0];                                            \
+    uint32_t num_elems = header[1];                                            \
+    uint64_t *words = snapshot_read_array(r, set->alloc, sizeof(uint64_t),     \
+                                          num_words, num_words);               \
+                                                                               \
+    if (words == NULL) {                                                       \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    tag_set_##NAME##_free(set);                                                \
+    set->words = words;                                                        \
+    set->num_words = num_words;                                                \
+    set->num_elems = num_elems;                                                \
+  }                                                                            \
+                                                                               \
+  /* lookups index the words directly, every value is at distance 0 */         \
+  void tag_set_##NAME##_stats(struct tag_set_##NAME *set,                      \
+                              struct storage_stats *stats) {                   \
+    stats->num_elems = set->num_elems;                                         \
+    stats->cap = tag_set_##NAME##_num_slots(set);                              \
+    stats->probe_histogram[0] = set->num_elems;                                \
+    stats->bytes = set->num_words * sizeof(uint64_t);                          \
+    stats->grows = set->num_grows;                                             \
+    storage_stats_finish(stats);                                               \
+  }
+
+#endif // __TAG_SET_H_
@@ -0,0 +1,295 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common_macros.h"
+#include "profile.h"
+#include "thread_pool.h"
+
+static const uint32_t thread_pool_initial_deque_cap = 64;
+
+struct thread_pool_task {
+  void (*fn)(void *arg, uint32_t worker);
+  void *arg;
+  struct thread_pool_group *group;
+};
+
+struct thread_pool_deque {
+  pthread_mutex_t lock;
+  struct thread_pool_task *tasks;
+  // oldest task, thieves steal from here
+  uint32_t top;
+  // one past the newest task, the owner pushes and pops here
+  uint32_t bottom;
+  uint32_t cap;
+};
+
+struct thread_pool_worker {
+  struct thread_pool *pool;
+  uint32_t idx;
+  pthread_t thread;
+};
+
+struct thread_pool {
+  uint32_t num_workers;
+  struct thread_pool_deque *deques;
+  struct thread_pool_worker *workers;
+  pthread_mutex_t sleep_lock;
+  // signalled when a task is queued, broadcast when a group finishes
+  pthread_cond_t cond;
+  uint32_t num_queued;
+  bool stop;
+};
+
+static _Thread_local struct thread_pool *thread_pool__current_pool;
+static _Thread_local uint32_t thread_pool__current_idx;
+
+static struct thread_pool *thread_pool__global;
+
+static void thread_pool__push(struct thread_pool_deque *deque,
+                              struct thread_pool_task task) {
+  pthread_mutex_lock(&deque->lock);
+
+  if (deque->bottom - deque->top == deque->cap) {
+    uint32_t new_cap = deque->cap * 2;
+    struct thread_pool_task *tasks =
+        malloc(new_cap * sizeof(struct thread_pool_task));
+
+    for (uint32_t i = 0; i < deque->cap; i++) {
+      tasks[i] = deque->tasks[(deque->top + i) & (deque->cap - 1)];
+    }
+
+    free(deque->tasks);
+    deque->tasks = tasks;
+    deque->top = 0;
+    deque->bottom = deque->cap;
+    deque->cap = new_cap;
+  }
+
+  deque->tasks[deque->bottom & (deque->cap - 1)] = task;
+  deque->bottom++;
+
+  pthread_mutex_unlock(&deque->lock);
+}
+
+static bool thread_pool__pop(struct thread_pool_deque *deque,
+                             struct thread_pool_task *task) {
+  bool found = false;
+  pthread_mutex_lock(&deque->lock);
+
+  if (deque->bottom != deque->top) {
+    deque->bottom--;
+    *task = deque->tasks[deque->bottom & (deque->cap - 1)];
+    found = true;
+  }
+
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static bool thread_pool__steal(struct thread_pool_deque *deque,
+                               struct thread_pool_task *task) {
+  bool found = false;
+  pthread_mutex_lock(&deque->lock);
+
+  if (deque->bottom != deque->top) {
+    *task = deque->tasks[deque->top & (deque->cap - 1)];
+    deque->top++;
+    found = true;
+  }
+
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+/**
+ * Pop a task from the worker's own deque, or steal one from another worker.
+ */
+static bool thread_pool__find_task(struct thread_pool *pool, uint32_t idx,
+                                   struct thread_pool_task *task) {
+  if (__atomic_load_n(&pool->num_queued, __ATOMIC_ACQUIRE) == 0) {
+    return false;
+  }
+
+  bool found = thread_pool__pop(&pool->deques[idx], task);
+
+  for (uint32_t i = 1; !found && i < pool->num_workers; i++) {
+    found = thread_pool__steal(&pool->deques[(idx + i) % pool->num_workers],
+                               task);
+  }
+
+  if (found) {
+    __atomic_fetch_sub(&pool->num_queued, 1, __ATOMIC_ACQ_REL);
+  }
+
+  return found;
+}
+
+static void thread_pool__run_task(struct thread_pool *pool,
+                                  struct thread_pool_task task, uint32_t idx) {
+  task.fn(task.arg, idx);
+
+  if (__atomic_sub_fetch(&task.group->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_lock(&pool->sleep_lock);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->sleep_lock);
+  }
+}
+
+static void *thread_pool__worker_main(void *arg) {
+  struct thread_pool_worker *worker = arg;
+  struct thread_pool *pool = worker->pool;
+  struct thread_pool_task task;
+
+  thread_pool__current_pool = pool;
+  thread_pool__current_idx = worker->idx;
+
+  for (;;) {
+    if (thread_pool__find_task(pool, worker->idx, &task)) {
+      thread_pool__run_task(pool, task, worker->idx);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->sleep_lock);
+    while (__atomic_load_n(&pool->num_queued, __ATOMIC_ACQUIRE) == 0 &&
+           !pool->stop) {
+      pthread_cond_wait(&pool->cond, &pool->sleep_lock);
+    }
+    bool stop = pool->stop;
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    if (stop) {
+      PROFILE_THREAD_EXIT();
+      return NULL;
+    }
+  }
+}
+
+struct thread_pool *thread_pool_new(uint32_t num_workers) {
+  if (num_workers == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = online > 0 ? online : 1;
+  }
+
+  if (num_workers > THREAD_POOL_MAX_WORKERS) {
+    num_workers = THREAD_POOL_MAX_WORKERS;
+  }
+
+  struct thread_pool *pool = malloc(sizeof(struct thread_pool));
+  pool->num_workers = num_workers;
+  pool->deques = malloc(num_workers * sizeof(struct thread_pool_deque));
+  pool->workers = malloc(num_workers * sizeof(struct thread_pool_worker));
+  pool->num_queued = 0;
+  pool->stop = false;
+  pthread_mutex_init(&pool->sleep_lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  for (uint32_t i = 0; i < num_workers; i++) {
+    struct thread_pool_deque *deque = &pool->deques[i];
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->cap = thread_pool_initial_deque_cap;
+    deque->tasks = malloc(deque->cap * sizeof(struct thread_pool_task));
+    deque->top = 0;
+    deque->bottom = 0;
+  }
+
+  // worker 0 is whichever thread waits on the pool
+  for (uint32_t i = 1; i < num_workers; i++) {
+    pool->workers[i] = (struct thread_pool_worker){.pool = pool, .idx = i};
+    pthread_create(&pool->workers[i].thread, NULL, &thread_pool__worker_main,
+                   &pool->workers[i]);
+  }
+
+  return pool;
+}
+
+void thread_pool_free(struct thread_pool *pool) {
+  pthread_mutex_lock(&pool->sleep_lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->sleep_lock);
+
+  for (uint32_t i = 1; i < pool->num_workers; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+
+  for (uint32_t i = 0; i < pool->num_workers; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+  }
+
+  pthread_mutex_destroy(&pool->sleep_lock);
+  pthread_cond_destroy(&pool->cond);
+  free(pool->deques);
+  free(pool->workers);
+  free(pool);
+}
+
+uint32_t thread_pool_num_workers(struct thread_pool *pool) {
+  return pool->num_workers;
+}
+
+uint32_t thread_pool_current_worker(void) { return thread_pool__current_idx; }
+
+static uint32_t thread_pool__worker_idx(struct thread_pool *pool) {
+  return thread_pool__current_pool == pool ? thread_pool__current_idx : 0;
+}
+
+void thread_pool_submit(struct thread_pool *pool,
+                        struct thread_pool_group *group,
+                        void (*fn)(void *arg, uint32_t worker), void *arg) {
+  __atomic_fetch_add(&group->pending, 1, __ATOMIC_ACQ_REL);
+
+  thread_pool__push(&pool->deques[thread_pool__worker_idx(pool)],
+                    (struct thread_pool_task){fn, arg, group});
+  __atomic_fetch_add(&pool->num_queued, 1, __ATOMIC_ACQ_REL);
+
+  pthread_mutex_lock(&pool->sleep_lock);
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->sleep_lock);
+}
+
+void thread_pool_wait(struct thread_pool *pool,
+                      struct thread_pool_group *group) {
+  struct thread_pool *prev_pool = thread_pool__current_pool;
+  uint32_t prev_idx = thread_pool__current_idx;
+  uint32_t idx = thread_pool__worker_idx(pool);
+  struct thread_pool_task task;
+
+  thread_pool__current_pool = pool;
+  thread_pool__current_idx = idx;
+
+  while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+    if (thread_pool__find_task(pool, idx, &task)) {
+      thread_pool__run_task(pool, task, idx);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->sleep_lock);
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0 &&
+           __atomic_load_n(&pool->num_queued, __ATOMIC_ACQUIRE) == 0) {
+      pthread_cond_wait(&pool->cond, &pool->sleep_lock);
+    }
+    pthread_mutex_unlock(&pool->sleep_lock);
+  }
+
+  thread_pool__current_pool = prev_pool;
+  thread_pool__current_idx = prev_idx;
+}
+
+struct thread_pool *thread_pool_global(void) {
+  if (thread_pool__global == NULL) {
+    thread_pool__global = thread_pool_new(1);
+  }
+
+  return thread_pool__global;
+}
+
+void thread_pool_set_global_workers(uint32_t num_workers) {
+  if (thread_pool__global != NULL) {
+    thread_pool_free(thread_pool__global);
+  }
+
+  thread_pool__global = thread_pool_new(num_workers);
+}
@@ -0,0 +1,65 @@
+#ifndef __THREAD_POOL_H_
+#define __THREAD_POOL_H_
+
+// A persistent work stealing thread pool: every worker has its own deque of
+// tasks, it pops from the bottom of its own and steals from the top of the
+// others' when it runs out
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define THREAD_POOL_MAX_WORKERS 64
+
+struct thread_pool;
+
+/**
+ * Tasks submitted together that can be waited on together.
+ */
+struct thread_pool_group {
+  uint32_t pending;
+};
+
+/**
+ * Create a pool of `num_workers` workers (0 for one per online CPU, at most
+ * THREAD_POOL_MAX_WORKERS), the thread that waits on the pool is one of them so
+ * `num_workers - 1` threads are started. With a single worker every task runs
+ * on the waiting thread.
+ */
+struct thread_pool *thread_pool_new(uint32_t num_workers);
+
+void thread_pool_free(struct thread_pool *pool);
+
+uint32_t thread_pool_num_workers(struct thread_pool *pool);
+
+/**
+ * Index of the calling worker in its pool, 0 for the thread driving the pool.
+ */
+uint32_t thread_pool_current_worker(void);
+
+/**
+ * Queue `fn(arg, worker)` to run on the pool as part of `group`.
+ */
+void thread_pool_submit(struct thread_pool *pool,
+                        struct thread_pool_group *group,
+                        void (*fn)(void *arg, uint32_t worker), void *arg);
+
+/**
+ * Run tasks until every task of `group` has finished. Can be called from
+ * within a task, the waiting worker keeps running tasks meanwhile.
+ */
+void thread_pool_wait(struct thread_pool *pool,
+                      struct thread_pool_group *group);
+
+/**
+ * The pool shared by the systems and the parallel joins, single threaded until
+ * thread_pool_set_global_workers is called.
+ */
+struct thread_pool *thread_pool_global(void);
+
+/**
+ * Recreate the shared pool with `num_workers` workers, 0 for one per online
+ * CPU. Must not be called while the pool is running tasks.
+ */
+void thread_pool_set_global_workers(uint32_t num_workers);
+
+#endif // __THREAD_POOL_H_
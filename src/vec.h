@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocator.h"
 #include "common_macros.h"
 
 #define DEFINE_VECTOR(TYPE, TNAME)                                             \
@@ -13,8 +14,11 @@
     size_t cap;                                                                \
     size_t length;                                                             \
     TYPE *data;                                                                \
+    const struct allocator *alloc;                                             \
   };                                                                           \
   struct vector_##TNAME vector_##TNAME##_new(size_t);                          \
+  struct vector_##TNAME vector_##TNAME##_new_with_allocator(                   \
+      size_t, const struct allocator *);                                       \
   TYPE vector_##TNAME##_pop(struct vector_##TNAME *);                          \
   size_t vector_##TNAME##_push(struct vector_##TNAME *, TYPE);                 \
   TYPE vector_##TNAME##_index(struct vector_##TNAME *, size_t);                \
@@ -26,9 +30,13 @@
   size_t vector_##TNAME##_indexof(struct vector_##TNAME *, TYPE);
 
 #define MAKE_VECTOR(TYPE, TNAME)                                               \
+  struct vector_##TNAME vector_##TNAME##_new_with_allocator(                   \
+      size_t initial, const struct allocator *alloc) {                         \
+    TYPE *data = allocator_alloc(alloc, sizeof(TYPE) * initial);               \
+    return (struct vector_##TNAME){initial, 0, data, alloc};                   \
+  }                                                                            \
   struct vector_##TNAME vector_##TNAME##_new(size_t initial) {                 \
-    TYPE *data = malloc(sizeof(TYPE) * initial);                               \
-    return (struct vector_##TNAME){initial, 0, data};                          \
+    return vector_##TNAME##_new_with_allocator(initial, &allocator_heap);      \
   }                                                                            \
   TYPE vector_##TNAME##_pop(struct vector_##TNAME *vec) {                      \
     if (DEBUG_ONLY(vec->length == 0)) {                                        \
@@ -43,7 +51,9 @@
       size_t new_len = 1 + vec->cap + (vec->cap >> 2);                         \
       DEBUG_LOG("growing vec(%p) from %ld to %ld", (void *)vec, vec->cap,      \
                 new_len);                                                      \
-      vec->data = realloc(vec->data, new_len * sizeof(TYPE));                  \
+      vec->data = allocator_realloc(vec->alloc, vec->data,                     \
+                                    vec->cap * sizeof(TYPE),                   \
+                                    new_len * sizeof(TYPE));                   \
       vec->cap = new_len;                                                      \
     }                                                                          \
     size_t inserted_idx = vec->length;                                         \
@@ -70,10 +80,14 @@
     return &vec->data[idx];                                                    \
   }                                                                            \
   void vector_##TNAME##_shrink_to_fit(struct vector_##TNAME *vec) {            \
-    vec->data = realloc(vec->data, vec->length * sizeof(TYPE));                \
+    vec->data = allocator_realloc(vec->alloc, vec->data,                       \
+                                  vec->cap * sizeof(TYPE),                     \
+                                  vec->length * sizeof(TYPE));                 \
     vec->cap = vec->length;                                                    \
   }                                                                            \
-  void vector_##TNAME##_free(struct vector_##TNAME *vec) { free(vec->data); }  \
+  void vector_##TNAME##_free(struct vector_##TNAME *vec) {                     \
+    allocator_free(vec->alloc, vec->data, vec->cap * sizeof(TYPE));            \
+  }                                                                            \
   void vector_##TNAME##_remove(struct vector_##TNAME *vec, size_t idx) {       \
     if (DEBUG_ONLY(idx < 0 || idx >= vec->length)) {                           \
       RUNTIME_ERROR("Indexing vector out of bounds");                          \
@@ -0,0 +1,60 @@
+#include <stdlib.h>
+
+#include "command_buffer.h"
+#include "common_macros.h"
+#include "component.h"
+#include "entity.h"
+#include "query.h"
+#include "system.h"
+#include "world.h"
+
+struct world world__default;
+_Thread_local struct world *world__current = &world__default;
+
+static void world__init(struct world *world) {
+  entity__world_init(world);
+  component__world_init(world);
+  archetype__world_init(world);
+  change__world_init(world);
+  command_buffer__world_init(world);
+  query__world_init(world);
+  system__world_init(world);
+}
+
+struct world *world_new(void) {
+  struct world *world = calloc(1, sizeof(struct world));
+  world->pool = thread_pool_new(1);
+  world__init(world);
+  return world;
+}
+
+void world_free(struct world *world) {
+  if (world == &world__default) {
+    RUNTIME_ERROR("The default world can't be freed");
+  }
+
+  component__world_free(world);
+  system__world_free(world);
+  query__world_free(world);
+  command_buffer__world_free(world);
+  change__world_free(world);
+  archetype__world_free(world);
+  entity__world_free(world);
+  thread_pool_free(world->pool);
+  free(world);
+}
+
+struct world *world_enter(struct world *world) {
+  struct world *prev = world__current;
+  world__current = world;
+  return prev;
+}
+
+struct thread_pool *world_thread_pool(void) {
+  struct world *world = world__current;
+  return world->pool ? world->pool : thread_pool_global();
+}
+
+// before the components' constructors, they put their storages in it
+static void world_init(void) __attribute__((constructor(101)));
+static void world_init(void) { world__init(&world__default); }
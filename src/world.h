@@ -0,0 +1,94 @@
+#ifndef __WORLD_H_
+#define __WORLD_H_
+
+// Worlds: independent simulations in one process. A world owns its entities,
+// the storage of every component, the change lists, the queries' matches and
+// the system schedule. Everything the library does happens in the calling
+// thread's current world, the default one unless another was entered
+
+#include <stdint.h>
+
+#include "archetype.h"
+#include "thread_pool.h"
+
+// state every module keeps per world, created and freed by the module along
+// with the world (see the `*__world_init` of each)
+struct entity_world;
+struct component_world;
+struct archetype_world;
+struct change_world;
+struct command_buffer_world;
+struct query_world;
+struct system_world;
+
+struct world {
+  // storage of every registered component, by component id, see
+  // COMPONENT_STORAGE
+  void *storages[COMPONENT_MAX];
+  struct entity_world *entities;
+  struct component_world *components;
+  struct archetype_world *archetypes;
+  struct change_world *changes;
+  struct command_buffer_world *command_buffers;
+  struct query_world *queries;
+  struct system_world *systems;
+  // pool the systems and parallel joins run on, NULL for the shared one
+  struct thread_pool *pool;
+};
+
+extern struct world world__default;
+extern _Thread_local struct world *world__current;
+
+/**
+ * Create a world with no entities, every registered component gets an empty
+ * storage in it. It has a pool of its own with a single worker, see
+ * system_set_num_workers.
+ */
+struct world *world_new(void);
+
+/**
+ * Free a world created with world_new and everything in it. It mustn't be the
+ * current world of any thread.
+ */
+void world_free(struct world *world);
+
+/**
+ * The world every thread starts in, the one programs that never create a world
+ * use. Its systems and parallel joins run on the shared thread pool.
+ */
+static inline struct world *world_default(void) { return &world__default; }
+
+/**
+ * The world the calling thread works in.
+ */
+static inline struct world *world_current(void) { return world__current; }
+
+/**
+ * Make `world` the calling thread's current world, returns the one it was
+ * before. A world should only be current on one thread at a time (plus the
+ * workers of its pool), worlds on different threads share nothing.
+ */
+struct world *world_enter(struct world *world);
+
+/**
+ * The pool of the current world.
+ */
+struct thread_pool *world_thread_pool(void);
+
+/**
+ * Run the body in `WORLD`, then go back to the world the thread was in. Don't
+ * `return` from the body.
+ *
+ * Usage:
+ * WITH_WORLD(match, {
+ *   FOR_JOIN_COMPONENT_2(position, velocity, d, { ... });
+ * });
+ */
+#define WITH_WORLD(WORLD, ...)                                                 \
+  do {                                                                         \
+    struct world *world_prev = world_enter(WORLD);                             \
+    { __VA_ARGS__ }                                                            \
+    world_enter(world_prev);                                                   \
+  } while (0)
+
+#endif // __WORLD_H_